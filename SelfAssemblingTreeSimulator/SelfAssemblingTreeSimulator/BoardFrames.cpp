@@ -0,0 +1,88 @@
+#include "BoardFrames.h"
+#include "BoardObject.h"
+
+TraceCell makeTraceCell(const Cell& cell)
+{
+	TraceCell traceCell;
+	traceCell.symbol = cell.m_symbol;
+	traceCell.flags = (uint8_t)(cell.m_cellType & TRACE_CELL_TYPE_MASK) | (cell.isFree() ? TRACE_CELL_FREE : 0) | (cell.m_isRented ? TRACE_CELL_RENTED : 0);
+	return traceCell;
+}
+
+static bool operator!=(const TraceCell& a, const TraceCell& b)
+{
+	return a.symbol != b.symbol || a.flags != b.flags;
+}
+
+bool BoardFramesWriter::open(const char* fileName, const int keyframeInterval, const uint64_t resumeOffset)
+{
+	m_keyframeInterval = keyframeInterval;
+	m_isKeyframeRequested = true;
+	m_frameCells.clear();
+	m_isCellChanged.clear();
+	m_changedCells.clear();
+	m_isAllChanged = true;
+	return m_trace.open(fileName, resumeOffset);
+}
+
+void BoardFramesWriter::writeFrame(const CellGrid& board, const int step)
+{
+	const bool isKeyframeDue = m_keyframeInterval > 0 && step - m_lastKeyframeStep >= m_keyframeInterval;
+	if (m_isKeyframeRequested || isKeyframeDue || (int)m_frameCells.size() != board.getNumCells())
+	{
+		writeKeyframe(board, step);
+		return;
+	}
+
+	m_frameChanges.clear();
+	const auto addChangeIfAny = [&](const int cellIndex)
+	{
+		const TraceCell traceCell = makeTraceCell(board.at(cellIndex));
+		if (traceCell != m_frameCells[cellIndex])
+		{
+			m_frameCells[cellIndex] = traceCell;
+			m_frameChanges.push_back({ cellIndex, traceCell, {} });
+		}
+	};
+
+	// Marked cells can be modified back by the end of the step, e.g. by a rolled back transaction, so they are compared with the previous frame
+	if (m_isAllChanged)
+	{
+		for (int cellIndex = 0; cellIndex < board.getNumCells(); cellIndex++)
+			addChangeIfAny(cellIndex);
+	}
+	else
+	{
+		for (const int cellIndex : m_changedCells)
+			addChangeIfAny(cellIndex);
+	}
+
+	for (const int cellIndex : m_changedCells)
+		m_isCellChanged[cellIndex] = false;
+	m_changedCells.clear();
+	m_isAllChanged = false;
+
+	if (m_frameChanges.empty())
+		return;
+
+	const TraceRecord record = { TRACE_FRAME, step, board.getNumRows(), board.getNumCols(), (int32_t)m_frameChanges.size(), 0, 0.0f };
+	m_trace.write(record);
+	m_trace.write(m_frameChanges);
+}
+
+void BoardFramesWriter::writeKeyframe(const CellGrid& board, const int step)
+{
+	m_frameCells.resize(board.getNumCells());
+	for (int cellIndex = 0; cellIndex < board.getNumCells(); cellIndex++)
+		m_frameCells[cellIndex] = makeTraceCell(board.at(cellIndex));
+
+	m_isCellChanged.assign(board.getNumCells(), false);
+	m_changedCells.clear();
+	m_isAllChanged = false;
+	m_isKeyframeRequested = false;
+	m_lastKeyframeStep = step;
+
+	const TraceRecord record = { TRACE_KEYFRAME, step, board.getNumRows(), board.getNumCols(), 0, 0, 0.0f };
+	m_trace.write(record);
+	m_trace.write(m_frameCells);
+}
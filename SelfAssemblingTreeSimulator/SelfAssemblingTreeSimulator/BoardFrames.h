@@ -0,0 +1,65 @@
+#ifndef BOARD_FRAMES_H
+#define BOARD_FRAMES_H
+
+#include "Trace.h"
+#include <vector>
+
+struct Cell;
+struct CellGrid;
+
+// The state of a cell as written in the traces
+TraceCell makeTraceCell(const Cell& cell);
+
+// Stream of the board over time, for visualization. A frame holds only the cells changed since the previous frame (TRACE_FRAME),
+// and every keyframeInterval steps all of them (TRACE_KEYFRAME), so a viewer can start from any keyframe.
+// The board tells the cells it modifies (see BoardObject::markSymbolModified), so the cost of a frame and its size follow the changes, not the board area
+class BoardFramesWriter
+{
+public:
+	BoardFramesWriter() = default;
+
+	// Starts a new stream, or continues one from resumeOffset. The first frame written is a keyframe
+	bool open(const char* fileName, const int keyframeInterval, const uint64_t resumeOffset = 0);
+	void close() { m_trace.close(); }
+	bool isOpen() const { return m_trace.isOpen(); }
+
+	void markCellChanged(const int cellIndex)
+	{
+		if (m_isAllChanged || m_isCellChanged[cellIndex])
+			return;
+
+		m_isCellChanged[cellIndex] = true;
+		m_changedCells.push_back(cellIndex);
+	}
+
+	void markAllCellsChanged() { m_isAllChanged = true; }
+
+	// The next frame is a keyframe. Requested on each checkpoint, so a resumed stream continues the same as the original one
+	void requestKeyframe() { m_isKeyframeRequested = true; }
+
+	// Writes the frame of the step: a keyframe if one is due, or else the marked cells that are different than in the previous frame, if any
+	void writeFrame(const CellGrid& board, const int step);
+
+	// Waits until the written frames are in the file and returns its size
+	uint64_t flush() { return m_trace.flush(); }
+
+private:
+	BoardFramesWriter(const BoardFramesWriter& other) = delete;
+	void operator=(const BoardFramesWriter& other) = delete;
+
+	void writeKeyframe(const CellGrid& board, const int step);
+
+	TraceWriter m_trace;
+	int m_keyframeInterval = 0;
+	int m_lastKeyframeStep = 0;
+	bool m_isKeyframeRequested = true;
+
+	std::vector<TraceCell> m_frameCells; // The cells as of the last frame
+	std::vector<char> m_isCellChanged;
+	std::vector<int> m_changedCells; // Marked since the last frame
+	bool m_isAllChanged = true;
+
+	std::vector<TraceCellChange> m_frameChanges; // Reused between the frames
+};
+
+#endif
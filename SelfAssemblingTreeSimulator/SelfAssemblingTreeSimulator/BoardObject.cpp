@@ -3,13 +3,28 @@
 #include <unordered_map>
 #include <assert.h>
 #include "ExprGenerator.h"
+#include "TaskPool.h"
+#include "EvaluationCache.h"
 #include <algorithm>
 #include <stack>
+#include <queue>
+#include <sstream>
 #include <algorithm>
 #include <set>
+#include <string.h>
+#include <cmath>
 
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#ifdef _WIN32
 #define NOMINMAX
 #include <windows.h>
+static void setConsoleTextColor(const WORD color) { SetConsoleTextAttribute(GetStdHandle(STD_OUTPUT_HANDLE), color); }
+#else
+static void setConsoleTextColor(const int color) {} // Console colors are available only on Windows
+#endif
 
 using namespace std;
 
@@ -21,89 +36,309 @@ extern int g_minNodesOnRandomTree;
 extern int g_powerChangeFrequency;
 extern float g_maxPowerVelocityPerTick;
 extern int g_maxFlowPerCell;
+extern float g_minSourceInfluence;
 extern bool variableSourcesPower;
-extern std::regex g_colRXExpr;
-extern std::regex g_rowRXExpr;
+extern Expression_DFA g_colExprDFA;
+extern Expression_DFA g_rowExprDFA;
 extern int g_maxResourcesToRent;
 
 extern bool g_verboseLocalSolutions;
 extern bool g_verboseBestGatheredSolutions;
 extern float g_energyLossThreshold;
 
-extern std::ostream* g_debugLogOutput;
+extern thread_local std::ostream* g_debugLogOutput;
 
 BoardObject::~BoardObject()
 {
 }
 
-bool BoardObject::addSource(const TablePos& pos, const SourceInfo& sourceInfo)
+uint64_t SourcesTable::getNewVersion()
+{
+	static std::atomic<uint64_t> lastVersion(0);
+	return ++lastVersion;
+}
+
+SourceInfo SourcesTable::getInfo(const int index) const
+{
+	SourceInfo info;
+	info.setCurrentPower(m_currentPowers[index]);
+	info.setPowerTarget(m_targetPowers[index]);
+	return info;
+}
+
+int SourcesTable::getGridIndex(const TablePos& pos) const
+{
+	if (pos.row >= 0 && pos.row < m_gridRows && pos.col >= 0 && pos.col < m_gridCols)
+		return pos.row * m_gridCols + pos.col;
+
+	return INVALID_POS;
+}
+
+int SourcesTable::find(const TablePos& pos) const
+{
+	const int gridIndex = getGridIndex(pos);
+	if (gridIndex != INVALID_POS)
+		return m_indexByCell[gridIndex];
+
+	for (int index = 0; index < (int)m_positions.size(); index++)
+	{
+		if (m_positions[index] == pos)
+			return index;
+	}
+
+	return INVALID_POS;
+}
+
+void SourcesTable::add(const TablePos& pos, const SourceInfo& info)
 {
-	auto it = m_posToSourceMap.find(pos);
-	if (it != m_posToSourceMap.end())
+	assert(find(pos) == INVALID_POS && "This source is already added !");
+
+	if (m_indexByCell.empty())
 	{
-		//assert(false && "This source is already added !");
-		// Just change the power
-		it->second.overridePower(sourceInfo.getPower());
-		return true;
+		m_gridRows = g_boardRows;
+		m_gridCols = g_boardCols;
+		m_indexByCell.assign(m_gridRows * m_gridCols, INVALID_POS);
 	}
 
-	m_posToSourceMap.insert(std::make_pair(pos, sourceInfo));
+	const int gridIndex = getGridIndex(pos);
+	if (gridIndex != INVALID_POS)
+	{
+		m_indexByCell[gridIndex] = (int)m_positions.size();
+	}
 
-	return true;
+	m_positions.push_back(pos);
+	m_currentPowers.push_back(info.getPower());
+	m_targetPowers.push_back(info.getTarget());
 }
 
-bool BoardObject::modifySource(const TablePos& pos, const SourceInfo& sourceInfo)
+void SourcesTable::removeAt(const int index)
 {
-	auto it = m_posToSourceMap.find(pos);
-	if (it == m_posToSourceMap.end())
+	const int lastIndex = (int)m_positions.size() - 1;
+	assert(index >= 0 && index <= lastIndex);
+
+	const int removedGridIndex = getGridIndex(m_positions[index]);
+	if (removedGridIndex != INVALID_POS)
 	{
-		assert(false && "This source doesn't exist can't update !");
-		return false;
+		m_indexByCell[removedGridIndex] = INVALID_POS;
 	}
 
-	it->second = sourceInfo;
-	return true;
+	if (index != lastIndex)
+	{
+		m_positions[index] = m_positions[lastIndex];
+		m_currentPowers[index] = m_currentPowers[lastIndex];
+		m_targetPowers[index] = m_targetPowers[lastIndex];
+
+		const int movedGridIndex = getGridIndex(m_positions[index]);
+		if (movedGridIndex != INVALID_POS)
+		{
+			m_indexByCell[movedGridIndex] = index;
+		}
+	}
+
+	m_positions.pop_back();
+	m_currentPowers.pop_back();
+	m_targetPowers.pop_back();
 }
 
-bool BoardObject::removeSource(const TablePos& pos, const bool allSources)
+void SourcesTable::clear()
+{
+	for (const TablePos& pos : m_positions)
+	{
+		const int gridIndex = getGridIndex(pos);
+		if (gridIndex != INVALID_POS)
+		{
+			m_indexByCell[gridIndex] = INVALID_POS;
+		}
+	}
+
+	m_positions.clear();
+	m_currentPowers.clear();
+	m_targetPowers.clear();
+}
+
+int SourcesInfluenceField::getRowIndex(const TablePos& srcPos) const
 {
-	if (allSources)
+	if (srcPos.row >= 0 && srcPos.row < numRows && srcPos.col >= 0 && srcPos.col < numCols)
+		return rowIndexByCell[srcPos.row * numCols + srcPos.col];
+
+	// Sources can be outside the board
+	for (uint rowIndex = 0; rowIndex < rowSourcePos.size(); rowIndex++)
 	{
-		m_posToSourceMap.clear();
+		if (rowSourcePos[rowIndex] == srcPos)
+			return rowIndex;
 	}
-	else
+
+	return INVALID_POS;
+}
+
+const SourcesInfluenceField& BoardObject::getSourcesInfluenceField() const
+{
+	SourcesTable& sources = *m_sources;
+	const int numRows = m_board.getNumRows();
+	const int numCols = m_board.getNumCols();
+
+	const SourcesInfluenceField* oldField = sources.m_influenceField.get();
+	if (oldField && oldField->layoutVersion == sources.m_layoutVersion)
+		return *oldField;
+
+	// The sources that didn't move keep their rows
+	const bool canReuseRows = oldField && oldField->numRows == numRows && oldField->numCols == numCols;
+
+	std::shared_ptr<SourcesInfluenceField> field = std::make_shared<SourcesInfluenceField>();
+	field->layoutVersion = sources.m_layoutVersion;
+	field->numRows = numRows;
+	field->numCols = numCols;
+	field->maxDistance = 0;
+	field->rowIndexByCell.assign(numRows * numCols, INVALID_POS);
+
+	for (int srcIndex = 0; srcIndex < sources.getNumSources(); srcIndex++)
+	{
+		const TablePos& srcPos = sources.getPos(srcIndex);
+		const int oldRowIndex = canReuseRows ? oldField->getRowIndex(srcPos) : INVALID_POS;
+
+		std::shared_ptr<const SourcesInfluenceField::SourceRow> row;
+		if (oldRowIndex != INVALID_POS)
+		{
+			row = oldField->rows[oldRowIndex];
+		}
+		else
+		{
+			std::shared_ptr<SourcesInfluenceField::SourceRow> newRow = std::make_shared<SourcesInfluenceField::SourceRow>();
+			newRow->distance.resize(numRows * numCols);
+			newRow->unitInfluence.resize(numRows * numCols);
+			newRow->maxDistance = 0;
+			for (int cellRow = 0; cellRow < numRows; cellRow++)
+			{
+				for (int cellCol = 0; cellCol < numCols; cellCol++)
+				{
+					const int cellIndex = cellRow * numCols + cellCol;
+					const int dist = manhattanDist(srcPos, TablePos(cellRow, cellCol));
+					const float distF = (float)dist;
+					newRow->distance[cellIndex] = dist;
+					newRow->unitInfluence[cellIndex] = 1.0f / (distF * distF);
+					newRow->maxDistance = std::max(newRow->maxDistance, dist);
+				}
+			}
+
+			row = newRow;
+		}
+
+		if (srcPos.row >= 0 && srcPos.row < numRows && srcPos.col >= 0 && srcPos.col < numCols)
+		{
+			field->rowIndexByCell[srcPos.row * numCols + srcPos.col] = (int)field->rows.size();
+		}
+
+		field->maxDistance = std::max(field->maxDistance, row->maxDistance);
+		field->rows.push_back(row);
+		field->rowSourcePos.push_back(srcPos);
+	}
+
+	sources.m_influenceField = field;
+	return *field;
+}
+
+bool BoardObject::applySourceEvent(const SourceEvent& event, bool& outLayoutModified)
+{
+	SourcesTable& sources = *m_sources;
+	const TablePos& pos = event.pos;
+
+	switch (event.type)
+	{
+	case Cell::EVENT_SOURCE_ADD:
 	{
-		auto it = m_posToSourceMap.find(pos);
-		if (it == m_posToSourceMap.end())
+		journalSource(pos);
+
+		const int srcIndex = sources.find(pos);
+		if (srcIndex != INVALID_POS)
+		{
+			//assert(false && "This source is already added !");
+			// Just change the power
+			SourceInfo info = sources.getInfo(srcIndex);
+			info.overridePower(event.info.getPower());
+			sources.setInfo(srcIndex, info);
+			return true;
+		}
+
+		sources.add(pos, event.info);
+		outLayoutModified = true;
+		return true;
+	}
+
+	case Cell::EVENT_SOURCE_MODIFY:
+	{
+		const int srcIndex = sources.find(pos);
+		if (srcIndex == INVALID_POS)
 		{
-			//assert(false && "This source doesn't exist can't delete it !");
+			assert(false && "This source doesn't exist can't update !");
 			return false;
 		}
 
-		m_posToSourceMap.erase(it);
+		journalSource(pos);
+		sources.setInfo(srcIndex, event.info);
+		return true;
 	}
 
-	return true;
+	case Cell::EVENT_SOURCE_REMOVE:
+	{
+		if (event.allSources)
+		{
+			for (int srcIndex = 0; srcIndex < sources.getNumSources(); srcIndex++)
+			{
+				journalSource(sources.getPos(srcIndex));
+			}
+
+			sources.clear();
+		}
+		else
+		{
+			const int srcIndex = sources.find(pos);
+			if (srcIndex == INVALID_POS)
+			{
+				//assert(false && "This source doesn't exist can't delete it !");
+				return false;
+			}
+
+			journalSource(pos);
+			sources.removeAt(srcIndex);
+		}
+
+		outLayoutModified = true;
+		return true;
+	}
+
+	default:
+		assert(false);
+	}
+
+	return false;
+}
+
+bool BoardObject::addSource(const TablePos& pos, const SourceInfo& sourceInfo)
+{
+	return propagateSourceEvents(SourceEventsBatch(1, SourceEvent(Cell::EVENT_SOURCE_ADD, pos, sourceInfo)));
+}
+
+bool BoardObject::modifySource(const TablePos& pos, const SourceInfo& sourceInfo)
+{
+	return propagateSourceEvents(SourceEventsBatch(1, SourceEvent(Cell::EVENT_SOURCE_MODIFY, pos, sourceInfo)));
+}
+
+bool BoardObject::removeSource(const TablePos& pos, const bool allSources)
+{
+	return propagateSourceEvents(SourceEventsBatch(1, SourceEvent(Cell::EVENT_SOURCE_REMOVE, pos, SourceInfo(), allSources)));
 }
 
 TablePos BoardObject::selectRandomSource() const
 {
-	if (m_posToSourceMap.empty())
+	const SourcesTable& sources = getSources();
+	if (sources.isEmpty())
 	{
 		assert(false);
 		TablePos invalidPos(INVALID_POS, INVALID_POS);
 		return invalidPos;
 	}
-	// Choose a bucket
-	int bucket, bucket_size;
-	do
-	{
-		bucket = (int)randRange(0, (int)m_posToSourceMap.bucket_count() - 1);
-	} while ((bucket_size = (int)m_posToSourceMap.bucket_size(bucket)) == 0);
 
-	// Normally this should be very small if the hash function is working properly
-	auto element = std::next(m_posToSourceMap.begin(bucket), randRange(0, bucket_size - 1));
-	return element->first;
+	return sources.getPos(randIndex(sources.getNumSources()));
 }
 
 float BoardObject::computeScoreForLeafAndSource(const TablePos& leafPos, const TablePos& srcPos, const SourceInfo& srcInfo) const
@@ -160,20 +395,44 @@ void BoardObject::updateBoardAfterSymbolsInit()
 
 void BoardObject::updateInternalCellsInfo()
 {
-	// Reset all links first
-	for (int i = 0; i < MAX_ROWS; i++)
-		for (int j = 0; j < MAX_COLS; j++)
+#if RUNMODE == DIRECTIONAL_MODE
+	// Reset all links first. The occupied and linked cells are touched below
+	for (int i = 0; i < g_boardRows; i++)
+		for (int j = 0; j < g_boardCols; j++)
 		{
+			Cell& cell = m_board[i][j];
+			bool isLinked = !cell.isFree();
 			for (int dirIter = 0; dirIter < DIR_COUNT; dirIter++)
 			{
-				(*m_board[i][j].m_followersByDir[dirIter]) = nullptr;
-				(*m_board[i][j].m_previousByDir[dirIter]) = nullptr;
+				isLinked = isLinked || *cell.m_followersByDir[dirIter] != nullptr || *cell.m_previousByDir[dirIter] != nullptr;
+				(*cell.m_followersByDir[dirIter]) = nullptr;
+				(*cell.m_previousByDir[dirIter]) = nullptr;
 			}
-		}
 
+			if (isLinked)
+			{
+				journalCell(cell);
+			}
+		}
+#else
+	// Reset the links of the previous tree first. The new tree is journaled while linked
+	journalLinkedCells();
+	for (const int cellIndex : m_linkedCells)
+	{
+		Cell& cell = m_board.at(cellIndex);
+		journalCell(cell);
+		for (int dirIter = 0; dirIter < DIR_COUNT; dirIter++)
+		{
+			(*cell.m_followersByDir[dirIter]) = nullptr;
+			(*cell.m_previousByDir[dirIter]) = nullptr;
+		}
+	}
+	m_linkedCells.clear();
+#endif
 
 	// Start from root node
 	Cell* rootCell = getRootCell();
+	journalCell(*rootCell);
 	rootCell->m_distanceToRoot = 0;
 
 	rootCell->m_row = m_rootRow;
@@ -183,6 +442,10 @@ void BoardObject::updateInternalCellsInfo()
 	m_rentedResources.clear();
 
 #if RUNMODE == DIRECTIONAL_MODE
+	// The cell types are decided again from the membrane
+	if (m_framesWriter)
+		m_framesWriter->markAllCellsChanged();
+
 	// Points where the direction is changed
 	std::vector<TablePos> inflexionPoints;
 	getInflexionPointAndConnectMembrane(inflexionPoints);
@@ -230,13 +493,16 @@ void BoardObject::updateInternalCellsInfo()
 #endif
 
 #else
-	internalCreateLinks(rootCell, DIR_LEFT, 0, MAX_COLS - 2);
-	internalCreateLinks(rootCell, DIR_DOWN, 1, MAX_COLS - 1);
+	m_linkedCells.push_back(m_rootRow * m_board.getNumCols() + m_rootCol);
+	internalCreateLinks(rootCell, DIR_LEFT, 0, g_boardCols - 2);
+	internalCreateLinks(rootCell, DIR_DOWN, 1, g_boardCols - 1);
 #endif
 
 	Cell* rootNode = getRootCell();
 	rootNode->m_row = m_rootRow;
 	rootNode->m_column = m_rootCol;
+
+	m_linksVersion++;
 }
 
 #if RUNMODE == DIRECTIONAL_MODE
@@ -479,6 +745,9 @@ void BoardObject::internalCreateLinks(Cell* prevCell, const DIRECTION dir, const
 	if (currCell->isFree())
 		return;
 
+	journalCell(*currCell);
+	m_linkedCells.push_back(row * m_board.getNumCols() + col);
+
 	// If rented, mark it accordingly
 	if (currCell->isRented())
 	{
@@ -526,9 +795,17 @@ void BoardObject::internalCreateLinks(Cell* prevCell, const DIRECTION dir, const
 
 void BoardObject::copyDataFrom(const BoardObject& other)
 {
+	assert(!isInTransaction() && "Can't copy into a board with an open transaction");
+	m_board.resize(other.m_board.getNumRows(), other.m_board.getNumCols());
+	m_languageDirtyRows = other.m_languageDirtyRows;
+	m_languageDirtyCols = other.m_languageDirtyCols;
+	m_zobristRowHashes = other.m_zobristRowHashes;
+	m_zobristDirtyRows = other.m_zobristDirtyRows;
+	m_cellsZobristHash = other.m_cellsZobristHash;
+
 	// If this is the same object, don't do anything !
-	for (int i = 0; i < MAX_ROWS; i++)
-		for (int j = 0; j < MAX_ROWS; j++)
+	for (int i = 0; i < m_board.getNumRows(); i++)
+		for (int j = 0; j < m_board.getNumCols(); j++)
 		{
 			m_board[i][j] = other.m_board[i][j];
 
@@ -536,6 +813,10 @@ void BoardObject::copyDataFrom(const BoardObject& other)
 			m_board[i][j].m_boardView = this;
 		}
 
+#if RUNMODE != DIRECTIONAL_MODE
+	m_linkedCells.clear(); // The copied cells have no links
+#endif
+
 	//#if RUNMODE == DIRECTIONAL_MODE
 	setRootLocation(other.m_rootRow, other.m_rootCol);
 	//#endif
@@ -546,34 +827,79 @@ void BoardObject::copyDataFrom(const BoardObject& other)
 
 	m_garbageCollectedResources = other.m_garbageCollectedResources;
 
+	// Copies get their own sources table (it could be shared with the snapshots broadcasted from the other board)
 	if (this != &other)
 	{
-		m_posToSourceMap.clear();
+		*m_sources = *other.m_sources;
 	}
 
-	m_posToSourceMap.insert(other.m_posToSourceMap.begin(), other.m_posToSourceMap.end());
-
 	m_rowGenerator = other.m_rowGenerator;
 	m_colGenerator = other.m_colGenerator;
 	m_numTicksRemainingToUpdateSources = other.m_numTicksRemainingToUpdateSources;
+
+	if (m_framesWriter)
+		m_framesWriter->markAllCellsChanged();
+}
+
+BoardSnapshotPtr BoardObject::createSnapshot() const
+{
+	std::shared_ptr<BoardObject> snapshot = std::make_shared<BoardObject>(*this);
+	snapshot->m_sources = m_sources;
+	return snapshot;
 }
 
 BoardObject::BoardObject()
-	: m_colGenerator(nullptr)
+	: m_sources(std::make_shared<SourcesTable>())
+	, m_colGenerator(nullptr)
 	, m_rowGenerator(nullptr)
 	, m_numTicksRemainingToUpdateSources(0)
 {
 #if RUNMODE == DIRECTIONAL_MODE
-	const int rootColumn = rand() % (MAX_COLS / 3);
-	const int rootRow = rand() % (MAX_ROWS / 3);
+	const int rootColumn = randInt() % (g_boardCols / 3);
+	const int rootRow = randInt() % (g_boardRows / 3);
 	setRootLocation(rootRow, rootColumn);
 #else
-	setRootLocation(0, MAX_COLS - 1);
+	setRootLocation(0, g_boardCols - 1);
+#endif
+
+	markAllSymbolsModified();
+}
+
+void CellGrid::resize(const int numRows, const int numCols)
+{
+	assert(numRows > 0 && numCols > 0 && "Invalid board dimensions");
+	if (numRows == m_numRows && numCols == m_numCols)
+		return;
+
+	delete[] m_cells;
+	m_cells = new Cell[numRows * numCols];
+	m_numRows = numRows;
+	m_numCols = numCols;
+}
+
+void BoardObject::resizeBoard(const int numRows, const int numCols)
+{
+	assert(!isInTransaction() && "Can't resize a board with an open transaction");
+	if (numRows != m_board.getNumRows() || numCols != m_board.getNumCols())
+	{
+		// New cells, with no links nor tick records
+#if RUNMODE != DIRECTIONAL_MODE
+		m_linkedCells.clear();
 #endif
+		m_cellTickRecords.clear();
+		m_dirtyTickCells.clear();
+		m_areAllTicksDirty = true;
+	}
+	m_board.resize(numRows, numCols);
+	markAllSymbolsModified();
 
+#if RUNMODE != DIRECTIONAL_MODE
+	setRootLocation(0, numCols - 1);
+#endif
 }
 
 BoardObject::BoardObject(const BoardObject& other)
+	: m_sources(std::make_shared<SourcesTable>())
 {
 	copyDataFrom(other);
 }
@@ -583,123 +909,810 @@ void BoardObject::operator=(const BoardObject& other)
 	copyDataFrom(other);
 }
 
-void BoardObject::resetCells(const bool resetSymbolsToo /*= true*/)
+void BoardObject::resetAndCopyFrom(const BoardObject& other)
 {
-	for (int i = 0; i < MAX_ROWS; i++)
+	assert(!isInTransaction() && "Can't copy into a board with an open transaction");
+
+	// Reset what copyDataFrom doesn't copy to the state of a new board
+	for (int i = 0; i < m_board.getNumCells(); i++)
 	{
-		for (int j = 0; j < MAX_COLS; j++)
-		{
-			m_board[i][j].reset(resetSymbolsToo);
-		}
+		m_board.at(i).resetAsNew();
 	}
-}
+	m_areAllTicksDirty = true; // The buffered data was reset
 
-void BoardObject::reset(const bool withoutStatistics, const bool resetSymbolsToo)
-{
-	resetCells(resetSymbolsToo);
+	m_rentedResources.clear();
+	m_SubtreeCut.reset();
+	m_remainingTicksUntilApplyCutSubtree = 0;
+	m_UseTicksToDelayDataFlowCapture = false;
+	m_membraneBoundsPerRow.clear();
+	m_membraneBoundsPerCol.clear();
+	m_membraneBoundsRows = m_membraneBoundsCols = std::pair<int, int>();
+
+	// The sources table can be shared with a snapshot of this board, which must keep it as it is
+	if (m_sources.use_count() > 1)
+	{
+		m_sources = std::make_shared<SourcesTable>();
+	}
 
-	m_posToSourceMap.clear();
-	m_numTicksRemainingToUpdateSources = g_powerChangeFrequency;
+	copyDataFrom(other);
+}
 
-	for (auto& keyValue : m_garbageCollectedResources)
+void BoardObject::beginTransaction()
+{
+	if (m_numOpenTransactions == (int)m_transactions.size())
 	{
-		m_garbageCollectedResources[keyValue.first] = 0;
+		m_transactions.emplace_back();
 	}
 
-	if (!withoutStatistics)
+	TransactionSavepoint& savepoint = m_transactions[m_numOpenTransactions++];
+	savepoint.stamp = ++m_lastTransactionStamp;
+	savepoint.numCellEntries = m_cellsJournal.size();
+	savepoint.numSourceEntries = m_sourcesJournal.size();
+	savepoint.sourcesVersion = m_sources->m_version;
+	savepoint.sourcesLayoutVersion = m_sources->m_layoutVersion;
+
+	savepoint.rootRow = m_rootRow;
+	savepoint.rootCol = m_rootCol;
+	savepoint.rentedResources = m_rentedResources;
+	savepoint.garbageCollectedResources = m_garbageCollectedResources;
+	savepoint.subtreeCut = m_SubtreeCut;
+	savepoint.remainingTicksUntilApplyCutSubtree = m_remainingTicksUntilApplyCutSubtree;
+	savepoint.useTicksToDelayDataFlowCapture = m_UseTicksToDelayDataFlowCapture;
+	savepoint.numTicksRemainingToUpdateSources = m_numTicksRemainingToUpdateSources;
+
+	savepoint.membraneBoundsPerRow = m_membraneBoundsPerRow;
+	savepoint.membraneBoundsPerCol = m_membraneBoundsPerCol;
+	savepoint.membraneBoundsRows = m_membraneBoundsRows;
+	savepoint.membraneBoundsCols = m_membraneBoundsCols;
+
+	// The statistics object moves with the root, so it is enough to save the one of the current root
+	savepoint.rootStatistics = isCoordinateValid(m_rootRow, m_rootCol) ? getRootCell()->m_flowStatistics : nullptr;
+	if (savepoint.rootStatistics)
 	{
-		getRootCell()->initFlowStatistics(g_simulationTicksForDataFlowEstimation);
+		savepoint.rootStatistics->saveRecords(savepoint.rootStatisticsRecords);
 	}
+
+#if RUNMODE != DIRECTIONAL_MODE
+	savepoint.isLinkedCellsSaved = false;
+#endif
 }
 
-float BoardObject::doDataFlowSimulation_serial_WITHOUT_SIDE_EFFECTS(const int ticksToSimulate)
+void BoardObject::applyTransaction()
 {
-	this->doDataFlowSimulation_serial(1, false);
-	const float baselineCurrentFlow = this->getLastSimulationAvgDataFlowPerUnit();
-	this->retractLastSimTickFlowRecord(); // Retract it since we don't propagate changes
+	assert(isInTransaction() && "There is no transaction to apply");
+	m_numOpenTransactions--;
 
-#if RUNMODE == DIRECTIONAL_MODE
-	Cell& cellBelowRoot = getRootCell()->m_boardView->m_board[m_rootRow - 1][m_rootCol];
-	cellBelowRoot.resetCapacityUsedInSubtree();
-#else
-	assert(false && " Not implemented yet");
+#if RUNMODE != DIRECTIONAL_MODE
+	// The enclosing transaction had the same linked cells when this one began, if it didn't save them itself
+	TransactionSavepoint& savepoint = m_transactions[m_numOpenTransactions];
+	if (m_numOpenTransactions > 0 && savepoint.isLinkedCellsSaved)
+	{
+		TransactionSavepoint& enclosingSavepoint = m_transactions[m_numOpenTransactions - 1];
+		if (!enclosingSavepoint.isLinkedCellsSaved)
+		{
+			enclosingSavepoint.linkedCells.swap(savepoint.linkedCells);
+			enclosingSavepoint.isLinkedCellsSaved = true;
+		}
+	}
 #endif
 
-	return baselineCurrentFlow;
+	// The journal entries of a nested transaction are kept since the enclosing one could still be rolled back
+	if (m_numOpenTransactions == 0)
+	{
+		m_cellsJournal.clear();
+		m_sourcesJournal.clear();
+	}
 }
 
-void BoardObject::doDataFlowSimulation_serial(const int ticksToSimulate, const bool isRealTick, const bool considerForStatistics /*=true*/)
+void BoardObject::rollbackTransaction()
 {
-	Cell* root = getRootCell();
-	root->beginSimulation();
+	assert(isInTransaction() && "There is no transaction to roll back");
+	const TransactionSavepoint& savepoint = m_transactions[m_numOpenTransactions - 1];
+
+	// Undo in reverse order, so a cell saved by several nested transactions ends up with its oldest state.
+	// The tree layout stays valid if no links are restored, and the cells tick again if their buffered data is restored
+	const uint64_t linksVersion = m_linksVersion;
+	bool areLinksRestored = false;
+	for (size_t i = m_cellsJournal.size(); i > savepoint.numCellEntries; i--)
+	{
+		const CellJournalEntry& entry = m_cellsJournal[i - 1];
+		Cell& cell = m_board.at(entry.index);
+		areLinksRestored = areLinksRestored || !cell.hasSameLinks(entry.state);
+		if (cell.getCurrentBufferedCap() != entry.state.bufferedData)
+			markTickDirty(entry.index);
+
+		cell.restoreState(entry.state);
+		markSymbolModified(entry.index / m_board.getNumCols(), entry.index % m_board.getNumCols());
+	}
 
-	for (int i = 0; i < ticksToSimulate; i++)
+	if (!areLinksRestored)
 	{
-		simulateTick_serial(considerForStatistics);
+		m_linksVersion = linksVersion;
+	}
+	m_cellsJournal.erase(m_cellsJournal.begin() + savepoint.numCellEntries, m_cellsJournal.end());
 
-		if (isRealTick)
+	for (size_t i = m_sourcesJournal.size(); i > savepoint.numSourceEntries; i--)
+	{
+		const SourceJournalEntry& entry = m_sourcesJournal[i - 1];
+		const int srcIndex = m_sources->find(entry.pos);
+		if (entry.existed)
 		{
-			updateSourcesPower();
+			if (srcIndex != INVALID_POS)
+				m_sources->setInfo(srcIndex, entry.info);
+			else
+				m_sources->add(entry.pos, entry.info);
 		}
-
-		// Check if exist a subtree that should be applied
-		SubtreeCutInfo subtree = root->m_boardView->m_SubtreeCut;
-		if (!subtree.isSubtreeCut)
+		else if (srcIndex != INVALID_POS)
 		{
-			return;
+			m_sources->removeAt(srcIndex);
 		}
+	}
+	m_sourcesJournal.erase(m_sourcesJournal.begin() + savepoint.numSourceEntries, m_sourcesJournal.end());
+	m_sources->m_version = savepoint.sourcesVersion;
+	m_sources->m_layoutVersion = savepoint.sourcesLayoutVersion;
+
+	m_rootRow = savepoint.rootRow;
+	m_rootCol = savepoint.rootCol;
+	m_rentedResources = savepoint.rentedResources;
+	m_garbageCollectedResources = savepoint.garbageCollectedResources;
+	m_SubtreeCut = savepoint.subtreeCut;
+	m_remainingTicksUntilApplyCutSubtree = savepoint.remainingTicksUntilApplyCutSubtree;
+	m_UseTicksToDelayDataFlowCapture = savepoint.useTicksToDelayDataFlowCapture;
+	m_numTicksRemainingToUpdateSources = savepoint.numTicksRemainingToUpdateSources;
+
+	m_membraneBoundsPerRow = savepoint.membraneBoundsPerRow;
+	m_membraneBoundsPerCol = savepoint.membraneBoundsPerCol;
+	m_membraneBoundsRows = savepoint.membraneBoundsRows;
+	m_membraneBoundsCols = savepoint.membraneBoundsCols;
+
+	if (savepoint.rootStatistics)
+	{
+		savepoint.rootStatistics->restoreRecords(savepoint.rootStatisticsRecords);
+	}
 
-		if (m_remainingTicksUntilApplyCutSubtree > 0)
-		{
-			if (--m_remainingTicksUntilApplyCutSubtree == 0)
-			{
-				int row = subtree.posAndScoreInfo.row;
-				int col = subtree.posAndScoreInfo.col;
-				const bool res = root->m_boardView->tryApplySubtree(row, col, subtree.subtreeInfo, true, true); // double check
-				assert(res && "[BoardObject::doDataFlowSimulation_serial] Couldn't apply the subtree cut!");
-
-				root->m_boardView->m_board[row][col].resetTicksToDelayDataFlowCapture();
-				root->m_boardView->m_SubtreeCut.reset();
-			}
-		}
+#if RUNMODE != DIRECTIONAL_MODE
+	if (savepoint.isLinkedCellsSaved)
+	{
+		m_linkedCells.swap(m_transactions[m_numOpenTransactions - 1].linkedCells);
 	}
+#endif
+
+	m_numOpenTransactions--;
 }
 
-void BoardObject::collectAllNodesFromRoot(const Cell* subtreeRoot, std::vector<Cell *>& outList, const CellType targetCellType /* = CELL_NOTSET */)
+void BoardObject::onBeforeCellModified(const int row, const int col)
 {
+	journalCellAndLinks(m_board[row][col]);
+	markSymbolModified(row, col);
+}
 
-	Cell* childrenList[DIR_COUNT];
-	subtreeRoot->fillChildrenList(childrenList);
+void BoardObject::markAllSymbolsModified()
+{
+	m_languageDirtyRows.assign(m_board.getNumRows(), true);
+	m_languageDirtyCols.assign(m_board.getNumCols(), true);
 
-	// Iterate over its external children and simulate tick to capture the flow out of them since they contains the leaf nodes
-	for (int childIter = 0; childIter < DIR_COUNT; childIter++)
-	{
-		Cell* child = childrenList[childIter];
-		if (child == nullptr || (targetCellType != CELL_NOTSET && (child->m_cellType != targetCellType)))
-			continue;
+	m_zobristRowHashes.assign(m_board.getNumRows(), 0);
+	m_zobristDirtyRows.assign(m_board.getNumRows(), true);
+	m_cellsZobristHash = 0;
+	m_linksVersion++;
 
-		outList.push_back(child);
+	if (m_framesWriter)
+		m_framesWriter->markAllCellsChanged();
+}
+
+void BoardObject::journalCell(Cell& cell)
+{
+	if (m_numOpenTransactions == 0)
+		return;
+
+	const uint stamp = m_transactions[m_numOpenTransactions - 1].stamp;
+	if (cell.m_journalStamp == stamp)
+		return;
+
+	const int index = (int)(&cell - &m_board.at(0));
+	assert(0 <= index && index < m_board.getNumCells() && "The cell doesn't belong to this board");
+
+	m_cellsJournal.emplace_back();
+	CellJournalEntry& entry = m_cellsJournal.back();
+	entry.index = index;
+	cell.saveState(entry.state);
+
+	cell.m_journalStamp = stamp;
+}
+
+void BoardObject::journalCellAndLinks(Cell& cell)
+{
+	if (m_numOpenTransactions == 0)
+		return;
+
+	journalCell(cell);
+
+	for (int dirIter = 0; dirIter < DIR_COUNT; dirIter++)
+	{
+		if (*cell.m_followersByDir[dirIter])
+			journalCell(**cell.m_followersByDir[dirIter]);
+
+		if (*cell.m_previousByDir[dirIter])
+			journalCell(**cell.m_previousByDir[dirIter]);
+	}
+
+#if RUNMODE != DIRECTIONAL_MODE
+	if (cell.m_parent)
+		journalCell(*cell.m_parent);
+#endif
+}
+
+void BoardObject::journalTreeCells()
+{
+	if (m_numOpenTransactions == 0 || !isCoordinateValid(m_rootRow, m_rootCol))
+		return;
+
+	// The root is updated even if it is not occupied yet
+	Cell* root = getRootCell();
+	journalCell(*root);
+
+	// Same walk as the structure messages, they stop when coming back to the root
+	std::vector<Cell*>& cellsToVisit = m_treeCellsToJournal;
+	cellsToVisit.clear();
+#if RUNMODE == DIRECTIONAL_MODE
+	cellsToVisit.push_back(&m_board[m_rootRow + 1][m_rootCol]);
+#else
+	cellsToVisit.push_back(root);
+#endif
+	while (!cellsToVisit.empty())
+	{
+		Cell* cell = cellsToVisit.back();
+		cellsToVisit.pop_back();
+		journalCell(*cell);
+
+		Cell* children[DIR_COUNT];
+		cell->fillChildrenList(children);
+		for (int childIter = 0; childIter < DIR_COUNT; childIter++)
+		{
+			if (children[childIter] && children[childIter] != root)
+				cellsToVisit.push_back(children[childIter]);
+		}
+	}
+}
+
+#if RUNMODE != DIRECTIONAL_MODE
+void BoardObject::journalLinkedCells()
+{
+	if (m_numOpenTransactions == 0)
+		return;
+
+	TransactionSavepoint& savepoint = m_transactions[m_numOpenTransactions - 1];
+	if (!savepoint.isLinkedCellsSaved)
+	{
+		savepoint.linkedCells = m_linkedCells;
+		savepoint.isLinkedCellsSaved = true;
+	}
+}
+#endif
+
+void BoardObject::journalAllCells()
+{
+	if (m_numOpenTransactions == 0)
+		return;
+
+	for (int i = 0; i < m_board.getNumCells(); i++)
+	{
+		journalCell(m_board.at(i));
+	}
+}
+
+void BoardObject::journalSource(const TablePos& pos)
+{
+	if (m_numOpenTransactions == 0)
+		return;
+
+	SourceJournalEntry entry;
+	entry.pos = pos;
+
+	const int srcIndex = m_sources->find(pos);
+	entry.existed = srcIndex != INVALID_POS;
+	if (entry.existed)
+	{
+		entry.info = m_sources->getInfo(srcIndex);
+	}
+
+	m_sourcesJournal.push_back(entry);
+}
+
+void BoardObject::resetCells(const bool resetSymbolsToo /*= true*/)
+{
+	journalAllCells();
+	markAllSymbolsModified(); // The rented flags are reset even if the symbols are kept
+
+	for (int i = 0; i < g_boardRows; i++)
+	{
+		for (int j = 0; j < g_boardCols; j++)
+		{
+			m_board[i][j].reset(resetSymbolsToo);
+		}
+	}
+}
+
+void BoardObject::reset(const bool withoutStatistics, const bool resetSymbolsToo)
+{
+	resetCells(resetSymbolsToo);
+
+	removeSource(TablePos(), true);
+	m_numTicksRemainingToUpdateSources = g_powerChangeFrequency;
+
+	for (auto& keyValue : m_garbageCollectedResources)
+	{
+		m_garbageCollectedResources[keyValue.first] = 0;
+	}
+
+	if (!withoutStatistics)
+	{
+		getRootCell()->initFlowStatistics(g_simulationTicksForDataFlowEstimation);
+	}
+}
+
+// Each part of the hash draws its keys from its own stream, at the index of the item hashed
+static const uint64_t ZOBRIST_CELLS_SEED = 0x5A0B0C311ULL;
+static const uint64_t ZOBRIST_ROOT_SEED = 0x5A0B0C322ULL;
+static const uint64_t ZOBRIST_SOURCES_SEED = 0x5A0B0C333ULL;
+static const uint64_t ZOBRIST_BUFFERED_DATA_SEED = 0x5A0B0C344ULL;
+
+static uint64_t getFloatBits(const float value)
+{
+	uint32_t bits = 0;
+	memcpy(&bits, &value, sizeof(bits));
+	return bits;
+}
+
+uint64_t BoardObject::getZobristHash() const
+{
+	const int numCols = m_board.getNumCols();
+	const RandomStream cellKeys(ZOBRIST_CELLS_SEED);
+	for (int row = 0; row < m_board.getNumRows(); row++)
+	{
+		if (!m_zobristDirtyRows[row])
+			continue;
+
+		uint64_t rowHash = 0;
+		for (int col = 0; col < numCols; col++)
+		{
+			const Cell& cell = m_board[row][col];
+			if (cell.isFree())
+				continue;
+
+			const uint64_t cellState = (uint64_t)(unsigned char)cell.m_symbol * 2 + (cell.isRented() ? 1 : 0);
+			rowHash ^= cellKeys.at((row * numCols + col) * 512 + cellState);
+		}
+
+		m_cellsZobristHash ^= m_zobristRowHashes[row] ^ rowHash;
+		m_zobristRowHashes[row] = rowHash;
+		m_zobristDirtyRows[row] = false;
+	}
+
+	uint64_t hash = m_cellsZobristHash;
+	hash ^= RandomStream(ZOBRIST_ROOT_SEED).at(m_rootRow * numCols + m_rootCol);
+
+	// A few sources only, so they are hashed on each call
+	const SourcesTable& sources = *m_sources;
+	for (int srcIndex = 0; srcIndex < sources.getNumSources(); srcIndex++)
+	{
+		const TablePos& srcPos = sources.getPos(srcIndex);
+		const uint64_t sourceKey = RandomStream(ZOBRIST_SOURCES_SEED).at(srcPos.row * numCols + srcPos.col);
+		hash ^= combineSeeds(sourceKey, getFloatBits(sources.m_currentPowers[srcIndex]));
+	}
+
+	return hash;
+}
+
+uint64_t BoardObject::getEvaluationKey() const
+{
+	uint64_t key = getZobristHash();
+
+	const RandomStream bufferedDataKeys(ZOBRIST_BUFFERED_DATA_SEED);
+	for (int cellIndex = 0; cellIndex < m_board.getNumCells(); cellIndex++)
+	{
+		const float bufferedData = m_board.at(cellIndex).getCurrentBufferedCap();
+		if (bufferedData != 0.0f)
+		{
+			key ^= combineSeeds(bufferedDataKeys.at(cellIndex), getFloatBits(bufferedData));
+		}
+	}
+
+	return key;
+}
+
+float BoardObject::evaluateDataFlow_serial()
+{
+	// A subtree waiting to be applied changes the board during the tick, which the key doesn't know about
+	const bool useCache = !m_SubtreeCut.isSubtreeCut;
+	const uint64_t key = getEvaluationKey();
+
+	float dataFlow = 0.0f;
+	if (useCache && g_evaluationCache.find(key, dataFlow))
+		return dataFlow;
+
+	ScopedRandomStream randomStream(key);
+	doDataFlowSimulation_serial(1);
+	dataFlow = getLastSimulationAvgDataFlowPerUnit();
+
+	if (useCache)
+	{
+		g_evaluationCache.insert(key, dataFlow);
+	}
+
+	return dataFlow;
+}
+
+void BoardObject::computeFlowUpperBounds(FlowUpperBounds& outBounds) const
+{
+	outBounds.isValid = false;
+#if RUNMODE != DIRECTIONAL_MODE
+	// Each occupied cell must be a single node of the tree, so a candidate finds the nodes above the cells it modifies from their neighbors
+	updateTreeLayout();
+	const TreeLayout& treeLayout = m_treeLayout;
+	const int numNodes = (int)treeLayout.nodeCell.size();
+	if (treeLayout.hasSharedCells || countNodes() != numNodes)
+		return;
+
+	// The sources give at most power / dist^2 to a cell, as in the influence field
+	const int numCells = m_board.getNumCells();
+	const SourcesTable& sources = getSources();
+	const SourcesInfluenceField& influenceField = getSourcesInfluenceField();
+	outBounds.cellCapture.assign(numCells, 0.0f);
+	for (int srcIndex = 0; srcIndex < sources.getNumSources(); srcIndex++)
+	{
+		const float srcPower = sources.m_currentPowers[srcIndex];
+		const float* srcUnitInfluence = influenceField.rows[influenceField.getRowIndex(sources.getPos(srcIndex))]->unitInfluence.data();
+		for (int cellIndex = 0; cellIndex < numCells; cellIndex++)
+		{
+			outBounds.cellCapture[cellIndex] += srcPower * srcUnitInfluence[cellIndex];
+		}
+	}
+
+	// The post-order has the children before their parent. The cap is the first argument of the min, so a NaN capture (a source on the cell) gives the cap
+	const float maxFlow = (float)g_maxFlowPerCell;
+	outBounds.nodeBound.resize(numNodes);
+	for (int node = 0; node < numNodes; node++)
+	{
+		const int cellIndex = treeLayout.nodeCell[node];
+		float inputBound = 0.0f;
+		if (treeLayout.nodeChildrenStart[node] == treeLayout.nodeChildrenStart[node + 1])
+		{
+			inputBound = outBounds.cellCapture[cellIndex];
+		}
+
+		for (int childPos = treeLayout.nodeChildrenStart[node]; childPos < treeLayout.nodeChildrenStart[node + 1]; childPos++)
+		{
+			inputBound += outBounds.nodeBound[treeLayout.childNodes[childPos]];
+		}
+
+		outBounds.nodeBound[node] = std::min(maxFlow, m_board.at(cellIndex).getCurrentBufferedCap() + inputBound);
+	}
+
+	outBounds.isValid = true;
+#endif
+}
+
+float BoardObject::getFlowUpperBound(const FlowUpperBounds& bounds, std::vector<ModifiedCell>& modifiedCells) const
+{
+	const float maxFlow = (float)g_maxFlowPerCell;
+	if (!bounds.isValid)
+		return maxFlow;
+
+#if RUNMODE != DIRECTIONAL_MODE
+	std::sort(modifiedCells.begin(), modifiedCells.end(), [](const ModifiedCell& a, const ModifiedCell& b)
+	{
+		return a.cellIndex != b.cellIndex ? a.cellIndex < b.cellIndex : a.isOccupied > b.isOccupied;
+	});
+	modifiedCells.erase(std::unique(modifiedCells.begin(), modifiedCells.end(), [](const ModifiedCell& a, const ModifiedCell& b) { return a.cellIndex == b.cellIndex; }), modifiedCells.end());
+
+	const TreeLayout& treeLayout = m_treeLayout;
+	const int numRows = m_board.getNumRows();
+	const int numCols = m_board.getNumCols();
+	auto findModifiedCell = [&](const int row, const int col) -> const ModifiedCell*
+	{
+		const int cellIndex = row * numCols + col;
+		auto iter = std::lower_bound(modifiedCells.begin(), modifiedCells.end(), cellIndex, [](const ModifiedCell& a, const int index) { return a.cellIndex < index; });
+		return iter != modifiedCells.end() && iter->cellIndex == cellIndex ? &*iter : nullptr;
+	};
+
+	auto getCellNode = [&](const int cellIndex)
+	{
+		const CellTickRecord& record = m_cellTickRecords[cellIndex];
+		return record.layoutBuildId == treeLayout.buildId ? record.node : INVALID_POS;
+	};
+
+	auto isOccupiedAfter = [&](const int row, const int col)
+	{
+		const ModifiedCell* modifiedCell = findModifiedCell(row, col);
+		return modifiedCell ? modifiedCell->isOccupied : !m_board[row][col].isFree();
+	};
+
+	// A cell on the left or below a modified cell may get it as a new parent, then the cell and its subtree can be shared.
+	// It's unknown how much such a cell gives, except that it has at most g_maxFlowPerCell
+	auto isUnknownCell = [&](const int row, const int col)
+	{
+		const ModifiedCell* rightCell = col + 1 < numCols ? findModifiedCell(row, col + 1) : nullptr;
+		const ModifiedCell* upCell = row > 0 ? findModifiedCell(row - 1, col) : nullptr;
+		return (rightCell && rightCell->isOccupied) || (upCell && upCell->isOccupied);
+	};
+
+	// The nodes that can have other children or other descendants than in the layout: the ones above the modified cells, the unknown cells,
+	// and the cells that can get a modified cell as a child
+	std::vector<int> affectedNodes;
+	auto addNodesToRoot = [&](int node)
+	{
+		while (node != INVALID_POS)
+		{
+			affectedNodes.push_back(node);
+			node = treeLayout.nodeParent[node];
+		}
+	};
+
+	for (const ModifiedCell& modifiedCell : modifiedCells)
+	{
+		const int row = modifiedCell.cellIndex / numCols;
+		const int col = modifiedCell.cellIndex % numCols;
+		const int node = getCellNode(modifiedCell.cellIndex);
+		if (node != INVALID_POS)
+			addNodesToRoot(treeLayout.nodeParent[node]);
+
+		if (!modifiedCell.isOccupied)
+			continue;
+
+		const TablePos parentsPos[2] = { TablePos(row, col + 1), TablePos(row - 1, col) };
+		for (const TablePos& parentPos : parentsPos)
+		{
+			if (isCoordinateValid(parentPos) && !findModifiedCell(parentPos.row, parentPos.col))
+				addNodesToRoot(getCellNode(parentPos.row * numCols + parentPos.col));
+		}
+
+		const TablePos childrenPos[2] = { TablePos(row, col - 1), TablePos(row + 1, col) };
+		for (const TablePos& childPos : childrenPos)
+		{
+			if (isCoordinateValid(childPos) && !findModifiedCell(childPos.row, childPos.col))
+			{
+				const int childNode = getCellNode(childPos.row * numCols + childPos.col);
+				if (childNode != INVALID_POS)
+					addNodesToRoot(treeLayout.nodeParent[childNode]);
+			}
+		}
+	}
+
+	std::sort(affectedNodes.begin(), affectedNodes.end());
+	affectedNodes.erase(std::unique(affectedNodes.begin(), affectedNodes.end()), affectedNodes.end());
+	std::vector<float> affectedNodesBound(affectedNodes.size(), maxFlow);
+
+	// How much a cell on the left or below a node can give it, once the nodes before the affected node are bounded
+	auto getChildBound = [&](const int row, const int col) -> float
+	{
+		if (row >= numRows || col < 0)
+			return 0.0f;
+
+		const ModifiedCell* modifiedCell = findModifiedCell(row, col);
+		if (modifiedCell)
+		{
+			if (!modifiedCell->isOccupied)
+				return 0.0f;
+
+			// Its children are unknown, except if it has none
+			const int cellIndex = row * numCols + col;
+			const bool hasChildren = (col > 0 && isOccupiedAfter(row, col - 1)) || (row + 1 < numRows && isOccupiedAfter(row + 1, col));
+			return hasChildren ? maxFlow : std::min(maxFlow, m_board.at(cellIndex).getCurrentBufferedCap() + bounds.cellCapture[cellIndex]);
+		}
+
+		if (m_board[row][col].isFree())
+			return 0.0f;
+
+		if (isUnknownCell(row, col))
+			return maxFlow;
+
+		const int node = getCellNode(row * numCols + col);
+		auto iter = std::lower_bound(affectedNodes.begin(), affectedNodes.end(), node);
+		return iter != affectedNodes.end() && *iter == node ? affectedNodesBound[iter - affectedNodes.begin()] : bounds.nodeBound[node];
+	};
+
+	// A node could become a leaf or get children, so it's bounded by the most it can get either way. A NaN capture is kept by the max, then gives the cap
+	for (uint i = 0; i < affectedNodes.size(); i++)
+	{
+		const int cellIndex = treeLayout.nodeCell[affectedNodes[i]];
+		const int row = cellIndex / numCols;
+		const int col = cellIndex % numCols;
+		const float childrenBound = getChildBound(row, col - 1) + getChildBound(row + 1, col);
+		affectedNodesBound[i] = std::min(maxFlow, m_board.at(cellIndex).getCurrentBufferedCap() + std::max(bounds.cellCapture[cellIndex], childrenBound));
+	}
+
+	// The root is the last node
+	const int rootNode = (int)treeLayout.nodeCell.size() - 1;
+	return !affectedNodes.empty() && affectedNodes.back() == rootNode ? affectedNodesBound.back() : bounds.nodeBound[rootNode];
+#else
+	return maxFlow;
+#endif
+}
+
+float BoardObject::doDataFlowSimulation_serial_WITHOUT_SIDE_EFFECTS(const int ticksToSimulate)
+{
+	this->doDataFlowSimulation_serial(1, false);
+	const float baselineCurrentFlow = this->getLastSimulationAvgDataFlowPerUnit();
+	this->retractLastSimTickFlowRecord(); // Retract it since we don't propagate changes
+
+#if RUNMODE == DIRECTIONAL_MODE
+	Cell& cellBelowRoot = getRootCell()->m_boardView->m_board[m_rootRow - 1][m_rootCol];
+	cellBelowRoot.resetCapacityUsedInSubtree();
+#else
+	assert(false && " Not implemented yet");
+#endif
+
+	return baselineCurrentFlow;
+}
+
+void BoardObject::doDataFlowSimulation_serial(const int ticksToSimulate, const bool isRealTick, const bool considerForStatistics /*=true*/)
+{
+	// The simulation changes the buffered data of the tree cells and the root's statistics (saved by the transaction begin).
+	// Without directions the cells are journaled by the tick, before they are changed
+#if RUNMODE == DIRECTIONAL_MODE
+	journalTreeCells();
+#endif
+
+	Cell* root = getRootCell();
+	root->beginSimulation();
+
+	for (int i = 0; i < ticksToSimulate; i++)
+	{
+		simulateTick_serial(considerForStatistics);
+
+		if (isRealTick)
+		{
+			updateSourcesPower();
+		}
+
+		// Check if exist a subtree that should be applied
+		SubtreeCutInfo subtree = root->m_boardView->m_SubtreeCut;
+		if (!subtree.isSubtreeCut)
+		{
+			return;
+		}
+
+		if (m_remainingTicksUntilApplyCutSubtree > 0)
+		{
+			if (--m_remainingTicksUntilApplyCutSubtree == 0)
+			{
+				int row = subtree.posAndScoreInfo.row;
+				int col = subtree.posAndScoreInfo.col;
+				const bool res = root->m_boardView->tryApplySubtree(row, col, subtree.subtreeInfo, true, true); // double check
+				assert(res && "[BoardObject::doDataFlowSimulation_serial] Couldn't apply the subtree cut!");
+
+				root->m_boardView->m_board[row][col].resetTicksToDelayDataFlowCapture();
+				root->m_boardView->m_SubtreeCut.reset();
+
+				// The structure changed, so cells need a fresh snapshot of it
+				root->onMsgDiscoverStructure(root->m_row, root->m_column, 0);
+				root->onRootMsgBroadcastStructure(root->m_boardView);
+			}
+		}
+	}
+}
+
+void BoardObject::collectAllNodesFromRoot(const Cell* subtreeRoot, std::vector<Cell *>& outList, const CellType targetCellType /* = CELL_NOTSET */)
+{
+
+	Cell* childrenList[DIR_COUNT];
+	subtreeRoot->fillChildrenList(childrenList);
+
+	// Iterate over its external children and simulate tick to capture the flow out of them since they contains the leaf nodes
+	for (int childIter = 0; childIter < DIR_COUNT; childIter++)
+	{
+		Cell* child = childrenList[childIter];
+		if (child == nullptr || (targetCellType != CELL_NOTSET && (child->m_cellType != targetCellType)))
+			continue;
+
+		outList.push_back(child);
 		collectAllNodesFromRoot(child, outList, targetCellType);
 	}
 }
 
 void BoardObject::simulateTick_serial(const bool considerForStatistics /* = true */)
 {
+	const uint64_t numHeapAllocationsBefore = getNumHeapAllocations();
+
 	// Step 0: Find how much flow each leaf (capture) cell will get from the available sources
-	SimulationContext simContext;
+	SimulationContext& simContext = m_simulationScratch.simContext;
 	fillSimulationContext(simContext);
 
-	// If not directional mode, easy step: capture from root only
+	// If not directional mode, easy step: capture from root only.
+	// Each cell captures after its children, so sweep the tree in post-order. fillSimulationContext updated the layout
 #if RUNMODE != DIRECTIONAL_MODE
-	Cell* root = getRootCell();
-	root->simulateTick_serial(simContext);
+	TreeLayout& treeLayout = m_treeLayout;
+	const int numNodes = (int)treeLayout.nodeCell.size();
+	const int rootNode = numNodes - 1;
+
+	// The nodes on the paths to the root from the dirty cells and from the leaves capturing something else. The root always ticks, it collects the flow
+	const uint tickStamp = ++m_lastTickStamp;
+	m_tickNodes.clear();
+	auto addPathToRoot = [&](int nodeIndex)
+	{
+		while (nodeIndex != INVALID_POS && treeLayout.nodeTickStamps[nodeIndex] != tickStamp)
+		{
+			treeLayout.nodeTickStamps[nodeIndex] = tickStamp;
+			m_tickNodes.push_back(nodeIndex);
+			nodeIndex = treeLayout.nodeParent[nodeIndex];
+		}
+	};
+
+	if (m_areAllTicksDirty || treeLayout.hasSharedCells)
+	{
+		for (int nodeIndex = 0; nodeIndex < numNodes; nodeIndex++)
+		{
+			treeLayout.nodeTickStamps[nodeIndex] = tickStamp;
+			m_tickNodes.push_back(nodeIndex);
+		}
+	}
+	else
+	{
+		addPathToRoot(rootNode);
+		for (const int cellIndex : m_dirtyTickCells)
+		{
+			const CellTickRecord& record = m_cellTickRecords[cellIndex];
+			if (record.layoutBuildId == treeLayout.buildId)
+				addPathToRoot(record.node);
+		}
+
+		for (const int leafNode : treeLayout.leafNodes)
+		{
+			const Cell& leaf = m_board.at(treeLayout.nodeCell[leafNode]);
+			float leafCapture = 0.0f;
+			simContext.getLeafNodeCapture(TablePos(leaf.m_row, leaf.m_column), leafCapture);
+			if (leafCapture != m_cellTickRecords[treeLayout.nodeCell[leafNode]].leafCapture)
+				addPathToRoot(leafNode);
+		}
+
+		std::sort(m_tickNodes.begin(), m_tickNodes.end());
+	}
+
+	for (const int cellIndex : m_dirtyTickCells)
+	{
+		m_cellTickRecords[cellIndex].isDirty = false;
+	}
+	m_dirtyTickCells.clear();
+	m_areAllTicksDirty = false;
+
+	for (const int nodeIndex : m_tickNodes)
+	{
+		// The steady children don't tick. They only leave the flow of their record to be captured
+		for (int childPos = treeLayout.nodeChildrenStart[nodeIndex]; childPos < treeLayout.nodeChildrenStart[nodeIndex + 1]; childPos++)
+		{
+			const int childNode = treeLayout.childNodes[childPos];
+			if (treeLayout.nodeTickStamps[childNode] != tickStamp)
+			{
+				Cell& child = m_board.at(treeLayout.nodeCell[childNode]);
+				journalCell(child);
+				child.setBufferedData(m_cellTickRecords[treeLayout.nodeCell[childNode]].bufferedAfter);
+			}
+		}
+
+		simulateNodeTick_serial(nodeIndex, simContext);
+	}
+
+	// A node is steady if its parent left it the flow it had before its tick. Only the nodes that ticked, and their children, could change
+	for (const int nodeIndex : m_tickNodes)
+	{
+		const int childrenEnd = treeLayout.nodeChildrenStart[nodeIndex + 1];
+		for (int childPos = treeLayout.nodeChildrenStart[nodeIndex]; childPos < childrenEnd; childPos++)
+		{
+			const int childCell = treeLayout.nodeCell[treeLayout.childNodes[childPos]];
+			if (m_board.at(childCell).getCurrentBufferedCap() != m_cellTickRecords[childCell].bufferedBefore)
+				markTickDirty(childCell);
+		}
+	}
 #else
 	// In directional mode:
 	float totalDonatedFlow = 0.0f;
 
-	std::set<Cell*> interiorSubtrees; // THis will store all interior sub-trees roots
+	std::vector<Cell*>& interiorSubtrees = m_simulationScratch.interiorSubtrees; // THis will store all interior sub-trees roots
+	interiorSubtrees.clear();
 
-	std::vector<Cell*> membraneCells;
+	std::vector<Cell*>& membraneCells = m_simulationScratch.membraneCells;
+	membraneCells.clear();
 	getMembraneCells(membraneCells);
 
 	// Step 1: take membrane nodes and find how much each can capture from their attached external trees
@@ -747,9 +1760,9 @@ void BoardObject::simulateTick_serial(const bool considerForStatistics /* = true
 				if (child == nullptr || child->m_cellType != CELL_INTERIOR)
 					continue;
 
-				if (interiorSubtrees.find(child) == interiorSubtrees.end())
+				if (std::find(interiorSubtrees.begin(), interiorSubtrees.end(), child) == interiorSubtrees.end())
 				{
-					interiorSubtrees.insert(child);
+					interiorSubtrees.push_back(child);
 				}
 
 				const float currentCapAvailable = memCell->getCurrentBufferedCap();
@@ -801,6 +1814,77 @@ void BoardObject::simulateTick_serial(const bool considerForStatistics /* = true
 		root->addNewFlowRecord(totalDonatedFlow);
 	}
 #endif
+
+	m_lastTickNumHeapAllocations = getNumHeapAllocations() - numHeapAllocationsBefore;
+}
+
+void BoardObject::markTickDirty(const int cellIndex) const
+{
+	if ((int)m_cellTickRecords.size() <= cellIndex)
+		m_cellTickRecords.resize(m_board.getNumCells());
+
+	CellTickRecord& record = m_cellTickRecords[cellIndex];
+	if (!record.isDirty)
+	{
+		record.isDirty = true;
+		m_dirtyTickCells.push_back(cellIndex);
+	}
+}
+
+void BoardObject::simulateNodeTick_serial(const int nodeIndex, const SimulationContext& simContext)
+{
+	const TreeLayout& treeLayout = m_treeLayout;
+	const int cellIndex = treeLayout.nodeCell[nodeIndex];
+	const int childrenStart = treeLayout.nodeChildrenStart[nodeIndex];
+	const int numChildren = treeLayout.nodeChildrenStart[nodeIndex + 1] - childrenStart;
+	Cell& cell = m_board.at(cellIndex);
+	CellTickRecord& record = m_cellTickRecords[cellIndex];
+	journalCell(cell); // The children were journaled before they ticked or replayed their records
+
+	float leafCapture = 0.0f;
+	if (numChildren == 0)
+	{
+		simContext.getLeafNodeCapture(TablePos(cell.m_row, cell.m_column), leafCapture);
+	}
+
+	// Same inputs as the recorded tick ?
+	bool isRecordValid = record.numChildren == numChildren && record.bufferedBefore == cell.getCurrentBufferedCap() && record.leafCapture == leafCapture;
+	for (int childIter = 0; childIter < numChildren && isRecordValid; childIter++)
+	{
+		const int childCell = treeLayout.nodeCell[treeLayout.childNodes[childrenStart + childIter]];
+		isRecordValid = record.childCells[childIter] == childCell && record.childrenBufferedBefore[childIter] == m_board.at(childCell).getCurrentBufferedCap();
+	}
+
+	if (isRecordValid)
+	{
+		cell.setBufferedData(record.bufferedAfter);
+		for (int childIter = 0; childIter < numChildren; childIter++)
+		{
+			m_board.at(record.childCells[childIter]).setBufferedData(record.childrenBufferedAfter[childIter]);
+		}
+	}
+	else
+	{
+		record.numChildren = numChildren;
+		record.bufferedBefore = cell.getCurrentBufferedCap();
+		record.leafCapture = leafCapture;
+		for (int childIter = 0; childIter < numChildren; childIter++)
+		{
+			const int childCell = treeLayout.nodeCell[treeLayout.childNodes[childrenStart + childIter]];
+			record.childCells[childIter] = childCell;
+			record.childrenBufferedBefore[childIter] = m_board.at(childCell).getCurrentBufferedCap();
+		}
+
+		cell.captureDataFlow(simContext);
+
+		record.bufferedAfter = cell.getCurrentBufferedCap();
+		for (int childIter = 0; childIter < numChildren; childIter++)
+		{
+			record.childrenBufferedAfter[childIter] = m_board.at(record.childCells[childIter]).getCurrentBufferedCap();
+		}
+	}
+
+	cell.endCellTick_serial();
 }
 
 template <typename T>
@@ -817,6 +1901,8 @@ void BoardObject::setNewCell(const int targetRow, const int targetCol, const cha
 {
 	// Set the symbol
 	Cell& newCell = m_board[targetRow][targetCol];
+	journalCell(newCell);
+	markSymbolModified(targetRow, targetCol);
 	newCell.setSymbol(symbol);
 
 	// Connect the links and distance to root 
@@ -832,6 +1918,8 @@ void BoardObject::setNewCell(const int targetRow, const int targetCol, const cha
 		if (neighbCell.isFree())
 			continue;
 
+		journalCell(neighbCell);
+
 		// Need to connect with it !
 		(*neighbCell.m_previousByDir[getOppositeDirection((DIRECTION)dirIter)]) = &newCell;
 		(*newCell.m_followersByDir[dirIter]) = &neighbCell;
@@ -845,6 +1933,7 @@ void BoardObject::setNewCell(const int targetRow, const int targetCol, const cha
 	if (definitive)
 	{
 		// Broadcast the structure and call discovery
+		journalTreeCells();
 		Cell* rootCell = getRootCell();
 		rootCell->onMsgDiscoverStructure(rootCell->m_row, rootCell->m_column, 0);
 		rootCell->onRootMsgBroadcastStructure(this);
@@ -860,37 +1949,44 @@ void BoardObject::updateSourcesPower()
 	if (!variableSourcesPower)
 		return;
 
-	// For each source
-	for (auto& it : m_posToSourceMap)
+	SourcesTable& sources = *m_sources;
+	const int numSources = sources.getNumSources();
+	if (m_numOpenTransactions > 0)
 	{
-		SourceInfo& srcInfo = it.second;
-		// Update current power according to their targets
+		for (int srcIndex = 0; srcIndex < numSources; srcIndex++)
 		{
-			float amountToAdd = srcInfo.getTarget() - srcInfo.getPower();
-			const float sgn = amountToAdd > 0.0f ? 1.0f : -1.0f;
-
-			const float absAmountToAdd = std::abs(amountToAdd);
-			amountToAdd = sgn * std::min(absAmountToAdd, g_maxPowerVelocityPerTick);
-			srcInfo.setCurrentPower(srcInfo.getPower() + amountToAdd);
-
-			propagateSourceEvent(Cell::EVENT_SOURCE_MODIFY, it.first, srcInfo, false);
+			journalSource(sources.getPos(srcIndex));
 		}
 	}
 
+	// Update current power according to their targets, by at most g_maxPowerVelocityPerTick.
+	// All the sources are updated in place and the table gets a single new version at the end of the tick
+	float* currentPowers = sources.m_currentPowers.data();
+	const float* targetPowers = sources.m_targetPowers.data();
+	const float maxPowerVelocity = g_maxPowerVelocityPerTick;
+	for (int srcIndex = 0; srcIndex < numSources; srcIndex++)
+	{
+		const float amountToAdd = targetPowers[srcIndex] - currentPowers[srcIndex];
+		currentPowers[srcIndex] += std::max(-maxPowerVelocity, std::min(amountToAdd, maxPowerVelocity));
+	}
+
 	// Update the sources' power target
 	m_numTicksRemainingToUpdateSources--;
 	if (m_numTicksRemainingToUpdateSources == 0)
 	{
 		m_numTicksRemainingToUpdateSources = g_powerChangeFrequency;
 
-		for (auto& it : m_posToSourceMap)
+		// Time expired, update sources' targets
+		for (int srcIndex = 0; srcIndex < numSources; srcIndex++)
 		{
-			SourceInfo& srcInfo = it.second;
-
-			// Time expired, update sources' targets
-			srcInfo.setPowerTarget((float)randRange(g_minPowerForWirelessSource, g_maxPowerForWirelessSource));
+			sources.m_targetPowers[srcIndex] = (float)randRange(g_minPowerForWirelessSource, g_maxPowerForWirelessSource);
 		}
 	}
+
+	if (numSources > 0)
+	{
+		sources.onModified();
+	}
 }
 
 
@@ -908,84 +2004,210 @@ bool BoardObject::isNumberOfCharactersGood() const
 bool BoardObject::isCompliantWithRowColPatterns(int onlyTestRow, int onlyTestCol, TablePos* outWrongPos) const
 {
 	// Check the language on rows
-	for (int row = 0; row < MAX_ROWS; row++)
+	for (int row = 0; row < g_boardRows; row++)
 	{
 		if (onlyTestRow != INVALID_POS && row != onlyTestRow)
 			continue;
 
-		int start = INVALID_POS;
-		for (int col = 0; col < MAX_COLS; col++)
+		if (m_languageDirtyRows[row] == false)
+			continue;
+
+		if (checkRowSegments(row, outWrongPos) == false)
+			return false;
+
+		m_languageDirtyRows[row] = false;
+	}
+
+	// Check the language on columns
+	for (int col = 0; col < g_boardCols; col++)
+	{
+		if (onlyTestCol != INVALID_POS && col != onlyTestCol)
+			continue;
+
+		if (m_languageDirtyCols[col] == false)
+			continue;
+
+		if (checkColSegments(col, outWrongPos) == false)
+			return false;
+
+		m_languageDirtyCols[col] = false;
+	}
+
+	return true;
+}
+
+bool BoardObject::isCompliantWithRowColPatternsExcept(const int skipRow, const int skipCol) const
+{
+	for (int row = 0; row < g_boardRows; row++)
+	{
+		if (row == skipRow || m_languageDirtyRows[row] == false)
+			continue;
+
+		if (checkRowSegments(row, nullptr) == false)
+			return false;
+
+		m_languageDirtyRows[row] = false;
+	}
+
+	for (int col = 0; col < g_boardCols; col++)
+	{
+		if (col == skipCol || m_languageDirtyCols[col] == false)
+			continue;
+
+		if (checkColSegments(col, nullptr) == false)
+			return false;
+
+		m_languageDirtyCols[col] = false;
+	}
+
+	return true;
+}
+
+void BoardObject::preparePosLanguageCheck(const TablePos& pos, PosLanguageCheck& outCheck) const
+{
+	outCheck.pos = pos;
+
+	// The segments through the position, with the position occupied
+	int rowSegmentStart = pos.col;
+	while (rowSegmentStart > 0 && m_board[pos.row][rowSegmentStart - 1].isFree() == false)
+		rowSegmentStart--;
+
+	int rowSegmentEnd = pos.col;
+	while (rowSegmentEnd < g_boardCols - 1 && m_board[pos.row][rowSegmentEnd + 1].isFree() == false)
+		rowSegmentEnd++;
+
+	int colSegmentStart = pos.row;
+	while (colSegmentStart > 0 && m_board[colSegmentStart - 1][pos.col].isFree() == false)
+		colSegmentStart--;
+
+	int colSegmentEnd = pos.row;
+	while (colSegmentEnd < g_boardRows - 1 && m_board[colSegmentEnd + 1][pos.col].isFree() == false)
+		colSegmentEnd++;
+
+	outCheck.rowSegmentEnd = rowSegmentEnd;
+	outCheck.colSegmentEnd = colSegmentEnd;
+	outCheck.areOtherSegmentsCompliant = checkRowSegmentsInRange(pos.row, 0, rowSegmentStart - 2, nullptr) && checkRowSegmentsInRange(pos.row, rowSegmentEnd + 2, g_boardCols - 1, nullptr)
+		&& checkColSegmentsInRange(pos.col, 0, colSegmentStart - 2, nullptr) && checkColSegmentsInRange(pos.col, colSegmentEnd + 2, g_boardRows - 1, nullptr);
+
+	outCheck.rowState = g_rowExprDFA.getStartState();
+	for (int colIter = rowSegmentStart; colIter < pos.col; colIter++)
+	{
+		outCheck.rowState = g_rowExprDFA.getNextState(outCheck.rowState, m_board[pos.row][colIter].m_symbol);
+	}
+
+	outCheck.colState = g_colExprDFA.getStartState();
+	for (int rowIter = colSegmentStart; rowIter < pos.row; rowIter++)
+	{
+		outCheck.colState = g_colExprDFA.getNextState(outCheck.colState, m_board[rowIter][pos.col].m_symbol);
+	}
+}
+
+bool BoardObject::isSymbolCompliantAtPos(const PosLanguageCheck& check, const char symbol) const
+{
+	if (check.areOtherSegmentsCompliant == false)
+		return false;
+
+	const TablePos& pos = check.pos;
+	int rowState = g_rowExprDFA.getNextState(check.rowState, symbol);
+	for (int colIter = pos.col + 1; colIter <= check.rowSegmentEnd && rowState != Expression_DFA::DEAD_STATE; colIter++)
+	{
+		rowState = g_rowExprDFA.getNextState(rowState, m_board[pos.row][colIter].m_symbol);
+	}
+
+	if (g_rowExprDFA.isAccepting(rowState) == false)
+		return false;
+
+	int colState = g_colExprDFA.getNextState(check.colState, symbol);
+	for (int rowIter = pos.row + 1; rowIter <= check.colSegmentEnd && colState != Expression_DFA::DEAD_STATE; rowIter++)
+	{
+		colState = g_colExprDFA.getNextState(colState, m_board[rowIter][pos.col].m_symbol);
+	}
+
+	return g_colExprDFA.isAccepting(colState);
+}
+
+bool BoardObject::checkRowSegments(const int row, TablePos* outWrongPos) const
+{
+	return checkRowSegmentsInRange(row, 0, g_boardCols - 1, outWrongPos);
+}
+
+bool BoardObject::checkRowSegmentsInRange(const int row, const int startCol, const int endCol, TablePos* outWrongPos) const
+{
+	int start = INVALID_POS;
+	for (int col = startCol; col <= endCol; col++)
+	{
+		const bool isFreeCell = m_board[row][col].isFree();
+		if (isFreeCell)
 		{
-			const bool isFreeCell = m_board[row][col].isFree();
-			if (isFreeCell)
+			if (start != INVALID_POS) // end of a contiguous row
 			{
-				if (start != INVALID_POS) // end of a contiguous row
+				if (checkRow(row, start, col - 1) == false)
 				{
-					if (checkRow(row, start, col - 1) == false)
-					{
-						if (outWrongPos)
-							*outWrongPos = TablePos(row, start);
+					if (outWrongPos)
+						*outWrongPos = TablePos(row, start);
 
-						return false;
-					}
-
-					start = INVALID_POS;
+					return false;
 				}
+
+				start = INVALID_POS;
 			}
-			else if (start == INVALID_POS) // Start of a new row
-				start = col;
 		}
+		else if (start == INVALID_POS) // Start of a new row
+			start = col;
+	}
 
-		if (start != INVALID_POS)
+	if (start != INVALID_POS)
+	{
+		if (checkRow(row, start, endCol) == false)
 		{
-			if (checkRow(row, start, MAX_COLS - 1) == false)
-			{
-				if (outWrongPos)
-					*outWrongPos = TablePos(row, start);
+			if (outWrongPos)
+				*outWrongPos = TablePos(row, start);
 
-				return false;
-			}
+			return false;
 		}
 	}
 
-	// Check the language on columns
-	for (int col = 0; col < MAX_COLS; col++)
-	{
-		if (onlyTestCol != INVALID_POS && col != onlyTestCol)
-			continue;
+	return true;
+}
+
+bool BoardObject::checkColSegments(const int col, TablePos* outWrongPos) const
+{
+	return checkColSegmentsInRange(col, 0, g_boardRows - 1, outWrongPos);
+}
 
-		int start = INVALID_POS;
-		for (int row = 0; row < MAX_ROWS; row++)
+bool BoardObject::checkColSegmentsInRange(const int col, const int startRow, const int endRow, TablePos* outWrongPos) const
+{
+	int start = INVALID_POS;
+	for (int row = startRow; row <= endRow; row++)
+	{
+		const bool isFreeCell = m_board[row][col].isFree();
+		if (isFreeCell)
 		{
-			const bool isFreeCell = m_board[row][col].isFree();
-			if (isFreeCell)
+			if (start != INVALID_POS) // end of a contig col
 			{
-				if (start != INVALID_POS) // end of a contig col
+				if (checkCol(col, start, row - 1) == false)
 				{
-					if (checkCol(col, start, row - 1) == false)
-					{
-						if (outWrongPos)
-							*outWrongPos = TablePos(start, col);
-
-						return false;
-					}
+					if (outWrongPos)
+						*outWrongPos = TablePos(start, col);
 
-					start = INVALID_POS;
+					return false;
 				}
+
+				start = INVALID_POS;
 			}
-			else if (start == INVALID_POS) // Start of a new row
-				start = row;
 		}
+		else if (start == INVALID_POS) // Start of a new col
+			start = row;
+	}
 
-		if (start != INVALID_POS)
+	if (start != INVALID_POS)
+	{
+		if (checkCol(col, start, endRow) == false)
 		{
-			if (checkCol(col, start, MAX_ROWS - 1) == false)
-			{
-				if (outWrongPos)
-					*outWrongPos = TablePos(start, col);
+			if (outWrongPos)
+				*outWrongPos = TablePos(start, col);
 
-				return false;
-			}
+			return false;
 		}
 	}
 
@@ -1008,6 +2230,8 @@ bool BoardObject::tryApplySubtree(const int row, const int col, const SubtreeInf
 		const int colAp = col + offsetAndSymbol.colOff;
 		assert(isCoordinateValid(rowAp, colAp));
 
+		journalCell(m_board[rowAp][colAp]);
+		markSymbolModified(rowAp, colAp);
 		m_board[rowAp][colAp].setSymbol(offsetAndSymbol.symbol);
 
 		if (offsetAndSymbol.isRented)
@@ -1016,9 +2240,7 @@ bool BoardObject::tryApplySubtree(const int row, const int col, const SubtreeInf
 		}
 	}
 
-	// Update the internal board info - rows, columns, links and distance to root currently
-	updateInternalCellsInfo();
-
+	// The language depends on the symbols only, so a subtree that doesn't fit it fails before the links are updated. The callers roll it back
 	if (checkLanguage)
 	{
 		const bool res = isCompliantWithRowColPatterns();
@@ -1026,6 +2248,9 @@ bool BoardObject::tryApplySubtree(const int row, const int col, const SubtreeInf
 			return false;
 	}
 
+	// Update the internal board info - rows, columns, links and distance to root currently
+	updateInternalCellsInfo();
+
 	return true;
 }
 
@@ -1039,7 +2264,11 @@ void BoardObject::cutSubtree(const int row, const int col, SubtreeInfo& subtree)
 	// Remove the content from this board
 	for (const OffsetAndSymbol& offsetAndSymbol : subtree.m_offsets)
 	{
-		Cell& targetCell = m_board[row + offsetAndSymbol.rowOff][col + offsetAndSymbol.colOff];
+		const int targetRow = row + offsetAndSymbol.rowOff;
+		const int targetCol = col + offsetAndSymbol.colOff;
+		Cell& targetCell = m_board[targetRow][targetCol];
+		journalCellAndLinks(targetCell);
+		markSymbolModified(targetRow, targetCol);
 
 		// Disable connection to its parent then reset
 #if RUNMODE == DIRECTIONAL_MODE
@@ -1084,7 +2313,7 @@ bool BoardObject::canPasteSubtreeAtPos_noLangCheck(const int targetRow, const in
 	// Check if we can paste the subtree there only considering their positions
 	const bool isTargetCellFree = m_board[targetRow][targetCol].isFree();
 	const bool canGlueAbove = targetRow > 0 && m_board[targetRow - 1][targetCol].isFree() == false;
-	const bool canGlueRight = (targetCol < MAX_COLS - 1) && m_board[targetRow][targetCol + 1].isFree() == false;
+	const bool canGlueRight = (targetCol < g_boardCols - 1) && m_board[targetRow][targetCol + 1].isFree() == false;
 	const bool canGlueToOneSide = canGlueAbove || canGlueRight;
 
 	if (isTargetCellFree == false || canGlueToOneSide == false)
@@ -1113,72 +2342,182 @@ bool BoardObject::checkRow(const int row, const int startCol, const int endCol)
 {
 	assert(isCoordinateValid(row, startCol) && isCoordinateValid(row, endCol) && startCol <= endCol);
 
-	std::string testLocal;
-	testLocal.reserve(endCol - startCol + 2);
-	for (int colIter = startCol; colIter <= endCol; colIter++)
+	// Feed the symbols straight to the automaton, stopping as soon as it can't match anymore
+	int state = g_rowExprDFA.getStartState();
+	for (int colIter = startCol; colIter <= endCol && state != Expression_DFA::DEAD_STATE; colIter++)
 	{
-		testLocal += m_board[row][colIter].m_symbol;
+		state = g_rowExprDFA.getNextState(state, m_board[row][colIter].m_symbol);
 	}
 
-	const bool res = std::regex_match(testLocal.c_str(), g_rowRXExpr);
-	return res;
+	return g_rowExprDFA.isAccepting(state);
 }
 
 bool BoardObject::checkCol(const int col, const int startRow, const int endRow) const
 {
 	assert(isCoordinateValid(startRow, col) && isCoordinateValid(endRow, col) && startRow <= endRow);
 
-	std::string testLocal;
-	testLocal.reserve(endRow - startRow + 2);
-	for (int rowIter = startRow; rowIter <= endRow; rowIter++)
+	int state = g_colExprDFA.getStartState();
+	for (int rowIter = startRow; rowIter <= endRow && state != Expression_DFA::DEAD_STATE; rowIter++)
+	{
+		state = g_colExprDFA.getNextState(state, m_board[rowIter][col].m_symbol);
+	}
+
+	return g_colExprDFA.isAccepting(state);
+}
+
+BoardObjectPool g_boardObjectPool;
+
+void BoardObjectPool::init(const int numThreads)
+{
+	m_threadBoards.clear();
+	for (int threadIter = 0; threadIter < numThreads; threadIter++)
+	{
+		m_threadBoards.emplace_back(new ThreadBoards());
+	}
+}
+
+BoardObjectPool::BoardPtr BoardObjectPool::acquireCopy(const BoardObject& board)
+{
+	m_numAcquires++;
+	const int numBoardsInUse = ++m_numBoardsInUse;
+	int maxBoardsInUse = m_maxBoardsInUse;
+	while (numBoardsInUse > maxBoardsInUse && !m_maxBoardsInUse.compare_exchange_weak(maxBoardsInUse, numBoardsInUse)) {}
+
+	Releaser releaser;
+	const int threadIndex = TaskPool::getCurrentThreadIndex();
+	if (threadIndex < (int)m_threadBoards.size())
+	{
+		releaser.threadIndex = threadIndex;
+
+		ThreadBoards& threadBoards = *m_threadBoards[threadIndex];
+		std::unique_ptr<BoardObject> freeBoard;
+		{
+			std::lock_guard<std::mutex> lock(threadBoards.mutex);
+			if (!threadBoards.freeBoards.empty())
+			{
+				freeBoard = std::move(threadBoards.freeBoards.back());
+				threadBoards.freeBoards.pop_back();
+			}
+		}
+
+		if (freeBoard)
+		{
+			freeBoard->resetAndCopyFrom(board);
+			return BoardPtr(freeBoard.release(), releaser);
+		}
+	}
+
+	m_numBoardsCreated++;
+	return BoardPtr(new BoardObject(board), releaser);
+}
+
+void BoardObjectPool::release(BoardObject* board, const int threadIndex)
+{
+	m_numBoardsInUse--;
+	if (threadIndex == INVALID_POS)
 	{
-		testLocal += m_board[rowIter][col].m_symbol;
+		delete board;
+		return;
 	}
 
-	const bool res = std::regex_match(testLocal.c_str(), g_colRXExpr);
-	return res;
+	assert(!board->isInTransaction() && "A board must be released with its transactions rolled back or applied");
+	ThreadBoards& threadBoards = *m_threadBoards[threadIndex];
+	std::lock_guard<std::mutex> lock(threadBoards.mutex);
+	threadBoards.freeBoards.emplace_back(board);
+}
+
+void BoardObjectPool::Releaser::operator()(BoardObject* board) const
+{
+	g_boardObjectPool.release(board, threadIndex);
+}
+
+ThreadScratchBoards::ThreadScratchBoards(const BoardObject& board)
+	: m_board(board)
+	, m_threadBoards(g_taskPool.getNumThreads())
+{
+	// The copies share the sources influence field of the board
+	board.getSourcesInfluenceField();
+}
+
+BoardObject& ThreadScratchBoards::get()
+{
+	BoardObjectPool::BoardPtr& threadBoard = m_threadBoards[TaskPool::getCurrentThreadIndex()];
+	if (!threadBoard)
+	{
+		threadBoard = g_boardObjectPool.acquireCopy(m_board);
+	}
+	return *threadBoard;
 }
 
-void BoardObject::evaluatePositionsToMove(const int cellRow, const int cellCol, const SubtreeInfo& subtreeCut, AvailablePositionsToMove& outPos, int& outBestOptionIndex) const
+void BoardObject::evaluatePositionsToMove(const int cellRow, const int cellCol, const SubtreeInfo& subtreeCut, AvailablePositionsToMove& outPos, int& outBestOptionIndex)
 {
 	// For each position on the table, check if this subtree cut can be put in there
 	const int min_row = std::abs(subtreeCut.minRowOffset);
-	const int max_row = MAX_ROWS - subtreeCut.maxRowOffset;
+	const int max_row = g_boardRows - subtreeCut.maxRowOffset;
 	const int min_col = std::abs(subtreeCut.minColOffset);
-	const int max_col = MAX_COLS - subtreeCut.maxColOffset;
+	const int max_col = g_boardCols - subtreeCut.maxColOffset;
+
+	const int numCandidateRows = std::max(0, max_row - min_row);
+	const int numCandidateCols = std::max(0, max_col - min_col);
+	const int numCandidates = numCandidateRows * numCandidateCols;
+
+	// The candidates are tried in parallel, each in place on the board of the thread that runs it.
+	// With more threads, each thread works on its own copy of this board, which is kept unchanged to be copied
+	const bool useThreadBoards = g_taskPool.getNumThreads() > 1 && numCandidates > 1;
+	std::unique_ptr<ThreadScratchBoards> threadBoards(useThreadBoards ? new ThreadScratchBoards(*this) : nullptr);
 
-	for (int rowIter = min_row; rowIter < max_row; rowIter++)
+	// All the candidates have the same sources, so they share this board's influence field
+	getSourcesInfluenceField();
+
+	std::vector<AvailablePosInfoAndDeltaScore> candidatesInfo(numCandidates);
+	std::vector<char> candidatesValid(numCandidates, false);
+
+	g_taskPool.parallelFor(numCandidates, [&](const int candidateIndex)
 	{
-		for (int colIter = min_col; colIter < max_col; colIter++)
-		{
-			// Same movement as initial cut ?
-			if (rowIter == cellRow && colIter == cellCol)
-				continue;
+		const int rowIter = min_row + candidateIndex / numCandidateCols;
+		const int colIter = min_col + candidateIndex % numCandidateCols;
 
-			// Test if we have something near to paste this subtree - We must have an item either in the upper side or right side
-			//if (rowIter == 0 || colIter == MAX_COLS - 1)
-			//	continue;
+		// Same movement as initial cut ?
+		if (rowIter == cellRow && colIter == cellCol)
+			return;
 
-			// Check if we can paste the subtree there only considering their positions first
-			if (canPasteSubtreeAtPos_noLangCheck(rowIter, colIter, subtreeCut) == false)
-				continue;
+		// Test if we have something near to paste this subtree - We must have an item either in the upper side or right side
+		//if (rowIter == 0 || colIter == g_boardCols - 1)
+		//	return;
 
-			// TODO: optimize this !!! We are allocating and copy a lot of memory here !
-			BoardObject boardWithNewSubtree = *this;
-			if (boardWithNewSubtree.tryApplySubtree(rowIter, colIter, subtreeCut, false, true) == false)
-				continue;
+		// Check if we can paste the subtree there only considering their positions first
+		if (canPasteSubtreeAtPos_noLangCheck(rowIter, colIter, subtreeCut) == false)
+			return;
 
-			// Simulate and get the average flow then send it to root
-			boardWithNewSubtree.doDataFlowSimulation_serial(1);
-			const float dataFlow = boardWithNewSubtree.getLastSimulationAvgDataFlowPerUnit();
+		BoardObject* board = useThreadBoards ? &threadBoards->get() : this;
 
-			AvailablePosInfoAndDeltaScore posInfo;
-			posInfo.col = colIter;
-			posInfo.row = rowIter;
-			posInfo.selectedColumn = cellCol;
-			posInfo.selectedRow = cellRow;
-			posInfo.score = dataFlow;
-			outPos.push_back(posInfo);
+		// Try the move in place and undo it after evaluation
+		board->beginTransaction();
+		if (board->tryApplySubtree(rowIter, colIter, subtreeCut, false, true) == false)
+		{
+			board->rollbackTransaction();
+			return;
+		}
+
+		// Simulate and get the average flow then send it to root. The random numbers come from the evaluated board, so the result doesn't depend on the thread that evaluates it
+		const float dataFlow = board->evaluateDataFlow_serial();
+		board->rollbackTransaction();
+
+		AvailablePosInfoAndDeltaScore& posInfo = candidatesInfo[candidateIndex];
+		posInfo.col = colIter;
+		posInfo.row = rowIter;
+		posInfo.selectedColumn = cellCol;
+		posInfo.selectedRow = cellRow;
+		posInfo.score = dataFlow;
+		candidatesValid[candidateIndex] = true;
+	});
+
+	// Gather the results in the order of the positions on the table
+	for (int candidateIndex = 0; candidateIndex < numCandidates; candidateIndex++)
+	{
+		if (candidatesValid[candidateIndex])
+		{
+			outPos.push_back(candidatesInfo[candidateIndex]);
 		}
 	}
 
@@ -1197,20 +2536,18 @@ void BoardObject::evaluatePositionsToMove(const int cellRow, const int cellCol,
 
 void BoardObject::printBoard(std::ostream& outStream)
 {
-	HANDLE hstdout = GetStdHandle(STD_OUTPUT_HANDLE);
-
 	outStream << "Current board: " << endl;
 
 	outStream << ' ' << ' ';
-	for (uint j = 0; j < MAX_COLS; j++)
+	for (int j = 0; j < g_boardCols; j++)
 		outStream << ' ' << j % 10 << ' ';
 
 	outStream << endl;
-	for (uint i = 0; i < MAX_ROWS; i++)
+	for (int i = 0; i < g_boardRows; i++)
 	{
 		outStream << i % 10 << ' ';
 
-		for (uint j = 0; j < MAX_COLS; j++)
+		for (int j = 0; j < g_boardCols; j++)
 		{
 			if (m_board[i][j].isFree())
 			{
@@ -1228,18 +2565,18 @@ void BoardObject::printBoard(std::ostream& outStream)
 				if (isColorChanged)
 				{
 					if (membraneCell)
-						SetConsoleTextAttribute(hstdout, 0x04);
+						setConsoleTextColor(0x04);
 					else if (isExteriorTree)
-						SetConsoleTextAttribute(hstdout, 0x02);
+						setConsoleTextColor(0x02);
 					else if (isInteriorTree)
-						SetConsoleTextAttribute(hstdout, 0x03);
+						setConsoleTextColor(0x03);
 				}
 
 				outStream << ' ' << m_board[i][j].m_symbol << ' ';
 
 				// Revert back to black
 				if (isColorChanged)
-					SetConsoleTextAttribute(hstdout, 0x0F);
+					setConsoleTextColor(0x0F);
 			}
 		}
 
@@ -1247,16 +2584,48 @@ void BoardObject::printBoard(std::ostream& outStream)
 	}
 
 	outStream << "Current sources ((row,col - power): ";
-	for (auto& it : m_posToSourceMap)
+	const SourcesTable& sources = getSources();
+	for (int srcIndex = 0; srcIndex < sources.getNumSources(); srcIndex++)
 	{
-		const TablePos& pos = it.first;
-		const SourceInfo& srcInfo = it.second;
-
-		outStream << " (" << pos.row << ", " << pos.col << ") - " << srcInfo.getPower();
+		const TablePos& pos = sources.getPos(srcIndex);
+		outStream << " (" << pos.row << ", " << pos.col << ") - " << sources.m_currentPowers[srcIndex];
 	}
 	outStream << endl << endl << endl;
 }
 
+void BoardObject::writeTrace(TraceWriter& trace, const int step) const
+{
+	const SourcesTable& sources = getSources();
+
+	TraceRecord record;
+	record.type = TRACE_BOARD;
+	record.step = step;
+	record.row = m_board.getNumRows();
+	record.col = m_board.getNumCols();
+	record.targetRow = sources.getNumSources();
+	record.targetCol = 0;
+	record.value = 0.0f;
+	trace.write(record);
+
+	// Reused between the steps
+	static thread_local std::vector<TraceCell> cells;
+	static thread_local std::vector<TraceSource> traceSources;
+	cells.resize(m_board.getNumCells());
+	for (int cellIndex = 0; cellIndex < m_board.getNumCells(); cellIndex++)
+	{
+		cells[cellIndex] = makeTraceCell(m_board.at(cellIndex));
+	}
+	trace.write(cells);
+
+	traceSources.resize(sources.getNumSources());
+	for (int srcIndex = 0; srcIndex < sources.getNumSources(); srcIndex++)
+	{
+		const TablePos& pos = sources.getPos(srcIndex);
+		traceSources[srcIndex] = { pos.row, pos.col, sources.m_currentPowers[srcIndex] };
+	}
+	trace.write(traceSources);
+}
+
 
 // Sets the expression on row starting at a position from first character of the expressions
 void BoardObject::setExprOnRow(const int row, const int startCol, const std::string& expr)
@@ -1270,6 +2639,9 @@ void BoardObject::setExprOnRow(const int row, const int startCol, const std::str
 	{
 		Cell* thisCell = &m_board[row][i];
 		assert(thisCell->isFree() && "THere is a bug ! I'm overriding the same positions here !");
+		journalCell(*prevNodeOnRow);
+		journalCell(*thisCell);
+		markSymbolModified(row, i);
 		thisCell->setSymbol(expr[exprStrIter]);
 
 #if RUNMODE == DIRECTIONAL_MODE
@@ -1293,6 +2665,9 @@ void BoardObject::setExprOnCol(const int col, const int startRow, const std::str
 		const int targetRow = startRow + i;
 		Cell* thisCell = &m_board[targetRow][col];
 		assert(thisCell->isFree() && "There is a bug ! I'm overriding the same positions here !");
+		journalCell(*prevNodeOnCol);
+		journalCell(*thisCell);
+		markSymbolModified(targetRow, col);
 		thisCell->setSymbol(expr[i]);
 
 #if RUNMODE == DIRECTIONAL_MODE
@@ -1312,10 +2687,13 @@ void BoardObject::clearExprOnRow(const int row, const int startCol, const uint s
 	int exprStrIter = (int)size - 2; // NOt cache friendly but doesn't matter with our dimensions
 
 	Cell* prevNodeOnRow = &m_board[row][startCol];
+	journalCell(*prevNodeOnRow);
 	prevNodeOnRow->m_left = nullptr;
 	for (uint i = startIterPos; exprStrIter >= 0; i--, exprStrIter--)
 	{
 		Cell* thisCell = &m_board[row][i];
+		journalCell(*thisCell);
+		markSymbolModified(row, i);
 		thisCell->reset();
 	}
 }
@@ -1325,73 +2703,47 @@ void BoardObject::clearExprOnCol(const int col, const int startRow, const uint s
 {
 	const uint startIterPos = 1;
 	Cell* prevNodeOnCol = &m_board[startRow][col];
+	journalCell(*prevNodeOnCol);
 	prevNodeOnCol->m_down = nullptr;
 	for (uint i = 1; i < size; i++)
 	{
 		const int targetRow = startRow + i;
 		Cell* thisCell = &m_board[targetRow][col];
+		journalCell(*thisCell);
+		markSymbolModified(targetRow, col);
 		thisCell->reset();
 	}
 }
 
 bool BoardObject::propagateSourceEvent(const Cell::BroadcastEventType srcEventType, const TablePos& pos, const SourceInfo& sourceInfo, const bool allSources)
 {
-	return internalPropagateSourceEvent(srcEventType, getRootCell(), pos, sourceInfo, allSources, 0);
+	// All cells' views share the sources table of this board, so a single update reaches everyone
+	return propagateSourceEvents(SourceEventsBatch(1, SourceEvent(srcEventType, pos, sourceInfo, allSources)));
 }
 
-bool BoardObject::internalPropagateSourceEvent(const Cell::BroadcastEventType srcEventType, Cell* cell, const TablePos& tablePos, const SourceInfo& source, const bool allSources, const int depth)
+bool BoardObject::propagateSourceEvents(const SourceEventsBatch& events)
 {
-	if (cell == nullptr)
-		return true;
-
-	bool childResuls = true;
-
-#if RUNMODE == DIRECTIONAL_MODE
-	if (cell->isRoot())
+	bool allApplied = true;
+	bool anyApplied = false;
+	bool layoutModified = false;
+	for (const SourceEvent& event : events)
 	{
-		// Did we come back to the root ?
-		if (depth > 0)
-			return true;
-
-		// Redirect to the cell bellow it
-		Cell* cellBelow = &(cell->m_boardView->m_board[cell->m_row + 1][cell->m_column]);
-		childResuls &= internalPropagateSourceEvent(srcEventType, cellBelow, tablePos, source, allSources, depth + 1);
+		const bool applied = applySourceEvent(event, layoutModified);
+		allApplied &= applied;
+		anyApplied |= applied;
 	}
 
-	// Follow previous links. Can't get a cycle so no need to protect the flood fill
-	for (int dirIter = 0; dirIter < DIR_COUNT; dirIter++)
+	// The cached data keyed by the sources versions is invalidated once for the whole batch
+	if (layoutModified)
 	{
-		const int rowOffset = Cell::DIR_OFFSET[dirIter].row;
-		const int colOffset = Cell::DIR_OFFSET[dirIter].col;
-
-		Cell* prev = *(cell->m_previousByDir[dirIter]);
-		if (prev)
-		{
-			childResuls &= internalPropagateSourceEvent(srcEventType, prev, tablePos, source, allSources, depth + 1);
-		}
+		m_sources->onLayoutModified();
 	}
-#else
-	childResuls &= internalPropagateSourceEvent(srcEventType, cell->m_left, tablePos, source, allSources, depth + 1);
-	childResuls &= internalPropagateSourceEvent(srcEventType, cell->m_right, tablePos, source, allSources, depth + 1);
-#endif
-
-	bool resThis = false;
-	switch (srcEventType)
+	else if (anyApplied)
 	{
-	case Cell::EVENT_SOURCE_ADD:
-		resThis = cell->m_boardView->addSource(tablePos, source);
-		break;
-	case Cell::EVENT_SOURCE_MODIFY:
-		resThis = cell->m_boardView->modifySource(tablePos, source);
-		break;
-	case Cell::EVENT_SOURCE_REMOVE:
-		resThis = cell->m_boardView->removeSource(tablePos, allSources);
-		break;
-	default:
-		assert(false);
+		m_sources->onModified();
 	}
 
-	return (resThis && childResuls);
+	return allApplied;
 }
 
 int BoardObject::getOccupiedItemsOnCol(const int col, const int startRow, const bool down /* = true */, const bool includeMembrane/* = false*/) const
@@ -1451,7 +2803,7 @@ int BoardObject::getFreeItemsOnCol(const int col, const int startRow, const bool
 		return -1;
 
 	int freeItems = 0;
-	for (int iterRow = startRow + 1; iterRow < MAX_ROWS; iterRow++)
+	for (int iterRow = startRow + 1; iterRow < g_boardRows; iterRow++)
 	{
 		if (m_board[iterRow][col].isFree() == false)
 			break;
@@ -1516,7 +2868,7 @@ int BoardObject::getFreeItemsOnRow(const int row, const int startCol, const bool
 	return freeItems;
 #else
 	//Test if this row is not actually a continuation of another row...
-	if (startCol + 1 < MAX_COLS && m_board[row][startCol + 1].isFree() == false)
+	if (startCol + 1 < g_boardCols && m_board[row][startCol + 1].isFree() == false)
 		return -1;
 
 	int freeItems = 0;
@@ -1730,8 +3082,8 @@ void BoardObject::generateMembrane(const int minMembraneSize, const int maxMembr
 	int n = randRange(minMembraneSize, maxMembraneSize);
 	int m = randRange(minMembraneSize, maxMembraneSize);
 
-	n = std::min(n, MAX_COLS - nextPointer.col - 1);
-	m = std::min(m, MAX_ROWS - nextPointer.row - 1);
+	n = std::min(n, g_boardCols - nextPointer.col - 1);
+	m = std::min(m, g_boardRows - nextPointer.row - 1);
 
 	assert(n >= minMembraneSize && "Can't fit the minimum membrane size");
 	assert(m >= minMembraneSize && "Can't fit the minimum membrane size");
@@ -1741,6 +3093,7 @@ void BoardObject::generateMembrane(const int minMembraneSize, const int maxMembr
 	for (int i = 0; i < n; i++)
 	{
 		Cell* thisCell = &m_board[nextPointer.row][nextPointer.col];
+		markSymbolModified(nextPointer.row, nextPointer.col);
 		thisCell->setSymbol('4');
 		thisCell->m_cellType = CELL_MEMBRANE;
 		nextPointer.col++;
@@ -1750,6 +3103,7 @@ void BoardObject::generateMembrane(const int minMembraneSize, const int maxMembr
 	for (int i = 0; i < m; i++)
 	{
 		Cell* thisCell = &m_board[nextPointer.row][nextPointer.col];
+		markSymbolModified(nextPointer.row, nextPointer.col);
 		thisCell->setSymbol('7');
 		thisCell->m_cellType = CELL_MEMBRANE;
 		nextPointer.row++;
@@ -1759,6 +3113,7 @@ void BoardObject::generateMembrane(const int minMembraneSize, const int maxMembr
 	for (int i = 0; i < n + 1; i++)
 	{
 		Cell* thisCell = &m_board[nextPointer.row][nextPointer.col];
+		markSymbolModified(nextPointer.row, nextPointer.col);
 		thisCell->setSymbol('e');
 		thisCell->m_cellType = CELL_MEMBRANE;
 		nextPointer.col--;
@@ -1770,6 +3125,7 @@ void BoardObject::generateMembrane(const int minMembraneSize, const int maxMembr
 	for (int i = 0; i < m - 1; i++)
 	{
 		Cell* thisCell = &m_board[nextPointer.row][nextPointer.col];
+		markSymbolModified(nextPointer.row, nextPointer.col);
 		thisCell->setSymbol('2');
 		thisCell->m_cellType = CELL_MEMBRANE;
 		nextPointer.row--;
@@ -1782,13 +3138,13 @@ void BoardObject::getBorderPoints(const int rootRow, const int rootCol, TablePos
 	outMin = TablePos(rootRow, rootCol);
 	int currRow = rootRow;
 	int currCol = rootCol;
-	while (currCol + 1 < MAX_COLS && m_board[currRow][currCol + 1].isFree() == false) // Go to max right
+	while (currCol + 1 < g_boardCols && m_board[currRow][currCol + 1].isFree() == false) // Go to max right
 	{
 		currCol++;
 	}
 
 	// Go to max down
-	while (currRow + 1 < MAX_ROWS && m_board[currRow + 1][currCol].isFree() == false)
+	while (currRow + 1 < g_boardRows && m_board[currRow + 1][currCol].isFree() == false)
 	{
 		currRow++;
 	}
@@ -1806,7 +3162,7 @@ void BoardObject::generateColExpression(const int middleRow, const int maxAttemp
 	indices.reserve(colMax - colMin + 1);
 	for (int i = colMin; i <= colMax; i++)
 		indices.push_back(i);
-	std::random_shuffle(indices.begin(), indices.end());
+	std::random_shuffle(indices.begin(), indices.end(), randIndex);
 
 	const int attempts = std::min(maxAttempts, (int)indices.size());
 	for (int attemptIter = 0; attemptIter < attempts; attemptIter++)
@@ -1829,6 +3185,7 @@ void BoardObject::generateColExpression(const int middleRow, const int maxAttemp
 			for (int upIter = 1; upIter <= numItemsUp; upIter++)
 			{
 				Cell* newCell = &m_board[middleRow - upIter][col];
+				markSymbolModified(middleRow - upIter, col);
 				newCell->setSymbol('7');
 				newCell->m_down = cellIter;
 				cellIter->m_prevUp = newCell;
@@ -1844,6 +3201,7 @@ void BoardObject::generateColExpression(const int middleRow, const int maxAttemp
 			for (int downIter = 1; downIter <= numItemsDown; downIter++)
 			{
 				Cell* newCell = &m_board[middleRow + downIter][col];
+				markSymbolModified(middleRow + downIter, col);
 				newCell->setSymbol('2');
 				newCell->m_up = cellIter;
 				cellIter->m_prevDown = newCell;
@@ -1869,7 +3227,7 @@ void BoardObject::generateRowExpression(const int middleCol, const int maxAttemp
 	indices.reserve(rowMax - rowMin + 1);
 	for (int i = rowMin; i <= rowMax; i++)
 		indices.push_back(i);
-	std::random_shuffle(indices.begin(), indices.end());
+	std::random_shuffle(indices.begin(), indices.end(), randIndex);
 
 	const int attempts = std::min(maxAttempts, (int)indices.size());
 	for (int attemptIter = 0; attemptIter < attempts; attemptIter++)
@@ -1893,6 +3251,7 @@ void BoardObject::generateRowExpression(const int middleCol, const int maxAttemp
 			for (int leftIter = 1; leftIter <= numItemsLeft; leftIter++)
 			{
 				Cell* newCell = &m_board[row][middleCol - leftIter];
+				markSymbolModified(row, middleCol - leftIter);
 				newCell->setSymbol('4');
 				newCell->m_cellType = decideCellType(startCell, DIR_LEFT);
 			}
@@ -1904,6 +3263,7 @@ void BoardObject::generateRowExpression(const int middleCol, const int maxAttemp
 			for (int rightIter = 1; rightIter <= numItemsRight; rightIter++)
 			{
 				Cell* newCell = &m_board[row][middleCol + rightIter];
+				markSymbolModified(row, middleCol + rightIter);
 				newCell->setSymbol('e');
 				newCell->m_cellType = decideCellType(startCell, DIR_RIGHT);
 			}
@@ -1948,7 +3308,7 @@ bool BoardObject::canCutColumn(const int column) const
 		return false;
 
 	int numOccupiedItems = 0;
-	for (int i = 0; i < MAX_ROWS; i++)
+	for (int i = 0; i < g_boardRows; i++)
 	{
 		if (m_membraneBoundsPerRow[i].first == column ||
 			m_membraneBoundsPerRow[i].second == column)
@@ -1970,7 +3330,7 @@ bool BoardObject::canCutRow(const int row) const
 		return false;
 
 	int numOccupiedItems = 0;
-	for (int i = 0; i < MAX_COLS; i++)
+	for (int i = 0; i < g_boardCols; i++)
 	{
 		if (m_membraneBoundsPerCol[i].first == row ||
 			m_membraneBoundsPerCol[i].second == row)
@@ -1986,7 +3346,7 @@ bool BoardObject::canCutRow(const int row) const
 	return numOccupiedItems != 0;
 }
 
-bool BoardObject::evaluateMembraneCut(membraneCutFunctorType func, const DIRECTION dirs[2], const int index, const float baselineFlowAvg, DIRECTION& outDir, float& outFlowDiff) const
+bool BoardObject::evaluateMembraneCut(BoardObject& scratchBoard, membraneCutFunctorType func, const DIRECTION dirs[2], const int index, const float baselineFlowAvg, DIRECTION& outDir, float& outFlowDiff) const
 {
 	outFlowDiff = INVALID_FLOW;
 	outDir = DIR_COUNT;
@@ -2000,23 +3360,27 @@ bool BoardObject::evaluateMembraneCut(membraneCutFunctorType func, const DIRECTI
 			(*g_debugLogOutput) << " ---- Index: " << index << " dir: " << Cell::getDirString(cutDir) << std::endl;
 		}
 
-		// Copy the board and cut the membrane by shifting to the desired direction
-		BoardObject newBoard = *this;
-		(newBoard.*func)(index, cutDir, false);
+		// Cut the membrane by shifting to the desired direction, then undo the cut after evaluation
+		scratchBoard.beginTransaction();
+		(scratchBoard.*func)(index, cutDir, false);
 
 		// Check if this is complaint with language stuff
-		if (newBoard.isCompliantWithRowColPatterns() == false)
+		if (scratchBoard.isCompliantWithRowColPatterns() == false)
+		{
+			scratchBoard.rollbackTransaction();
 			continue;
+		}
 
-		newBoard.updateBoardAfterSymbolsInit();
+		scratchBoard.updateBoardAfterSymbolsInit();
 
-		newBoard.expandInternalTrees();
+		scratchBoard.expandInternalTrees();
 
 		// Try to add the garbaged items to improve the flow
-		newBoard.expandExternalTrees();
+		scratchBoard.expandExternalTrees();
 
 		// Run the simulation on it and get result
-		const float localFlowDiff = newBoard.doDataFlowSimulation_serial_WITHOUT_SIDE_EFFECTS(1) - baselineFlowAvg;
+		const float localFlowDiff = scratchBoard.doDataFlowSimulation_serial_WITHOUT_SIDE_EFFECTS(1) - baselineFlowAvg;
+		scratchBoard.rollbackTransaction();
 		if (localFlowDiff > outFlowDiff)
 		{
 			outFlowDiff = localFlowDiff;
@@ -2050,71 +3414,96 @@ bool BoardObject::evaluateMembraneOptimization(int& row, int &col, DIRECTION& di
 	// Obtain the baseline flow of this board
 	const float baselineFlow = doDataFlowSimulation_serial_WITHOUT_SIDE_EFFECTS(1);
 
-	// Check each row, get the best one.
+	// The cuts of all the rows then all the columns
+	struct MembraneCutTry
 	{
-		if (g_verboseBestGatheredSolutions)
-		{
-			(*g_debugLogOutput) << " -- Evaluating cutting on ROWS: " << std::endl;
-		}
+		membraneCutFunctorType func;
+		int index;
+		DIRECTION dirsToTry[2];
+		// Results
+		DIRECTION outDir = DIR_COUNT;
+		float outFlowDiff = INVALID_FLOW;
+		bool isValid = false;
+		std::string log;
+	};
 
+	std::vector<MembraneCutTry> cutTries;
+	int numRowTries = 0;
+	for (int rowIter = m_membraneBoundsRows.first + 1; rowIter <= m_membraneBoundsRows.second - 1; rowIter++)
+	{
+		if (!canCutRow(rowIter))
+			continue;
 
-		for (int rowIter = m_membraneBoundsRows.first + 1; rowIter <= m_membraneBoundsRows.second - 1; rowIter++)
-		{
-			if (!canCutRow(rowIter))
-				continue;
+		cutTries.emplace_back();
+		MembraneCutTry& cutTry = cutTries.back();
+		cutTry.func = &BoardObject::cutMembraneByRow;
+		cutTry.index = rowIter;
+		cutTry.dirsToTry[0] = DIR_UP;
+		cutTry.dirsToTry[1] = DIR_DOWN;
+		numRowTries++;
+	}
 
-			DIRECTION outDir = DIR_COUNT;
-			float outFlowDiff = INVALID_FLOW;
-			const DIRECTION dirsToTry[2] = { DIR_UP, DIR_DOWN };
-			if (evaluateMembraneCut(&BoardObject::cutMembraneByRow, dirsToTry, rowIter, baselineFlow, outDir, outFlowDiff))
-			{
-				if (g_verboseBestGatheredSolutions)
-				{
-					(*g_debugLogOutput) << "----- Eval row " << rowIter << " dir " << Cell::getDirString(outDir) << " - " << outFlowDiff << std::endl;
-				}
+	for (int colIter = m_membraneBoundsCols.first + 1; colIter <= m_membraneBoundsCols.second - 1; colIter++)
+	{
+		if (!canCutColumn(colIter))
+			continue;
 
-				if (outFlowDiff > flowBenRow)
-				{
-					flowBenRow = outFlowDiff;
-					row = rowIter;
-					dirRow = outDir;
-				}
-			}
-		}
+		cutTries.emplace_back();
+		MembraneCutTry& cutTry = cutTries.back();
+		cutTry.func = &BoardObject::cutMembraneByCol;
+		cutTry.index = colIter;
+		cutTry.dirsToTry[0] = DIR_LEFT;
+		cutTry.dirsToTry[1] = DIR_RIGHT;
 	}
 
-	// Check each col, get the best one
+	// The cuts are evaluated in parallel, each thread on its own copy of this board, with the random stream and log of the cut
+	ThreadScratchBoards scratchBoards(*this);
+	const uint64_t cutsSeed = randSeed();
+	g_taskPool.parallelFor((int)cutTries.size(), [&](const int tryIndex)
+	{
+		ScopedRandomStream tryStream(combineSeeds(cutsSeed, tryIndex));
+		std::ostringstream tryLog;
+		std::ostream* const prevDebugLogOutput = g_debugLogOutput;
+		g_debugLogOutput = &tryLog;
+
+		MembraneCutTry& cutTry = cutTries[tryIndex];
+		cutTry.isValid = evaluateMembraneCut(scratchBoards.get(), cutTry.func, cutTry.dirsToTry, cutTry.index, baselineFlow, cutTry.outDir, cutTry.outFlowDiff);
+
+		g_debugLogOutput = prevDebugLogOutput;
+		cutTry.log = tryLog.str();
+	});
+
+	// Get the best cut among the tries in [firstTry, endTry), in their order
+	auto gatherBestCut = [&](const char* cutsName, const char* cutName, const int firstTry, const int endTry, int& outIndex, DIRECTION& outDir, float& outFlowBen)
 	{
 		if (g_verboseBestGatheredSolutions)
 		{
-			(*g_debugLogOutput) << " -- Evaluating cutting on COLUMNS: " << std::endl;
+			(*g_debugLogOutput) << " -- Evaluating cutting on " << cutsName << ": " << std::endl;
 		}
 
-
-		for (int colIter = m_membraneBoundsCols.first + 1; colIter <= m_membraneBoundsCols.second - 1; colIter++)
+		for (int tryIndex = firstTry; tryIndex < endTry; tryIndex++)
 		{
-			if (!canCutColumn(colIter))
+			const MembraneCutTry& cutTry = cutTries[tryIndex];
+			(*g_debugLogOutput) << cutTry.log;
+			if (cutTry.isValid == false)
 				continue;
 
-			DIRECTION outDir = DIR_COUNT;
-			float outFlowDiff = INVALID_FLOW;
-			const DIRECTION dirsToTry[2] = { DIR_LEFT, DIR_RIGHT };
-			if (evaluateMembraneCut(&BoardObject::cutMembraneByCol, dirsToTry, colIter, baselineFlow, outDir, outFlowDiff))
+			if (g_verboseBestGatheredSolutions)
 			{
-				if (g_verboseBestGatheredSolutions)
-				{
-					(*g_debugLogOutput) << "----- Eval col " << colIter << " dir " << Cell::getDirString(outDir) << " - " << outFlowDiff << std::endl;
-				}
+				(*g_debugLogOutput) << "----- Eval " << cutName << " " << cutTry.index << " dir " << Cell::getDirString(cutTry.outDir) << " - " << cutTry.outFlowDiff << std::endl;
+			}
 
-				if (outFlowDiff > flowBenCol)
-				{
-					flowBenCol = outFlowDiff;
-					col = colIter;
-					dirCol = outDir;
-				}
+			if (cutTry.outFlowDiff > outFlowBen)
+			{
+				outFlowBen = cutTry.outFlowDiff;
+				outIndex = cutTry.index;
+				outDir = cutTry.outDir;
 			}
 		}
-	}
+	};
+
+	gatherBestCut("ROWS", "row", 0, numRowTries, row, dirRow, flowBenRow);
+	gatherBestCut("COLUMNS", "col", numRowTries, (int)cutTries.size(), col, dirCol, flowBenCol);
 
 	// Compare and output only the best result
 	if (row == INVALID_POS && col == INVALID_POS)
@@ -2157,18 +3546,9 @@ bool BoardObject::evaluateMembraneOptimization(int& row, int &col, DIRECTION& di
 
 void BoardObject::updateMembraneBounds(std::vector<Cell*>& membraneCells)
 {
-	auto invalidMinMaxCol = std::make_pair(MAX_COLS + 1, -1);
 	// Init min / max first
-	for (int i = 0; i < MAX_ROWS; i++)
-	{
-		m_membraneBoundsPerRow[i] = invalidMinMaxCol;
-	}
-
-	auto invalidMinMaxRow = std::make_pair(MAX_ROWS + 1, -1);
-	for (int i = 0; i < MAX_COLS; i++)
-	{
-		m_membraneBoundsPerCol[i] = invalidMinMaxRow;
-	}
+	m_membraneBoundsPerRow.assign(g_boardRows + 1, std::make_pair(g_boardCols + 1, -1));
+	m_membraneBoundsPerCol.assign(g_boardCols + 1, std::make_pair(g_boardRows + 1, -1));
 
 	for (const Cell* cell : membraneCells)
 	{
@@ -2183,6 +3563,116 @@ void BoardObject::updateMembraneBounds(std::vector<Cell*>& membraneCells)
 	}
 }
 
+// Adds the garbage collected symbols at the candidate positions, one at a time, as long as the flow improves.
+// Lazy greedy: adding cells only lowers the benefit of the other candidates, so the benefits in the heap are upper bounds once evaluated.
+// After each addition only the top candidate is evaluated again, until the top one is up to date and is the best
+void BoardObject::expandTreesLazyGreedy(std::vector<ResourceAllocatedEval>& candidates, const CellType cellType, Cell::UniversalHash2D& hash2D,
+	const std::vector<char>& availableSymbolsToFill, const bool addCandidatesAroundNewCells, const bool addFirstCell)
+{
+	const char* treeName = cellType == CELL_EXTERIOR ? "External" : "Internal";
+	float baselineCurrentFlow = doDataFlowSimulation_serial_WITHOUT_SIDE_EFFECTS(1);
+
+	// The flow benefit of a candidate, evaluated after numCellsAdded cells were added. Ties go to the first candidate
+	struct CandidateBenefit
+	{
+		float flowBenefit;
+		int numCellsAdded;
+		int candidateIndex;
+
+		bool operator<(const CandidateBenefit& other) const
+		{
+			return flowBenefit != other.flowBenefit ? flowBenefit < other.flowBenefit : candidateIndex > other.candidateIndex;
+		}
+	};
+
+	std::priority_queue<CandidateBenefit> heap;
+	int numCellsAdded = 0;
+
+	// Apply the symbol in a transaction, check if valid then compute the avg flow for one tick to decide
+	auto evaluateCandidate = [&](const int candidateIndex)
+	{
+		ResourceAllocatedEval& resourceEval = candidates[candidateIndex];
+		const int targetRow = resourceEval.pos.row;
+		const int targetCol = resourceEval.pos.col;
+		resourceEval.flowBenefit = INVALID_FLOW;
+
+		beginTransaction();
+		setNewCell(targetRow, targetCol, resourceEval.symbol, cellType, false);
+		if (isCompliantWithRowColPatterns(targetRow, targetCol))
+		{
+			doDataFlowSimulation_serial(1, false);
+			resourceEval.flowBenefit = getLastSimulationAvgDataFlowPerUnit() - baselineCurrentFlow;
+
+			if (g_verboseLocalSolutions)
+			{
+				(*g_debugLogOutput) << " -------- Expand " << treeName << " tree on Pos (" << targetRow << "," << targetCol << ")" << " Sym: " << resourceEval.symbol << " Benefit: " << resourceEval.flowBenefit << std::endl;
+			}
+		}
+		rollbackTransaction();
+
+		CandidateBenefit benefit;
+		benefit.flowBenefit = resourceEval.flowBenefit;
+		benefit.numCellsAdded = numCellsAdded;
+		benefit.candidateIndex = candidateIndex;
+		heap.push(benefit);
+	};
+
+	for (int candidateIndex = 0; candidateIndex < (int)candidates.size(); candidateIndex++)
+	{
+		evaluateCandidate(candidateIndex);
+	}
+
+	bool mustAddCell = addFirstCell;
+	while (!heap.empty())
+	{
+		const CandidateBenefit best = heap.top();
+		heap.pop();
+
+		// Candidates only get invalid over time: their symbol is used up, or their position taken or next to a new cell
+		const ResourceAllocatedEval& rsc = candidates[best.candidateIndex];
+		if (m_garbageCollectedResources[rsc.symbol] == 0 || !m_board[rsc.pos.row][rsc.pos.col].isFree() || getNumNeighboors(rsc.pos) > 1)
+			continue;
+
+		if (best.numCellsAdded != numCellsAdded)
+		{
+			evaluateCandidate(best.candidateIndex);
+			continue;
+		}
+
+		// The best up to date candidate. The others can't do better, so stop if it doesn't improve the flow
+		if (best.flowBenefit == INVALID_FLOW || (best.flowBenefit <= 0.0f && !mustAddCell))
+			break;
+
+		const TablePos newCellPos = rsc.pos;
+		const char newCellSymbol = rsc.symbol;
+		this->setNewCell(newCellPos.row, newCellPos.col, newCellSymbol, cellType, true); // Definitive this time !
+
+		if (g_verboseBestGatheredSolutions)
+		{
+			(*g_debugLogOutput) << " ------- Expand" << treeName << "Tree Best Pos: (" << newCellPos.row << "," << newCellPos.col << ")" << " Sym: " << newCellSymbol << " Benefit: " << best.flowBenefit << std::endl;
+		}
+
+		// Consume the symbol committed from the map
+		assert(m_garbageCollectedResources[newCellSymbol] > 0);
+		m_garbageCollectedResources[newCellSymbol]--;
+
+		baselineCurrentFlow += best.flowBenefit;
+		numCellsAdded++;
+		mustAddCell = false;
+
+		// The positions around the new cell are candidates too
+		if (addCandidatesAroundNewCells)
+		{
+			const int firstNewCandidate = (int)candidates.size();
+			addPotentialNewCellsAround(candidates, cellType, newCellPos.row, newCellPos.col, hash2D, availableSymbolsToFill);
+			for (int candidateIndex = firstNewCandidate; candidateIndex < (int)candidates.size(); candidateIndex++)
+			{
+				evaluateCandidate(candidateIndex);
+			}
+		}
+	}
+}
+
 // Expands the external trees to improve overall flow
 void BoardObject::expandExternalTrees()
 {
@@ -2235,91 +3725,8 @@ void BoardObject::expandExternalTrees()
 		printBoard(std::cout);
 	}
 
-	float baselineCurrentFlow = doDataFlowSimulation_serial_WITHOUT_SIDE_EFFECTS(1);
-
-	do {
-		int argmax = -1;
-		float bestFlowBenefit = INVALID_FLOW;
-
-		// Step 3: for each such position compute the improvements added if we put something there. Continue moving in the most promising direction.
-		// Update ValidSet after each new position added.
-		for (int targetsIter = 0; targetsIter < validSet.size(); targetsIter++)
-		{
-			ResourceAllocatedEval& resourceEval = validSet[targetsIter];
-			resourceEval.flowBenefit = INVALID_FLOW;
-
-			// If we don't have remaining symbols of this type, don't do anything
-			if (m_garbageCollectedResources[resourceEval.symbol] == 0)
-			{
-				continue;
-			}
-
-			// Copy board, apply the symbol, check if valid then compute the avg flow for one tick to decide		
-			BoardObject* newBoard = new BoardObject();
-			*newBoard = *this;
-
-			const int targetRow = resourceEval.pos.row;
-			const int targetCol = resourceEval.pos.col;
-
-			// Apply symbol and set links to neighbors
-			newBoard->setNewCell(targetRow, targetCol, resourceEval.symbol, CELL_EXTERIOR, false);
-
-			if (newBoard->isCompliantWithRowColPatterns(targetRow, targetCol) == false)
-			{
-				delete newBoard;
-				continue;
-			}
-
-			newBoard->doDataFlowSimulation_serial(1, false);
-			const float flowRes = newBoard->getLastSimulationAvgDataFlowPerUnit();
-			resourceEval.flowBenefit = flowRes - baselineCurrentFlow;
-
-			if (g_verboseLocalSolutions)
-			{
-				(*g_debugLogOutput) << " -------- Expand external tree on Pos (" << targetRow << "," << targetCol << ")" << " Sym: " << resourceEval.symbol << " Benefit: " << resourceEval.flowBenefit << std::endl;
-			}
-
-			if (resourceEval.flowBenefit > 0.0f && resourceEval.flowBenefit > bestFlowBenefit)
-			{
-				bestFlowBenefit = resourceEval.flowBenefit;
-				argmax = targetsIter;
-			}
-
-			delete newBoard;
-		}
-
-		// TODO: verbose argmax !!
-		if (bestFlowBenefit > 0.0f && argmax > 0)
-		{
-			// Set this symbol on board
-			const ResourceAllocatedEval& rsc = validSet[argmax];
-			Cell& newAddedCell = m_board[rsc.pos.row][rsc.pos.col];
-			this->setNewCell(rsc.pos.row, rsc.pos.col, rsc.symbol, CELL_EXTERIOR, true); // Definitive this time !
-
-			if (g_verboseBestGatheredSolutions)
-			{
-				(*g_debugLogOutput) << " ------- ExpandExternalTree Best Pos: (" << rsc.pos.row << "," << rsc.pos.col << ")" << " Sym: " << rsc.symbol << " Benefit: " << bestFlowBenefit << std::endl;
-			}
-
-			// Consume the symbol committed from the map
-			assert(m_garbageCollectedResources[rsc.symbol] > 0);
-			m_garbageCollectedResources[rsc.symbol]--;
-
-			// Update the potential list of positions
-			addPotentialNewCellsAround(validSet, CELL_EXTERIOR, rsc.pos.row, rsc.pos.col, hash2D, availableSymbolsToFill);
-
-			// Move on to select another one !
-
-			// Update first the base flow value
-			baselineCurrentFlow += bestFlowBenefit;
-		}
-		else
-		{
-			// No more moves, exit !
-			break;
-		}
-
-	} while (true);
+	// Step 3: add the most promising positions while the flow improves. Each new cell brings the positions around it in ValidSet
+	expandTreesLazyGreedy(validSet, CELL_EXTERIOR, hash2D, availableSymbolsToFill, true, false);
 }
 
 void BoardObject::expandInternalTrees()
@@ -2327,146 +3734,62 @@ void BoardObject::expandInternalTrees()
 	// IDEA: collect all potential nodes around membrane nodes or existing internal nodes that are NOT LEAF and extend them with something that would be a leaf
 	// to have more leafs and collect more flow
 
-	const float baselineCurrentFlow = doDataFlowSimulation_serial_WITHOUT_SIDE_EFFECTS(1);
-
-	// Try this until adding a new leaf does not further increase the flow
-	while (true)
-	{
-		std::vector<Cell*> interiorRoots;
-		getMembraneCellsChildren(interiorRoots, CELL_INTERIOR);
-		const bool noInteriorRoots = interiorRoots.empty();
-
-		// PART 1: collect potential locations
-		//-------------------------------------------------------
-		std::vector<Cell*> membraneCells;
-		getMembraneCells(membraneCells);
-
-		updateMembraneBounds(membraneCells);
-
-		// Step 1: collect all nodes starting from membrane nodes and exterior subtrees
-		std::vector<std::pair<Cell*, std::vector<Cell*>>> occupiedCellsList; // occupiedCellList[M] = list => the subtree nodes below membrane node M
-		for (Cell* memCell : membraneCells)
-		{
-			std::vector<Cell*> occupiedCellsBelowMemCell;
-			occupiedCellsBelowMemCell.push_back(memCell); // Add the membrane cell too 
-			collectAllNodesFromRoot(memCell, occupiedCellsBelowMemCell, CELL_INTERIOR);
-			occupiedCellsList.emplace_back(std::make_pair(memCell, occupiedCellsBelowMemCell));
-		}
-
-		// Step 2: identify all available positions near the positions at Step 1 - valid are positions inside table which have a SINGLE valid neighbor on table
-		// Let this set be ValidSet
-		Cell::UniversalHash2D hash2D;
+	std::vector<Cell*> interiorRoots;
+	getMembraneCellsChildren(interiorRoots, CELL_INTERIOR);
+	const bool noInteriorRoots = interiorRoots.empty();
 
-		// Fill the list of different symbols that can be used (the ones garbage collected)
-		std::vector<char> availableSymbolsToFill;
-		for (auto& entry : m_garbageCollectedResources)
-		{
-			if (entry.second > 0)
-				availableSymbolsToFill.push_back(entry.first);
-		}
+	// PART 1: collect potential locations
+	//-------------------------------------------------------
+	std::vector<Cell*> membraneCells;
+	getMembraneCells(membraneCells);
 
-		std::vector<ResourceAllocatedEval> validSet;
-		for (std::pair<Cell*, std::vector<Cell*>>& cellsBelowParent : occupiedCellsList)
-		{
-			Cell* parent = cellsBelowParent.first;
-			const std::vector<Cell*>& cellsList = cellsBelowParent.second;
+	updateMembraneBounds(membraneCells);
 
-			for (const Cell* cell : cellsList)
-			{
-				const int row = cell->m_row;
-				const int column = cell->m_column;
+	// Step 1: collect all nodes starting from membrane nodes and exterior subtrees
+	std::vector<std::pair<Cell*, std::vector<Cell*>>> occupiedCellsList; // occupiedCellList[M] = list => the subtree nodes below membrane node M
+	for (Cell* memCell : membraneCells)
+	{
+		std::vector<Cell*> occupiedCellsBelowMemCell;
+		occupiedCellsBelowMemCell.push_back(memCell); // Add the membrane cell too 
+		collectAllNodesFromRoot(memCell, occupiedCellsBelowMemCell, CELL_INTERIOR);
+		occupiedCellsList.emplace_back(std::make_pair(memCell, occupiedCellsBelowMemCell));
+	}
 
-				// Do not add cells around leafs !!
-				if (cell->isInteriorLeaf())
-					continue;
+	// Step 2: identify all available positions near the positions at Step 1 - valid are positions inside table which have a SINGLE valid neighbor on table
+	// Let this set be ValidSet
+	Cell::UniversalHash2D hash2D;
 
-				addPotentialNewCellsAround(validSet, CELL_INTERIOR, row, column, hash2D, availableSymbolsToFill);
-			}
-		}
+	// Fill the list of different symbols that can be used (the ones garbage collected)
+	std::vector<char> availableSymbolsToFill;
+	for (auto& entry : m_garbageCollectedResources)
+	{
+		if (entry.second > 0)
+			availableSymbolsToFill.push_back(entry.first);
+	}
 
-		// Part 2: try each potential cell and get the best one
-		int argmax = -1;
-		float bestFlowBenefit = INVALID_FLOW;
+	std::vector<ResourceAllocatedEval> validSet;
+	for (std::pair<Cell*, std::vector<Cell*>>& cellsBelowParent : occupiedCellsList)
+	{
+		Cell* parent = cellsBelowParent.first;
+		const std::vector<Cell*>& cellsList = cellsBelowParent.second;
 
-		// Step 3: for each such position compute the improvements added if we put something there. Continue moving in the most promising direction.
-		// Update ValidSet after each new position added.
-		for (int targetsIter = 0; targetsIter < validSet.size(); targetsIter++)
+		for (const Cell* cell : cellsList)
 		{
-			ResourceAllocatedEval& resourceEval = validSet[targetsIter];
-			resourceEval.flowBenefit = INVALID_FLOW;
-
-			// If we don't have remaining symbols of this type, don't do anything
-			if (m_garbageCollectedResources[resourceEval.symbol] == 0)
-			{
-				continue;
-			}
-
-			// Copy board, apply the symbol, check if valid then compute the avg flow for one tick to decide		
-			BoardObject* newBoard = new BoardObject();
-			*newBoard = *this;
-
-			const int targetRow = resourceEval.pos.row;
-			const int targetCol = resourceEval.pos.col;
-
-			// Apply symbol and set links to neighbors
-			newBoard->setNewCell(targetRow, targetCol, resourceEval.symbol, CELL_INTERIOR, false);
+			const int row = cell->m_row;
+			const int column = cell->m_column;
 
-			if (newBoard->isCompliantWithRowColPatterns(targetRow, targetCol) == false)
-			{
-				delete newBoard;
+			// Do not add cells around leafs !!
+			if (cell->isInteriorLeaf())
 				continue;
-			}
-
-			newBoard->doDataFlowSimulation_serial(1, false);
-			const float flowRes = newBoard->getLastSimulationAvgDataFlowPerUnit();
-			resourceEval.flowBenefit = flowRes - baselineCurrentFlow;
-
-			if (g_verboseLocalSolutions)
-			{
-				(*g_debugLogOutput) << " -------- Expand external tree on Pos (" << targetRow << "," << targetCol << ")" << " Sym: " << resourceEval.symbol << " Benefit: " << resourceEval.flowBenefit << std::endl;
-			}
-
-			const bool isFlowBetter = (resourceEval.flowBenefit > 0.0f && resourceEval.flowBenefit > bestFlowBenefit);
-			if (noInteriorRoots || isFlowBetter)
-			{
-				bestFlowBenefit = resourceEval.flowBenefit;
-				argmax = targetsIter;
-
-				if (!isFlowBetter)
-				{
-					// Don't evaluate others..continue just
-					break;
-				}
-			}
-
-			delete newBoard;
-		}
-
-		// TODO: verbose argmax !!
-		if ((bestFlowBenefit > 0.0f || noInteriorRoots) && argmax > 0)
-		{
-			// Set this symbol on board
-			const ResourceAllocatedEval& rsc = validSet[argmax];
-			Cell& newAddedCell = m_board[rsc.pos.row][rsc.pos.col];
-			this->setNewCell(rsc.pos.row, rsc.pos.col, rsc.symbol, CELL_INTERIOR, true); // Definitive this time !
-
-			if (g_verboseBestGatheredSolutions)
-			{
-				(*g_debugLogOutput) << " ------- ExpandInternalTree Best Pos: (" << rsc.pos.row << "," << rsc.pos.col << ")" << " Sym: " << rsc.symbol << " Benefit: " << bestFlowBenefit << std::endl;
-			}
 
-			// Consume the symbol committed from the map
-			assert(m_garbageCollectedResources[rsc.symbol] > 0);
-			m_garbageCollectedResources[rsc.symbol]--;
-		}
-		else
-		{
-			// No more moves, exit !
-			break;
+			addPotentialNewCellsAround(validSet, CELL_INTERIOR, row, column, hash2D, availableSymbolsToFill);
 		}
 	}
-}
 
+	// PART 2: add the most promising positions while the flow improves. The new cells are leaves, so they don't bring new positions.
+	// Without interior trees, the first cell is added even if it doesn't improve the flow
+	expandTreesLazyGreedy(validSet, CELL_INTERIOR, hash2D, availableSymbolsToFill, false, noInteriorRoots);
+}
 
 void BoardObject::getMembraneCells(std::vector<Cell*>& membraneCells)
 {
@@ -2500,7 +3823,7 @@ void BoardObject::runGarbageCollector(const float threshold, std::ostream& outSt
 	const bool noInteriorRoots = interiorRoots.empty();
 
 	// Fill simulation context to decide how much each external leaf will get
-	SimulationContext simContext;
+	SimulationContext& simContext = m_simulationScratch.simContext;
 	fillSimulationContext(simContext);
 
 	for (Cell* root : exteriorRoots)
@@ -2542,7 +3865,10 @@ void BoardObject::garbageCollectSubtree(Cell* root)
 		garbageCollectSubtree(child);
 	}
 
-	// Reset this node too
+	// Reset this node too. A cell reached from two parents is already reset the second time, so its position comes from its address
+	journalCell(*root);
+	const int index = (int)(root - &m_board.at(0));
+	markSymbolModified(index / m_board.getNumCols(), index % m_board.getNumCols());
 	root->reset();
 }
 
@@ -2644,13 +3970,13 @@ bool BoardObject::generateRandomBoard(const int numDepthBranches, const int numS
 		bool succeded = false;
 		for (int i = 0; i < maxAttemptsForRoot; i++)
 		{
-			const bool succededRow = m_rowGenerator->GenerateRandom(MAX_COLS, resultRow, nullptr);
+			const bool succededRow = m_rowGenerator->GenerateRandom(g_boardCols, resultRow, nullptr);
 			if (!succededRow)
 				continue;
 
 			Constraint constr;
 			constr.setConstraintFirst(resultRow.m_str.back());
-			const bool succededCol = m_colGenerator->GenerateRandom(MAX_ROWS, resultCol, &constr);
+			const bool succededCol = m_colGenerator->GenerateRandom(g_boardRows, resultCol, &constr);
 			if (!succededCol)
 				continue;
 
@@ -2665,20 +3991,21 @@ bool BoardObject::generateRandomBoard(const int numDepthBranches, const int numS
 		}
 
 		// Set the root first on board
-		const int rootColumn = MAX_COLS - 1;
+		const int rootColumn = g_boardCols - 1;
 		const int rootRow = 0;
 
-		const int startColumn = MAX_COLS - (int)resultRow.m_str.size(), endColumn = MAX_COLS - 1;
-		m_board[0][MAX_COLS - 1].setSymbol(resultRow.m_str.back());
-		m_board[0][MAX_COLS - 1].m_row = 0;
-		m_board[0][MAX_COLS - 1].m_column = MAX_COLS - 1;
+		const int startColumn = g_boardCols - (int)resultRow.m_str.size(), endColumn = g_boardCols - 1;
+		markSymbolModified(0, g_boardCols - 1);
+		m_board[0][g_boardCols - 1].setSymbol(resultRow.m_str.back());
+		m_board[0][g_boardCols - 1].m_row = 0;
+		m_board[0][g_boardCols - 1].m_column = g_boardCols - 1;
 		setExprOnRow(0, endColumn, resultRow.m_str);
-		setExprOnCol(MAX_COLS - 1, 0, resultCol.m_str);
+		setExprOnCol(g_boardCols - 1, 0, resultCol.m_str);
 		//--------------------------------------
 
 		// Step 2: generate the cols and rows recursively from maxDepth
 		generateCol(0, startColumn, endColumn, numDepthBranches - 1);
-		generateRow(MAX_COLS - 1, 0, (int)resultCol.m_str.size() - 1, numDepthBranches - 1);
+		generateRow(g_boardCols - 1, 0, (int)resultCol.m_str.size() - 1, numDepthBranches - 1);
 
 		setRootLocation(rootRow, rootColumn);
 #else
@@ -2702,16 +4029,18 @@ bool BoardObject::generateRandomBoard(const int numDepthBranches, const int numS
 
 												 // Step 2.5: generate some random sources
 		const int numSourcesToGenerate = numSources; //randRange(1, 4);
+		SourceEventsBatch sourceEvents;
 		for (int i = 0; i < numSourcesToGenerate; i++)
 		{
-			const int row = randRange(0, MAX_ROWS - 1);
-			const int col = randRange(0, MAX_COLS - 1);
+			const int row = randRange(0, g_boardRows - 1);
+			const int col = randRange(0, g_boardCols - 1);
 			const float power = (float)randRange(g_minPowerForWirelessSource, g_maxPowerForWirelessSource);
 
 			SourceInfo src;
 			src.overridePower(power);
-			propagateSourceEvent(Cell::EVENT_SOURCE_ADD, TablePos(row, col), src, false);
+			sourceEvents.emplace_back(Cell::EVENT_SOURCE_ADD, TablePos(row, col), src);
 		}
+		propagateSourceEvents(sourceEvents);
 
 		// We found a solution !
 		getRootCell()->initFlowStatistics(g_simulationTicksForDataFlowEstimation);
@@ -2834,7 +4163,7 @@ void BoardObject::cutMembraneByRow(const int index, const DIRECTION dir, const b
 		// Items come from up side
 		for (int iRow = index; iRow > rowMin; iRow--)
 		{
-			for (int iCol = 0; iCol < MAX_COLS; iCol++)
+			for (int iCol = 0; iCol < g_boardCols; iCol++)
 			{
 				m_board[iRow][iCol].setSymbol(m_board[iRow - 1][iCol].m_symbol);
 				m_board[iRow - 1][iCol].setEmpty();
@@ -2849,7 +4178,7 @@ void BoardObject::cutMembraneByRow(const int index, const DIRECTION dir, const b
 		// Items come from down side
 		for (int iRow = index; iRow < rowMax; iRow++)
 		{
-			for (int iCol = 0; iCol < MAX_COLS; iCol++)
+			for (int iCol = 0; iCol < g_boardCols; iCol++)
 			{
 				//std::cout << "last " << iRow << " " << iCol << std::endl;
 
@@ -2862,6 +4191,7 @@ void BoardObject::cutMembraneByRow(const int index, const DIRECTION dir, const b
 			newRootRow--;
 	}
 
+	markAllSymbolsModified();
 	updateRootLocation(newRootRow, newRootCol);
 
 	if (definitive)
@@ -2905,7 +4235,7 @@ void BoardObject::cutMembraneByCol(const int index, const DIRECTION dir, const b
 		// Items come from left side
 		for (int iCol = index; iCol > colMin; iCol--)
 		{
-			for (int iRow = 0; iRow < MAX_ROWS; iRow++)
+			for (int iRow = 0; iRow < g_boardRows; iRow++)
 			{
 				Cell& prevCell = m_board[iRow][iCol - 1];
 				Cell& newCell = m_board[iRow][iCol];
@@ -2922,7 +4252,7 @@ void BoardObject::cutMembraneByCol(const int index, const DIRECTION dir, const b
 		// Items come from right side
 		for (int iCol = index; iCol < colMax; iCol++)
 		{
-			for (int iRow = 0; iRow < MAX_ROWS; iRow++)
+			for (int iRow = 0; iRow < g_boardRows; iRow++)
 			{
 				m_board[iRow][iCol].setSymbol(m_board[iRow][iCol + 1].m_symbol);
 				m_board[iRow][iCol + 1].setEmpty();
@@ -2933,6 +4263,7 @@ void BoardObject::cutMembraneByCol(const int index, const DIRECTION dir, const b
 			newRootCol--;
 	}
 
+	markAllSymbolsModified();
 	updateRootLocation(newRootRow, newRootCol);
 
 	if (definitive)
@@ -3004,6 +4335,8 @@ bool BoardObject::cutMembraneCorner(const std::vector<TablePos>& inflexionPoints
 				newRootRow = newRootCol = INVALID_POS;
 			}
 
+			journalCellAndLinks(thisCell);
+			markSymbolModified(iterPos.row, iterPos.col);
 			thisCell.setEmpty();
 		}
 
@@ -3025,16 +4358,28 @@ bool BoardObject::cutMembraneCorner(const std::vector<TablePos>& inflexionPoints
 	}
 
 	for (int y = startP.row; y >= yOffset + 1; y--)
+	{
+		markSymbolModified(y, startP.col);
 		m_board[y][startP.col].setSymbol('2');
+	}
 
 	for (int x = startP.col; x <= xOffset - 1; x++)
+	{
+		markSymbolModified(yOffset, x);
 		m_board[yOffset][x].setSymbol('4');
+	}
 
 	for (int y = yOffset; y >= middleP.row + 1; y--)
+	{
+		markSymbolModified(y, xOffset);
 		m_board[y][xOffset].setSymbol('2');
+	}
 
 	for (int x = xOffset; x <= endP.col - 1; x++)
+	{
+		markSymbolModified(middleP.row, x);
 		m_board[middleP.row][x].setSymbol('4');
+	}
 
 	if (isCompliantWithRowColPatterns() == false)
 	{
@@ -3060,6 +4405,9 @@ bool BoardObject::evaluateBestCornerCutChance(const std::vector<TablePos>& infle
 
 	const float baseFlowValue = this->doDataFlowSimulation_serial_WITHOUT_SIDE_EFFECTS(1);
 
+	// Gather all the corner cuts to try
+	std::vector<CutCornerDescription> cornerCutTries;
+
 	// Take 3 consecutive points and try to cut the corner
 	for (int infPointIter = 0; infPointIter < inflexionPoints.size() - 1; infPointIter++)
 	{
@@ -3077,8 +4425,6 @@ bool BoardObject::evaluateBestCornerCutChance(const std::vector<TablePos>& infle
 		if (IsGoing_NorthWest(startP, middleP, endP))
 		{
 			// Find the best corner desc here. Try all possible deviations
-			// Then do the cut and compare 
-			CutCornerDescription localBestCornerDesc;
 			const int cutStartRow = startP.row - 2;
 			const int cutEndRow = middleP.row + 1;
 			const int colStartDeviation = startP.col + 1;
@@ -3088,36 +4434,14 @@ bool BoardObject::evaluateBestCornerCutChance(const std::vector<TablePos>& infle
 			{
 				for (int colIter = colStartDeviation; colIter <= colEndDeviation; colIter++)
 				{
-					BoardObject* newBoard = new BoardObject();
-					*newBoard = *this;
-
-					//--- trees are collected now
-					// ####################################################
-					localBestCornerDesc.reset();
-					localBestCornerDesc.indexS = startIdx;
-					localBestCornerDesc.indexM = middleIdx;
-					localBestCornerDesc.indexE = endIdx;
-					localBestCornerDesc.yOffset = rowIter;
-					localBestCornerDesc.xOffset = colIter;
-					localBestCornerDesc.dirType = CutCornerDescription::NORTH_WEST;
-
-					const bool isBoardOK = newBoard->cutMembraneCorner(inflexionPoints, localBestCornerDesc, false);
-					if (isBoardOK)
-					{
-						// Expand internal and external trees
-						newBoard->expandInternalTrees();
-						newBoard->expandExternalTrees();
-
-						const float flowRes = newBoard->doDataFlowSimulation_serial_WITHOUT_SIDE_EFFECTS(1);
-						const float localFlowBenefit = flowRes - baseFlowValue;
-						if (localFlowBenefit > outBestFlowBenefit)
-						{
-							outBestFlowBenefit = localFlowBenefit;
-							outBestCornerCutRes = localBestCornerDesc;
-						}
-					}
-
-					delete newBoard;
+					cornerCutTries.emplace_back();
+					CutCornerDescription& cornerDesc = cornerCutTries.back();
+					cornerDesc.indexS = startIdx;
+					cornerDesc.indexM = middleIdx;
+					cornerDesc.indexE = endIdx;
+					cornerDesc.yOffset = rowIter;
+					cornerDesc.xOffset = colIter;
+					cornerDesc.dirType = CutCornerDescription::NORTH_WEST;
 				}
 			}
 		}
@@ -3125,6 +4449,49 @@ bool BoardObject::evaluateBestCornerCutChance(const std::vector<TablePos>& infle
 		// TODO: Add the code for others
 	}
 
+	// Do the cuts and compare them in parallel, each thread on its own copy of this board with the random stream and log of the cut
+	std::vector<float> cornerCutsFlowBenefit(cornerCutTries.size(), INVALID_FLOW);
+	std::vector<std::string> cornerCutsLog(cornerCutTries.size());
+	ThreadScratchBoards scratchBoards(*this);
+	const uint64_t cutsSeed = randSeed();
+	g_taskPool.parallelFor((int)cornerCutTries.size(), [&](const int tryIndex)
+	{
+		ScopedRandomStream tryStream(combineSeeds(cutsSeed, tryIndex));
+		std::ostringstream tryLog;
+		std::ostream* const prevDebugLogOutput = g_debugLogOutput;
+		g_debugLogOutput = &tryLog;
+
+		BoardObject& scratchBoard = scratchBoards.get();
+		scratchBoard.beginTransaction();
+
+		CutCornerDescription cornerDesc = cornerCutTries[tryIndex];
+		const bool isBoardOK = scratchBoard.cutMembraneCorner(inflexionPoints, cornerDesc, false);
+		if (isBoardOK)
+		{
+			// Expand internal and external trees
+			scratchBoard.expandInternalTrees();
+			scratchBoard.expandExternalTrees();
+
+			const float flowRes = scratchBoard.doDataFlowSimulation_serial_WITHOUT_SIDE_EFFECTS(1);
+			cornerCutsFlowBenefit[tryIndex] = flowRes - baseFlowValue;
+		}
+
+		scratchBoard.rollbackTransaction();
+
+		g_debugLogOutput = prevDebugLogOutput;
+		cornerCutsLog[tryIndex] = tryLog.str();
+	});
+
+	for (int tryIndex = 0; tryIndex < (int)cornerCutTries.size(); tryIndex++)
+	{
+		(*g_debugLogOutput) << cornerCutsLog[tryIndex];
+		if (cornerCutsFlowBenefit[tryIndex] > outBestFlowBenefit)
+		{
+			outBestFlowBenefit = cornerCutsFlowBenefit[tryIndex];
+			outBestCornerCutRes = cornerCutTries[tryIndex];
+		}
+	}
+
 	// If we have any flow benefit, check the result in outBestCornerCutRes
 	return (outBestFlowBenefit > 0.0f);
 }
@@ -3153,8 +4520,8 @@ void BoardObject::reorganize(ostream& outStream)
 int BoardObject::countNodes() const
 {
 	int count = 0;
-	for (int i = 0; i < MAX_ROWS; i++)
-		for (int j = 0; j < MAX_COLS; j++)
+	for (int i = 0; i < g_boardRows; i++)
+		for (int j = 0; j < g_boardCols; j++)
 		{
 			if (!m_board[i][j].isFree())
 				count++;
@@ -3180,6 +4547,8 @@ void BoardObject::transferFlowStatistics(const int prevRootRow, const int prevRo
 	Cell& newRoot = m_board[newRootRow][newRootCol];
 
 	assert(prevRoot.m_flowStatistics != nullptr && newRoot.m_flowStatistics == nullptr);
+	journalCell(prevRoot);
+	journalCell(newRoot);
 
 	newRoot.m_flowStatistics = prevRoot.m_flowStatistics;
 	prevRoot.m_flowStatistics = nullptr;
@@ -3200,40 +4569,199 @@ void BoardObject::reorganizeMaxFlow(int* outNumReorganizationsMade)
 		prevFlow = newFlow;
 		numIterations++;
 	}
-
-	if (outNumReorganizationsMade)
-		*outNumReorganizationsMade = numIterations;
+
+	if (outNumReorganizationsMade)
+		*outNumReorganizationsMade = numIterations;
+}
+
+void BoardObject::gatherLeafNodes(const Cell* currentCell, std::vector<TablePos>& outLeafNodes) const
+{
+	if (currentCell == nullptr)
+		return;
+
+	if (currentCell->isLeaf())
+	{
+		outLeafNodes.push_back(TablePos(currentCell->m_row, currentCell->m_column));
+	}
+	else
+	{
+		Cell* childrenList[DIR_COUNT];
+		currentCell->fillChildrenList(childrenList);
+
+		for (int childIter = 0; childIter < DIR_COUNT; childIter++)
+		{
+			Cell* cell = childrenList[childIter];
+			if (cell)
+			{
+				gatherLeafNodes(cell, outLeafNodes);
+			}
+		}
+	}
+}
+
+// The influence of each source on each leaf: power * (1 / manhattanDist^2), as computeScoreForLeafAndSource for a pair but without the divide.
+// The distances and unit influences are read from the sources' rows in the influence field.
+// The output matrices have a row for each source and a column for each leaf.
+// With AVX2 enabled at compile time (-mavx2, /arch:AVX2) 8 leaves are done at once, the other leaves by the portable loop. Both give the same results
+static void computeSourcesInfluence(const int numSources, const SourcesInfluenceField::SourceRow* const* srcRows, const float* srcPowers,
+	const int numLeaves, const int* leafCells, int* outDistance, float* outInfluence)
+{
+	for (int srcIter = 0; srcIter < numSources; srcIter++)
+	{
+		const int* srcDistance = srcRows[srcIter]->distance.data();
+		const float* srcUnitInfluence = srcRows[srcIter]->unitInfluence.data();
+		const float srcPower = srcPowers[srcIter];
+		int* distanceRow = outDistance + srcIter * numLeaves;
+		float* influenceRow = outInfluence + srcIter * numLeaves;
+
+		int leafIter = 0;
+#ifdef __AVX2__
+		const __m256 srcPowerV = _mm256_set1_ps(srcPower);
+		for (; leafIter + 8 <= numLeaves; leafIter += 8)
+		{
+			const __m256i cells = _mm256_loadu_si256((const __m256i*)(leafCells + leafIter));
+			_mm256_storeu_si256((__m256i*)(distanceRow + leafIter), _mm256_i32gather_epi32(srcDistance, cells, 4));
+			_mm256_storeu_ps(influenceRow + leafIter, _mm256_mul_ps(srcPowerV, _mm256_i32gather_ps(srcUnitInfluence, cells, 4)));
+		}
+#endif
+
+		for (; leafIter < numLeaves; leafIter++)
+		{
+			const int cell = leafCells[leafIter];
+			distanceRow[leafIter] = srcDistance[cell];
+			influenceRow[leafIter] = srcPower * srcUnitInfluence[cell];
+		}
+	}
 }
 
-void BoardObject::gatherLeafNodes(const Cell* currentCell, std::vector<TablePos>& outLeafNodes) const
+void BoardObject::updateTreeLayout() const
 {
-	if (currentCell == nullptr)
-		return;
-
-	if (currentCell->isLeaf())
+	if (!isTreeLayoutValid())
 	{
-		outLeafNodes.push_back(TablePos(currentCell->m_row, currentCell->m_column));
+		buildTreeLayout();
 	}
-	else
+}
+
+bool BoardObject::isTreeLayoutValid() const
+{
+	const TreeLayout& layout = m_treeLayout;
+	const Cell* root = getRootCell();
+	return !layout.nodeCell.empty() && layout.linksVersion == m_linksVersion && layout.numBoardCells == m_board.getNumCells()
+		&& layout.rootCell == root->m_row * m_board.getNumCols() + root->m_column;
+}
+
+void BoardObject::buildTreeLayout() const
+{
+	TreeLayout& layout = m_treeLayout;
+	const int numCols = m_board.getNumCols();
+	const Cell* root = getRootCell();
+	layout.rootCell = root->m_row * numCols + root->m_column;
+	layout.numBoardCells = m_board.getNumCells();
+	layout.nodeCell.clear();
+	layout.nodeParent.clear();
+
+	// Visit each node before its children, the last child first. Reversed, this order is the post-order with the children in fillChildrenList order.
+	// No recursion, the trees can be deep
+	layout.buildStack.clear();
+	layout.buildStack.push_back(std::make_pair(layout.rootCell, (int)INVALID_POS));
+	while (!layout.buildStack.empty())
 	{
-		Cell* childrenList[DIR_COUNT];
-		currentCell->fillChildrenList(childrenList);
+		const std::pair<int, int> item = layout.buildStack.back();
+		layout.buildStack.pop_back();
 
+		const int node = (int)layout.nodeCell.size();
+		layout.nodeCell.push_back(item.first);
+		layout.nodeParent.push_back(item.second);
+
+		Cell* children[DIR_COUNT];
+		m_board.at(item.first).fillChildrenList(children);
 		for (int childIter = 0; childIter < DIR_COUNT; childIter++)
 		{
-			Cell* cell = childrenList[childIter];
-			if (cell)
+			const Cell* child = children[childIter];
+			if (child)
 			{
-				gatherLeafNodes(cell, outLeafNodes);
+				layout.buildStack.push_back(std::make_pair(child->m_row * numCols + child->m_column, node));
 			}
 		}
 	}
+
+	const int numNodes = (int)layout.nodeCell.size();
+	std::reverse(layout.nodeCell.begin(), layout.nodeCell.end());
+	std::reverse(layout.nodeParent.begin(), layout.nodeParent.end());
+	for (int& parent : layout.nodeParent)
+	{
+		if (parent != INVALID_POS)
+			parent = numNodes - 1 - parent;
+	}
+
+	// Children ranges, by counting. The nodes are visited in post-order so each parent gets its children in order
+	layout.nodeChildrenStart.assign(numNodes + 1, 0);
+	for (const int parent : layout.nodeParent)
+	{
+		if (parent != INVALID_POS)
+			layout.nodeChildrenStart[parent + 1]++;
+	}
+
+	for (int node = 0; node < numNodes; node++)
+	{
+		layout.nodeChildrenStart[node + 1] += layout.nodeChildrenStart[node];
+	}
+
+	layout.childNodes.resize(numNodes - 1);
+	for (int node = 0; node < numNodes; node++)
+	{
+		const int parent = layout.nodeParent[node];
+		if (parent != INVALID_POS)
+			layout.childNodes[layout.nodeChildrenStart[parent]++] = node;
+	}
+
+	// The starts were moved to the ends while filling, move them back
+	for (int node = numNodes; node > 0; node--)
+	{
+		layout.nodeChildrenStart[node] = layout.nodeChildrenStart[node - 1];
+	}
+	layout.nodeChildrenStart[0] = 0;
+
+	// The nodes new in the layout, or with other children than when they last ticked, must tick
+	const int prevBuildId = layout.buildId++;
+	layout.linksVersion = m_linksVersion;
+	layout.hasSharedCells = false;
+	layout.leafNodes.clear();
+	layout.nodeTickStamps.resize(numNodes);
+	m_cellTickRecords.resize(layout.numBoardCells);
+	for (int node = 0; node < numNodes; node++)
+	{
+		const int childrenStart = layout.nodeChildrenStart[node];
+		const int numChildren = layout.nodeChildrenStart[node + 1] - childrenStart;
+		if (numChildren == 0)
+			layout.leafNodes.push_back(node);
+
+		CellTickRecord& record = m_cellTickRecords[layout.nodeCell[node]];
+		if (record.layoutBuildId == layout.buildId)
+			layout.hasSharedCells = true;
+
+		bool isDirty = record.layoutBuildId != prevBuildId || record.numChildren != numChildren;
+		for (int childIter = 0; childIter < numChildren && !isDirty; childIter++)
+		{
+			isDirty = record.childCells[childIter] != layout.nodeCell[layout.childNodes[childrenStart + childIter]];
+		}
+
+		if (isDirty)
+			markTickDirty(layout.nodeCell[node]);
+
+		record.layoutBuildId = layout.buildId;
+		record.node = node;
+	}
 }
 
 void BoardObject::fillSimulationContext(SimulationContext& simContext) const
 {
+	// The buffers are reused from the previous ticks
+	SimulationScratch& scratch = m_simulationScratch;
+
 	// Step1 : Gather all the leaf nodes and fill an augmented data structure
-	std::vector<TablePos> leafNodes;
+	std::vector<TablePos>& leafNodes = scratch.leafNodes;
+	leafNodes.clear();
 
 	const Cell* root = getRootCell();
 #if RUNMODE == DIRECTIONAL_MODE
@@ -3241,34 +4769,24 @@ void BoardObject::fillSimulationContext(SimulationContext& simContext) const
 	const Cell* cellBelowRoot = &root->m_boardView->m_board[root->m_row + 1][root->m_column];
 	gatherLeafNodes(cellBelowRoot, leafNodes);
 #else
-	gatherLeafNodes(root, leafNodes);
-#endif
-
-	struct CellTempCaptureInfo
+	// The leaves in post-order are in the same order as gathered from the root
+	updateTreeLayout();
+	const TreeLayout& treeLayout = m_treeLayout;
+	const int numCols = m_board.getNumCols();
+	for (const int node : treeLayout.leafNodes)
 	{
-		const Cell* cell = nullptr;
-		TablePos pos;
-		float remainingCap = 0.0f;
-
-		float currentIterCapSum = 0.0f;
-
-		void onAddCapture(const float value)
-		{
-			remainingCap -= value;
-			assert(remainingCap >= 0.0f);
-
-			currentIterCapSum += value;
-		}
-	};
+		const int cellIndex = treeLayout.nodeCell[node];
+		leafNodes.push_back(TablePos(cellIndex / numCols, cellIndex % numCols));
+	}
+#endif
 
-	using LeafNodsCaptureInfoArray = std::vector<CellTempCaptureInfo>;
-	LeafNodsCaptureInfoArray leafNodesCapture;
-	leafNodesCapture.reserve(leafNodes.size());
+	std::vector<SimulationScratch::CellTempCaptureInfo>& leafNodesCapture = scratch.leafNodesCapture;
+	leafNodesCapture.clear();
 	for (int i = 0; i < leafNodes.size(); i++)
 	{
 		const TablePos& pos = leafNodes[i];
 
-		CellTempCaptureInfo tempInfo;
+		SimulationScratch::CellTempCaptureInfo tempInfo;
 		tempInfo.cell = &m_board[pos.row][pos.col];
 		tempInfo.pos = pos;
 		tempInfo.remainingCap = tempInfo.cell->getRemainingCap();
@@ -3280,33 +4798,107 @@ void BoardObject::fillSimulationContext(SimulationContext& simContext) const
 	//------------------------
 
 	// Step 2: Shuffle the sources and leaf nodes list to have variation from time to time
-	std::vector<std::pair<TablePos, SourceInfo>> shuffledSources(m_posToSourceMap.begin(), m_posToSourceMap.end());
-	std::random_shuffle(shuffledSources.begin(), shuffledSources.end());
+	std::vector<std::pair<TablePos, SourceInfo>>& shuffledSources = scratch.shuffledSources;
+	// Sorted first, so the order doesn't depend on the history of the sources table
+	const SourcesTable& sources = getSources();
+	shuffledSources.clear();
+	for (int srcIndex = 0; srcIndex < sources.getNumSources(); srcIndex++)
+	{
+		shuffledSources.push_back(std::make_pair(sources.getPos(srcIndex), sources.getInfo(srcIndex)));
+	}
+	std::sort(shuffledSources.begin(), shuffledSources.end(), [](const std::pair<TablePos, SourceInfo>& a, const std::pair<TablePos, SourceInfo>& b)
+	{
+		return a.first.row != b.first.row ? a.first.row < b.first.row : a.first.col < b.first.col;
+	});
+	std::random_shuffle(shuffledSources.begin(), shuffledSources.end(), randIndex);
 
-	std::vector<int> leafNodesCaptureIndirection(leafNodesCapture.size()); // Indices: when iterating over element i becomes = >leafNodesCaptureIndirection[i]
+	std::vector<int>& leafNodesCaptureIndirection = scratch.leafNodesCaptureIndirection; // Indices: when iterating over element i becomes = >leafNodesCaptureIndirection[i]
+	leafNodesCaptureIndirection.resize(leafNodesCapture.size());
 	for (int i = 0; i < leafNodesCapture.size(); i++) leafNodesCaptureIndirection[i] = i;
 
+	// Steps 2.5 and 3. With a cut-off on the influence, each leaf only visits the sources around it
+	if (g_minSourceInfluence > 0.0f)
+	{
+		captureFromNearbySources(scratch);
+	}
+	else
+	{
+		captureFromAllSources(scratch);
+	}
+
+	// Fill the context with the leaf nodes and how much each can capture
+	simContext.resetLeafNodeCaptures();
+	for (const auto& leafNode : leafNodesCapture)
+	{
+		simContext.setLeafNodeCapture(leafNode.pos, leafNode.currentIterCapSum);
+	}
+
+	/*
+if (isLeaf())
+{
+	assert(isCoordinateValid(m_row, m_column));
+	const float maxFlowFromEnvironment = m_boardView->computeScoreForLeaf(TablePos(m_row, m_column), m_distanceToRoot, true);
+	const float capToAdd = std::min(maxFlowFromEnvironment, capRemaining);
+	m_bufferedData.add(capToAdd);
+}*/
+}
+
+void BoardObject::captureFromAllSources(SimulationScratch& scratch) const
+{
+	std::vector<SimulationScratch::CellTempCaptureInfo>& leafNodesCapture = scratch.leafNodesCapture;
+	const std::vector<std::pair<TablePos, SourceInfo>>& shuffledSources = scratch.shuffledSources;
+	std::vector<int>& leafNodesCaptureIndirection = scratch.leafNodesCaptureIndirection;
+
+	// Step 2.5: Get the influence of all the sources on all the leaves at once, from the field shared by all boards with the same sources
+	const SourcesInfluenceField& influenceField = getSourcesInfluenceField();
+	const int numLeaves = (int)leafNodesCapture.size();
+	const int numSources = (int)shuffledSources.size();
+
+	scratch.leafCells.resize(numLeaves);
+	for (int i = 0; i < numLeaves; i++)
+	{
+		scratch.leafCells[i] = leafNodesCapture[i].pos.row * influenceField.numCols + leafNodesCapture[i].pos.col;
+	}
+
+	scratch.sourceRows.resize(numSources);
+	scratch.sourcePowers.resize(numSources);
+	for (int i = 0; i < numSources; i++)
+	{
+		scratch.sourceRows[i] = influenceField.rows[influenceField.getRowIndex(shuffledSources[i].first)].get();
+		scratch.sourcePowers[i] = shuffledSources[i].second.getPower();
+	}
+
+	scratch.sourcesDistance.resize(numSources * numLeaves);
+	scratch.sourcesInfluence.resize(numSources * numLeaves);
+	computeSourcesInfluence(numSources, scratch.sourceRows.data(), scratch.sourcePowers.data(),
+		numLeaves, scratch.leafCells.data(), scratch.sourcesDistance.data(), scratch.sourcesInfluence.data());
+
+	// Buffers for the counting sort below, with a ring for each distance
+	std::vector<int>& sortedLeafNodesIndirection = scratch.sortedLeafNodesIndirection;
+	std::vector<int>& distanceRingStart = scratch.distanceRingStart;
+	sortedLeafNodesIndirection.resize(leafNodesCapture.size());
+	distanceRingStart.resize(influenceField.maxDistance + 2);
+
 	// Define the lambda function used to sort and shuffle. It will be used at each iteration through the sources
-	auto SortAndShuffleLeafNodesFunc = [&](const TablePos& srcPos) {
-		// Sort by distance to source using a functor
-		struct LeafToSrcFunctor
+	auto SortAndShuffleLeafNodesFunc = [&](const int srcIndex) {
+		// Sort by distance to source: counting sort on the distance rings around the source. It's stable, so the leaves at the same distance keep their previous order
+		const int* leafNodesDistance = &scratch.sourcesDistance[srcIndex * numLeaves];
+		std::fill(distanceRingStart.begin(), distanceRingStart.end(), 0);
+		for (int i = 0; i < numLeaves; i++)
 		{
-			LeafToSrcFunctor(const TablePos& srcPos, LeafNodsCaptureInfoArray& refInfoArray)
-				: m_srcPos(srcPos),
-				m_refInfoArray(refInfoArray)
-			{}
-
-			bool operator()(int a, int b) const
-			{
-				return manhattanDist(m_srcPos, m_refInfoArray[a].pos) < manhattanDist(m_srcPos, m_refInfoArray[b].pos);
-			}
+			distanceRingStart[leafNodesDistance[i] + 1]++;
+		}
 
-		private:
-			TablePos m_srcPos;
-			LeafNodsCaptureInfoArray& m_refInfoArray;
-		};
+		for (uint ring = 1; ring < distanceRingStart.size(); ring++)
+		{
+			distanceRingStart[ring] += distanceRingStart[ring - 1];
+		}
 
-		std::sort(leafNodesCaptureIndirection.begin(), leafNodesCaptureIndirection.end(), LeafToSrcFunctor(srcPos, leafNodesCapture));
+		for (const int leafIndex : leafNodesCaptureIndirection)
+		{
+			sortedLeafNodesIndirection[distanceRingStart[leafNodesDistance[leafIndex]]++] = leafIndex;
+		}
+		leafNodesCaptureIndirection.swap(sortedLeafNodesIndirection);
 
 		// Then shuffle		
 		//std::random_shuffle(leafNodesCapture.begin(), leafNodesCapture.end(), [] (int index){return index - 1; });
@@ -3314,11 +4906,11 @@ void BoardObject::fillSimulationContext(SimulationContext& simContext) const
 		const uint numLeafNodes = (uint)leafNodesCapture.size();
 		for (uint i = 1; i < numLeafNodes; i++)
 		{
-			const float randNum = (float)rand() / (RAND_MAX + 1.0f);
+			const float randNum = (float)randInt() / (RAND_INT_MAX + 1.0f);
 			const float probabilityToChangeThis = (((float)(numLeafNodes - i)) / numLeafNodes) * 0.5f;
 			if (randNum < probabilityToChangeThis)
 			{
-				const uint swapIndex = rand() % i;
+				const uint swapIndex = randInt() % i;
 				std::swap(leafNodesCaptureIndirection[i], leafNodesCaptureIndirection[swapIndex]);
 			}
 		}
@@ -3326,22 +4918,22 @@ void BoardObject::fillSimulationContext(SimulationContext& simContext) const
 	//------------------------
 
 	// Step 3: For each source check and clamp how much dataflow can each leaf cell gather
-	for (const auto& src : shuffledSources)
+	for (int srcIndex = 0; srcIndex < numSources; srcIndex++)
 	{
-		const TablePos& srcPos = src.first;
-		const SourceInfo& srcInfo = src.second;
+		const SourceInfo& srcInfo = shuffledSources[srcIndex].second;
 		float srcRemainingCap = srcInfo.getPower();
+		const float* srcInfluence = &scratch.sourcesInfluence[srcIndex * numLeaves];
 
-		SortAndShuffleLeafNodesFunc(srcPos);
+		SortAndShuffleLeafNodesFunc(srcIndex);
 
 		for (int i = 0; i < leafNodesCaptureIndirection.size(); i++)
 		{
-			auto& leafNode = leafNodesCapture[leafNodesCaptureIndirection[i]];
+			const int leafIndex = leafNodesCaptureIndirection[i];
+			auto& leafNode = leafNodesCapture[leafIndex];
 			if (leafNode.remainingCap <= 0.0f)
 				continue;
 
-			const TablePos& leafPos = leafNode.pos;
-			const float maxCapToGetFromSrc = computeScoreForLeafAndSource(leafPos, srcPos, srcInfo);
+			const float maxCapToGetFromSrc = srcInfluence[leafIndex];
 
 			// Get the minimum value between: source remaining capacity, how much this leaf node can subtract from source and the leaf node's remaining capacity
 			const float actualCapture = std::min(maxCapToGetFromSrc, leafNode.remainingCap);
@@ -3357,22 +4949,185 @@ void BoardObject::fillSimulationContext(SimulationContext& simContext) const
 				break;
 		}
 	}
+}
 
-	// Fill the context with the leaf nodes and how much each can capture
-	simContext.mLeafNodeToCaptureValue.clear();
-	for (const auto& leafNode : leafNodesCapture)
+// Same capture as captureFromAllSources, but a source gives nothing to the leaves where its influence is below g_minSourceInfluence.
+// The sources are put in a grid of buckets as large as the cut-off radius, so each leaf visits only the buckets around it.
+// The cost is in the number of (leaf, nearby source) pairs instead of all leaves times all sources
+void BoardObject::captureFromNearbySources(SimulationScratch& scratch) const
+{
+	std::vector<SimulationScratch::CellTempCaptureInfo>& leafNodesCapture = scratch.leafNodesCapture;
+	const std::vector<std::pair<TablePos, SourceInfo>>& shuffledSources = scratch.shuffledSources;
+	const int numLeaves = (int)leafNodesCapture.size();
+	const int numSources = (int)shuffledSources.size();
+	if (numLeaves == 0 || numSources == 0)
+		return;
+
+	// A source of power P gives less than the minimum influence beyond the distance sqrt(P / minInfluence).
+	// The radius is clamped to the largest distance between a source and a leaf, which also bounds it for a tiny minimum influence
+	const int numRows = m_board.getNumRows();
+	const int numCols = m_board.getNumCols();
+	float maxPower = 0.0f;
+	int maxDistOutsideBoard = 0;
+	for (const auto& it : shuffledSources)
+	{
+		maxPower = std::max(maxPower, it.second.getPower());
+
+		const TablePos& srcPos = it.first;
+		const int distOutsideBoard = std::max(0, std::max(-srcPos.row, srcPos.row - (numRows - 1))) + std::max(0, std::max(-srcPos.col, srcPos.col - (numCols - 1)));
+		maxDistOutsideBoard = std::max(maxDistOutsideBoard, distOutsideBoard);
+	}
+	const int maxRadius = numRows + numCols + maxDistOutsideBoard;
+	const int cutoffRadius = (int)std::min((float)maxRadius, std::sqrt(maxPower / g_minSourceInfluence) + 1.0f);
+
+	// Bucket the sources. The ones outside the board go to the buckets on the border
+	const int bucketSize = cutoffRadius;
+	const int numBucketRows = (numRows + bucketSize - 1) / bucketSize;
+	const int numBucketCols = (numCols + bucketSize - 1) / bucketSize;
+	auto getBucketRow = [&](const int row) { return std::max(0, std::min(numBucketRows - 1, row >= 0 ? row / bucketSize : -1)); };
+	auto getBucketCol = [&](const int col) { return std::max(0, std::min(numBucketCols - 1, col >= 0 ? col / bucketSize : -1)); };
+
+	std::vector<int>& bucketStart = scratch.bucketStart;
+	std::vector<int>& bucketSources = scratch.bucketSources;
+	bucketStart.assign(numBucketRows * numBucketCols + 1, 0);
+	bucketSources.resize(numSources);
+	for (const auto& it : shuffledSources)
+	{
+		bucketStart[getBucketRow(it.first.row) * numBucketCols + getBucketCol(it.first.col) + 1]++;
+	}
+	for (uint bucket = 1; bucket < bucketStart.size(); bucket++)
 	{
-		simContext.mLeafNodeToCaptureValue.insert(std::make_pair(leafNode.pos, leafNode.currentIterCapSum));
+		bucketStart[bucket] += bucketStart[bucket - 1];
 	}
+	for (int srcIndex = 0; srcIndex < numSources; srcIndex++)
+	{
+		const TablePos& srcPos = shuffledSources[srcIndex].first;
+		bucketSources[bucketStart[getBucketRow(srcPos.row) * numBucketCols + getBucketCol(srcPos.col)]++] = srcIndex;
+	}
+	// The starts were moved to the ends while filling, move them back
+	for (uint bucket = bucketStart.size() - 1; bucket > 0; bucket--)
+	{
+		bucketStart[bucket] = bucketStart[bucket - 1];
+	}
+	bucketStart[0] = 0;
 
-	/*
-if (isLeaf())
-{
-	assert(isCoordinateValid(m_row, m_column));
-	const float maxFlowFromEnvironment = m_boardView->computeScoreForLeaf(TablePos(m_row, m_column), m_distanceToRoot, true);
-	const float capToAdd = std::min(maxFlowFromEnvironment, capRemaining);
-	m_bufferedData.add(capToAdd);
-}*/
+	// Each leaf collects the sources in the buckets around it that have enough influence on it
+	std::vector<SimulationScratch::NearbyCapture>& nearbyCaptures = scratch.nearbyCaptures;
+	nearbyCaptures.clear();
+	for (int leafIndex = 0; leafIndex < numLeaves; leafIndex++)
+	{
+		const TablePos& leafPos = leafNodesCapture[leafIndex].pos;
+		const int minBucketRow = getBucketRow(leafPos.row - cutoffRadius);
+		const int maxBucketRow = getBucketRow(leafPos.row + cutoffRadius);
+		const int minBucketCol = getBucketCol(leafPos.col - cutoffRadius);
+		const int maxBucketCol = getBucketCol(leafPos.col + cutoffRadius);
+		for (int bucketRow = minBucketRow; bucketRow <= maxBucketRow; bucketRow++)
+		{
+			for (int bucketCol = minBucketCol; bucketCol <= maxBucketCol; bucketCol++)
+			{
+				const int bucket = bucketRow * numBucketCols + bucketCol;
+				for (int i = bucketStart[bucket]; i < bucketStart[bucket + 1]; i++)
+				{
+					const int srcIndex = bucketSources[i];
+					const int dist = manhattanDist(shuffledSources[srcIndex].first, leafPos);
+					if (dist > cutoffRadius)
+						continue;
+
+					// Same value as in the influence field
+					const float distF = (float)dist;
+					const float influence = shuffledSources[srcIndex].second.getPower() * (1.0f / (distF * distF));
+					if (influence >= g_minSourceInfluence)
+					{
+						SimulationScratch::NearbyCapture capture;
+						capture.srcIndex = srcIndex;
+						capture.leafIndex = leafIndex;
+						capture.distance = dist;
+						capture.influence = influence;
+						nearbyCaptures.push_back(capture);
+					}
+				}
+			}
+		}
+	}
+
+	// Group the pairs by source, the leaves of a source stay in the leaves order
+	std::vector<int>& sourceCapturesStart = scratch.sourceCapturesStart;
+	std::vector<SimulationScratch::NearbyCapture>& capturesBySource = scratch.capturesBySource;
+	sourceCapturesStart.assign(numSources + 1, 0);
+	capturesBySource.resize(nearbyCaptures.size());
+	for (const SimulationScratch::NearbyCapture& capture : nearbyCaptures)
+	{
+		sourceCapturesStart[capture.srcIndex + 1]++;
+	}
+	for (int srcIndex = 0; srcIndex < numSources; srcIndex++)
+	{
+		sourceCapturesStart[srcIndex + 1] += sourceCapturesStart[srcIndex];
+	}
+	for (const SimulationScratch::NearbyCapture& capture : nearbyCaptures)
+	{
+		capturesBySource[sourceCapturesStart[capture.srcIndex]++] = capture;
+	}
+	for (int srcIndex = numSources; srcIndex > 0; srcIndex--)
+	{
+		sourceCapturesStart[srcIndex] = sourceCapturesStart[srcIndex - 1];
+	}
+	sourceCapturesStart[0] = 0;
+
+	// Step 3: For each source, sort its leaves by distance and shuffle them as captureFromAllSources does, then capture
+	std::vector<int>& sortedCaptures = scratch.sortedLeafNodesIndirection;
+	std::vector<int>& distanceRingStart = scratch.distanceRingStart;
+	distanceRingStart.resize(cutoffRadius + 2);
+	for (int srcIndex = 0; srcIndex < numSources; srcIndex++)
+	{
+		const int firstCapture = sourceCapturesStart[srcIndex];
+		const int numCaptures = sourceCapturesStart[srcIndex + 1] - firstCapture;
+		const SimulationScratch::NearbyCapture* captures = capturesBySource.data() + firstCapture;
+
+		std::fill(distanceRingStart.begin(), distanceRingStart.end(), 0);
+		for (int i = 0; i < numCaptures; i++)
+		{
+			distanceRingStart[captures[i].distance + 1]++;
+		}
+		for (uint ring = 1; ring < distanceRingStart.size(); ring++)
+		{
+			distanceRingStart[ring] += distanceRingStart[ring - 1];
+		}
+		sortedCaptures.resize(numCaptures);
+		for (int i = 0; i < numCaptures; i++)
+		{
+			sortedCaptures[distanceRingStart[captures[i].distance]++] = i;
+		}
+
+		for (int i = 1; i < numCaptures; i++)
+		{
+			const float randNum = (float)randInt() / (RAND_INT_MAX + 1.0f);
+			const float probabilityToChangeThis = (((float)(numCaptures - i)) / numCaptures) * 0.5f;
+			if (randNum < probabilityToChangeThis)
+			{
+				const int swapIndex = randInt() % i;
+				std::swap(sortedCaptures[i], sortedCaptures[swapIndex]);
+			}
+		}
+
+		float srcRemainingCap = shuffledSources[srcIndex].second.getPower();
+		for (int i = 0; i < numCaptures; i++)
+		{
+			const SimulationScratch::NearbyCapture& capture = captures[sortedCaptures[i]];
+			auto& leafNode = leafNodesCapture[capture.leafIndex];
+			if (leafNode.remainingCap <= 0.0f)
+				continue;
+
+			const float actualCapture = std::min(capture.influence, leafNode.remainingCap);
+			const float capFromSrc = std::min(actualCapture, srcRemainingCap);
+
+			leafNode.onAddCapture(capFromSrc);
+			srcRemainingCap -= capFromSrc;
+			assert(srcRemainingCap >= 0.0f);
+
+			if (srcRemainingCap <= 0.0f)
+				break;
+		}
+	}
 }
 
 void BoardObject::addRentedResource(const char symbol, const TablePos& tablePos)
@@ -3381,6 +5136,8 @@ void BoardObject::addRentedResource(const char symbol, const TablePos& tablePos)
 	info.symbol = symbol;
 	info.pos = tablePos;
 	m_rentedResources.insert(info);
+	journalCell(m_board[tablePos.row][tablePos.col]);
+	markSymbolModified(tablePos.row, tablePos.col);
 	m_board[tablePos.row][tablePos.col].setAsRented();
 
 	assert(m_rentedResources.size() <= g_maxResourcesToRent);
@@ -3412,6 +5169,247 @@ void BoardObject::setAvailableSymbols(const std::vector<char>& allSymbols)
 		m_garbageCollectedResources.insert(std::make_pair(r, 0));
 }
 
+void BoardObject::saveCheckpoint(CheckpointWriter& writer) const
+{
+	// The view broadcasted last is the one shared by the most cells. Cells with an older view will see the board itself once loaded
+	const BoardObject* broadcastView = nullptr;
+	long broadcastViewUseCount = 0;
+	for (int cellIndex = 0; cellIndex < m_board.getNumCells(); cellIndex++)
+	{
+		const BoardSnapshotPtr& view = m_board.at(cellIndex).m_sharedBoardView;
+		if (view && view.use_count() > broadcastViewUseCount)
+		{
+			broadcastView = view.get();
+			broadcastViewUseCount = view.use_count();
+		}
+	}
+
+	std::vector<CheckpointCell> cells;
+	saveBoardState(writer, CHECKPOINT_BOARD, cells);
+	for (int cellIndex = 0; cellIndex < m_board.getNumCells(); cellIndex++)
+	{
+		cells[cellIndex].usesBroadcastView = broadcastView && m_board.at(cellIndex).m_sharedBoardView.get() == broadcastView;
+	}
+	writer.setSection(CHECKPOINT_BOARD, CHECKPOINT_CELLS, cells);
+
+	if (broadcastView)
+	{
+		std::vector<CheckpointCell> viewCells;
+		broadcastView->saveBoardState(writer, CHECKPOINT_BROADCAST_VIEW, viewCells);
+		writer.setSection(CHECKPOINT_BROADCAST_VIEW, CHECKPOINT_CELLS, viewCells);
+	}
+}
+
+bool BoardObject::loadCheckpoint(const CheckpointReader& reader)
+{
+	if (!loadBoardState(reader, CHECKPOINT_BOARD))
+		return false;
+
+	std::shared_ptr<BoardObject> broadcastView;
+	if (reader.getHeader().boards[CHECKPOINT_BROADCAST_VIEW].isSaved)
+	{
+		broadcastView = std::make_shared<BoardObject>();
+		broadcastView->setRowAndColGenerators(m_rowGenerator, m_colGenerator);
+		if (!broadcastView->loadBoardState(reader, CHECKPOINT_BROADCAST_VIEW) || broadcastView->m_board.getNumCells() != m_board.getNumCells())
+			return false;
+
+		broadcastView->m_sources = m_sources;
+	}
+
+	int numCells = 0;
+	const CheckpointCell* cells = reader.getSection<CheckpointCell>(CHECKPOINT_BOARD, CHECKPOINT_CELLS, numCells);
+	for (int cellIndex = 0; cellIndex < numCells; cellIndex++)
+	{
+		if (cells[cellIndex].usesBroadcastView)
+			m_board.at(cellIndex).m_sharedBoardView = broadcastView;
+	}
+
+	return true;
+}
+
+void BoardObject::saveBoardState(CheckpointWriter& writer, const CheckpointBoard boardIndex, std::vector<CheckpointCell>& outCells) const
+{
+	CheckpointBoardInfo& header = writer.getHeader().boards[boardIndex];
+	header.isSaved = true;
+	header.numRows = m_board.getNumRows();
+	header.numCols = m_board.getNumCols();
+	header.rootRow = m_rootRow;
+	header.rootCol = m_rootCol;
+	header.numTicksRemainingToUpdateSources = m_numTicksRemainingToUpdateSources;
+	header.remainingTicksUntilApplyCutSubtree = m_remainingTicksUntilApplyCutSubtree;
+	header.useTicksToDelayDataFlowCapture = m_UseTicksToDelayDataFlowCapture;
+
+	const SubtreeInfo& cutSubtree = m_SubtreeCut.subtreeInfo;
+	header.isSubtreeCut = m_SubtreeCut.isSubtreeCut;
+	header.subtreeCutSelectedRow = m_SubtreeCut.posAndScoreInfo.selectedRow;
+	header.subtreeCutSelectedCol = m_SubtreeCut.posAndScoreInfo.selectedColumn;
+	header.subtreeCutTargetRow = m_SubtreeCut.posAndScoreInfo.row;
+	header.subtreeCutTargetCol = m_SubtreeCut.posAndScoreInfo.col;
+	header.subtreeCutScore = m_SubtreeCut.posAndScoreInfo.score;
+	header.subtreeCutMinRowOffset = cutSubtree.minRowOffset;
+	header.subtreeCutMaxRowOffset = cutSubtree.maxRowOffset;
+	header.subtreeCutMinColOffset = cutSubtree.minColOffset;
+	header.subtreeCutMaxColOffset = cutSubtree.maxColOffset;
+
+	// The cells are set by the caller, which knows which view each cell uses
+	std::vector<float> flowStats;
+	outCells.resize(m_board.getNumCells());
+	for (int cellIndex = 0; cellIndex < m_board.getNumCells(); cellIndex++)
+	{
+		m_board.at(cellIndex).saveCheckpoint(outCells[cellIndex], flowStats);
+	}
+	writer.setSection(boardIndex, CHECKPOINT_FLOW_STATS, flowStats);
+
+	// A view shares the sources of its board
+	const SourcesTable& sourcesTable = getSources();
+	std::vector<CheckpointSource> sources(boardIndex == CHECKPOINT_BOARD ? sourcesTable.getNumSources() : 0);
+	for (int srcIndex = 0; srcIndex < (int)sources.size(); srcIndex++)
+	{
+		const SourceInfo info = sourcesTable.getInfo(srcIndex);
+		sources[srcIndex].row = sourcesTable.getPos(srcIndex).row;
+		sources[srcIndex].col = sourcesTable.getPos(srcIndex).col;
+		sources[srcIndex].power = info.getPower();
+		sources[srcIndex].target = info.getTarget();
+	}
+	writer.setSection(boardIndex, CHECKPOINT_SOURCES, sources);
+
+	std::vector<CheckpointRentedResource> rentedResources;
+	for (const RentedResourceInfo& resource : m_rentedResources)
+	{
+		CheckpointRentedResource record = CheckpointRentedResource();
+		record.row = resource.pos.row;
+		record.col = resource.pos.col;
+		record.symbol = resource.symbol;
+		rentedResources.push_back(record);
+	}
+	writer.setSection(boardIndex, CHECKPOINT_RENTED_RESOURCES, rentedResources);
+
+	std::vector<CheckpointGarbageCollected> garbageCollected;
+	for (const auto& entry : m_garbageCollectedResources)
+	{
+		CheckpointGarbageCollected record = CheckpointGarbageCollected();
+		record.symbol = entry.first;
+		record.count = entry.second;
+		garbageCollected.push_back(record);
+	}
+	writer.setSection(boardIndex, CHECKPOINT_GARBAGE_COLLECTED, garbageCollected);
+
+	std::vector<CheckpointSubtreeOffset> subtreeOffsets(cutSubtree.m_offsets.size());
+	for (size_t offsetIndex = 0; offsetIndex < cutSubtree.m_offsets.size(); offsetIndex++)
+	{
+		const OffsetAndSymbol& offset = cutSubtree.m_offsets[offsetIndex];
+		subtreeOffsets[offsetIndex] = CheckpointSubtreeOffset();
+		subtreeOffsets[offsetIndex].rowOff = offset.rowOff;
+		subtreeOffsets[offsetIndex].colOff = offset.colOff;
+		subtreeOffsets[offsetIndex].symbol = offset.symbol;
+		subtreeOffsets[offsetIndex].isRented = offset.isRented;
+	}
+	writer.setSection(boardIndex, CHECKPOINT_SUBTREE_CUT, subtreeOffsets);
+}
+
+bool BoardObject::loadBoardState(const CheckpointReader& reader, const CheckpointBoard boardIndex)
+{
+	assert(!isInTransaction() && "Can't load a checkpoint in a transaction");
+
+	const CheckpointBoardInfo& header = reader.getHeader().boards[boardIndex];
+	int numCells = 0, numFlowStats = 0, numSources = 0, numRentedResources = 0, numGarbageCollected = 0, numSubtreeOffsets = 0;
+	const CheckpointCell* cells = reader.getSection<CheckpointCell>(boardIndex, CHECKPOINT_CELLS, numCells);
+	const float* flowStats = reader.getSection<float>(boardIndex, CHECKPOINT_FLOW_STATS, numFlowStats);
+	const CheckpointSource* sources = reader.getSection<CheckpointSource>(boardIndex, CHECKPOINT_SOURCES, numSources);
+	const CheckpointRentedResource* rentedResources = reader.getSection<CheckpointRentedResource>(boardIndex, CHECKPOINT_RENTED_RESOURCES, numRentedResources);
+	const CheckpointGarbageCollected* garbageCollected = reader.getSection<CheckpointGarbageCollected>(boardIndex, CHECKPOINT_GARBAGE_COLLECTED, numGarbageCollected);
+	const CheckpointSubtreeOffset* subtreeOffsets = reader.getSection<CheckpointSubtreeOffset>(boardIndex, CHECKPOINT_SUBTREE_CUT, numSubtreeOffsets);
+	if (!cells || !flowStats || !sources || !rentedResources || !garbageCollected || !subtreeOffsets || numCells != header.numRows * header.numCols
+		|| header.rootRow < 0 || header.rootRow >= header.numRows || header.rootCol < 0 || header.rootCol >= header.numCols)
+	{
+		assert(false && "The checkpoint records don't match this build");
+		return false;
+	}
+
+	g_boardRows = header.numRows;
+	g_boardCols = header.numCols;
+	resizeBoard(header.numRows, header.numCols);
+	setRootLocation(header.rootRow, header.rootCol);
+	reset();
+
+	// The links are rebuilt from the symbols, then the rest of the cells' state is restored over what that computed
+	for (int cellIndex = 0; cellIndex < numCells; cellIndex++)
+	{
+		if (cells[cellIndex].symbol != EMPTY_SYMBOL)
+			m_board.at(cellIndex).setSymbol(cells[cellIndex].symbol);
+	}
+
+	updateBoardAfterSymbolsInit();
+
+	int firstFlowStat = 0;
+	for (int cellIndex = 0; cellIndex < numCells; cellIndex++)
+	{
+		if (firstFlowStat + cells[cellIndex].numFlowStats > numFlowStats)
+		{
+			assert(false && "The checkpoint flow records are incomplete");
+			return false;
+		}
+
+		m_board.at(cellIndex).loadCheckpoint(cells[cellIndex], flowStats + firstFlowStat);
+		firstFlowStat += cells[cellIndex].numFlowStats;
+
+		// Instead of the snapshot just broadcasted. The caller gives back the saved view to the cells that had it
+		m_board.at(cellIndex).m_sharedBoardView.reset();
+	}
+	markAllSymbolsModified(); // For the rented flags
+	m_areAllTicksDirty = true; // The buffered data was loaded
+
+	SourceEventsBatch sourceEvents;
+	for (int srcIndex = 0; srcIndex < numSources; srcIndex++)
+	{
+		SourceInfo info;
+		info.setCurrentPower(sources[srcIndex].power);
+		info.setPowerTarget(sources[srcIndex].target);
+		sourceEvents.push_back(SourceEvent(Cell::EVENT_SOURCE_ADD, TablePos(sources[srcIndex].row, sources[srcIndex].col), info));
+	}
+	propagateSourceEvents(sourceEvents);
+
+	m_rentedResources.clear();
+	for (int resourceIndex = 0; resourceIndex < numRentedResources; resourceIndex++)
+	{
+		RentedResourceInfo info;
+		info.pos = TablePos(rentedResources[resourceIndex].row, rentedResources[resourceIndex].col);
+		info.symbol = rentedResources[resourceIndex].symbol;
+		m_rentedResources.insert(info);
+	}
+
+	m_garbageCollectedResources.clear();
+	for (int entryIndex = 0; entryIndex < numGarbageCollected; entryIndex++)
+	{
+		m_garbageCollectedResources[garbageCollected[entryIndex].symbol] = garbageCollected[entryIndex].count;
+	}
+
+	m_numTicksRemainingToUpdateSources = header.numTicksRemainingToUpdateSources;
+	m_remainingTicksUntilApplyCutSubtree = header.remainingTicksUntilApplyCutSubtree;
+	m_UseTicksToDelayDataFlowCapture = header.useTicksToDelayDataFlowCapture != 0;
+
+	AvailablePosInfoAndDeltaScore cutPosAndScore;
+	cutPosAndScore.selectedRow = header.subtreeCutSelectedRow;
+	cutPosAndScore.selectedColumn = header.subtreeCutSelectedCol;
+	cutPosAndScore.row = header.subtreeCutTargetRow;
+	cutPosAndScore.col = header.subtreeCutTargetCol;
+	cutPosAndScore.score = header.subtreeCutScore;
+
+	SubtreeInfo cutSubtree;
+	for (int offsetIndex = 0; offsetIndex < numSubtreeOffsets; offsetIndex++)
+	{
+		OffsetAndSymbol offset(subtreeOffsets[offsetIndex].rowOff, subtreeOffsets[offsetIndex].colOff, subtreeOffsets[offsetIndex].symbol, subtreeOffsets[offsetIndex].isRented != 0);
+		cutSubtree.add(offset);
+	}
+	cutSubtree.minRowOffset = header.subtreeCutMinRowOffset;
+	cutSubtree.maxRowOffset = header.subtreeCutMaxRowOffset;
+	cutSubtree.minColOffset = header.subtreeCutMinColOffset;
+	cutSubtree.maxColOffset = header.subtreeCutMaxColOffset;
+	m_SubtreeCut.set(cutPosAndScore, cutSubtree, header.isSubtreeCut != 0);
+
+	return true;
+}
+
 int BoardObject::getNumAvailableResourcesToRent() const
 {
 	return g_maxResourcesToRent - (int)m_rentedResources.size();
@@ -3419,12 +5417,14 @@ int BoardObject::getNumAvailableResourcesToRent() const
 
 void BoardObject::copyJustCells(const BoardObject& other)
 {
-	assert(sizeof(m_board) == sizeof(other.m_board));
+	assert(m_board.getNumRows() == other.m_board.getNumRows() && m_board.getNumCols() == other.m_board.getNumCols() && "The boards have different sizes !");
 	//memcpy(m_board, other.m_board, sizeof(other.m_board));
+	journalAllCells();
+	markAllSymbolsModified();
 
-	for (int row = 0; row < MAX_ROWS; row++)
+	for (int row = 0; row < m_board.getNumRows(); row++)
 	{
-		for (int col = 0; col < MAX_COLS; col++)
+		for (int col = 0; col < m_board.getNumCols(); col++)
 		{
 			// Horrible hack: TODO make more generic - store / reload rented state
 			const bool isRented = other.m_board[row][col].isRented();//m_board[row][col].isRented();
@@ -2,11 +2,15 @@
 #define BOARD_OBJECT_H
 
 #include "Cell.h"
-#include <unordered_set>
-#include <regex>
 #include "ExprGenerator.h"
+#include "Checkpoint.h"
+#include "BoardFrames.h"
 #include <set>
+#include <map>
 #include <ostream>
+#include <memory>
+#include <cstdint>
+#include <mutex>
 
 #define INVALID_FLOW  -1000.0f
 
@@ -41,18 +45,13 @@ struct RentedResourceInfo
 	{
 		return pos == other.pos;
 	}
-};
 
-namespace std
-{
-	template <> struct hash<RentedResourceInfo>
+	// Ordered by position, so the resources are always visited in the same order
+	bool operator<(const RentedResourceInfo& other) const
 	{
-		size_t operator()(const RentedResourceInfo& resource) const
-		{
-			return std::hash<TablePos>()(resource.pos);
-		}
-	};
-}
+		return pos.row != other.pos.row ? pos.row < other.pos.row : pos.col < other.pos.col;
+	}
+};
 
 
 struct SubtreeInfo
@@ -85,9 +84,123 @@ struct SubtreeInfo
 };
 
 
+// How much each source influences each cell of a board, for a given layout of the sources (their positions, not their power).
+// A source gives to a cell its current power * unitInfluence, as computeScoreForLeafAndSource does.
+// It is immutable once built and shared by all the boards with the same sources layout: board copies, snapshots and the candidate boards of the searches
+struct SourcesInfluenceField
+{
+	struct SourceRow
+	{
+		std::vector<int> distance; // Manhattan distance ring of each cell around the source, by linear cell index
+		std::vector<float> unitInfluence; // 1 / distance^2
+		int maxDistance;
+	};
+
+	// Returns INVALID_POS if there is no source there
+	int getRowIndex(const TablePos& srcPos) const;
+
+	uint64_t layoutVersion;
+	int numRows, numCols;
+	int maxDistance;
+	std::vector<std::shared_ptr<const SourceRow>> rows; // One for each source, unchanged when the field is rebuilt for a new layout if the source is still there
+	std::vector<TablePos> rowSourcePos;
+	std::vector<int> rowIndexByCell; // For the sources on the board, INVALID_POS elsewhere
+};
+
+// A source add/modify/remove. A batch of them is applied with BoardObject::propagateSourceEvents, as a single modification of the sources table
+struct SourceEvent
+{
+	SourceEvent(const Cell::BroadcastEventType _type, const TablePos& _pos, const SourceInfo& _info = SourceInfo(), const bool _allSources = false)
+		: type(_type), pos(_pos), info(_info), allSources(_allSources) {}
+
+	Cell::BroadcastEventType type;
+	TablePos pos;
+	SourceInfo info;
+	bool allSources; // For EVENT_SOURCE_REMOVE only
+};
+
+typedef std::vector<SourceEvent> SourceEventsBatch;
+
+// The sources on a board. A board shares its table with the snapshots it broadcasts to the cells (see Cell::m_sharedBoardView),
+// so a source event is applied only once for all the cells' views. Board copies get their own table.
+// Every modification gets a new version, unique over all tables, so cached data can be checked cheaply against the sources it was computed for.
+// The layout version changes only when sources are added or removed, and it keys the cached influence field.
+// The sources are stored densely (positions and powers in separate arrays), in no particular order, with a grid from the board cells to their index.
+// Adding, removing and picking a random source are O(1) and the powers are updated in a tight loop
+struct SourcesTable
+{
+	SourcesTable() : m_version(getNewVersion()), m_layoutVersion(m_version), m_gridRows(0), m_gridCols(0) {}
+
+	void onModified() { m_version = getNewVersion(); }
+	void onLayoutModified() { onModified(); m_layoutVersion = m_version; }
+	static uint64_t getNewVersion();
+
+	int getNumSources() const { return (int)m_positions.size(); }
+	bool isEmpty() const { return m_positions.empty(); }
+	const TablePos& getPos(const int index) const { return m_positions[index]; }
+	SourceInfo getInfo(const int index) const;
+	void setInfo(const int index, const SourceInfo& info) { m_currentPowers[index] = info.getPower(); m_targetPowers[index] = info.getTarget(); }
+
+	// Returns INVALID_POS if there is no source at pos
+	int find(const TablePos& pos) const;
+
+	// There must be no source at pos already
+	void add(const TablePos& pos, const SourceInfo& info);
+
+	// The last source takes the place of the removed one
+	void removeAt(const int index);
+	void clear();
+
+	std::vector<TablePos> m_positions;
+	std::vector<float> m_currentPowers;
+	std::vector<float> m_targetPowers;
+	uint64_t m_version;
+	uint64_t m_layoutVersion;
+
+	// Built on demand by BoardObject::getSourcesInfluenceField. Copied with the table, so the copies share it
+	std::shared_ptr<const SourcesInfluenceField> m_influenceField;
+
+private:
+	// Returns INVALID_POS for the positions outside the grid. Sources can be outside the board, these are searched linearly
+	int getGridIndex(const TablePos& pos) const;
+
+	std::vector<int> m_indexByCell; // Index of the source on each cell, INVALID_POS if none. Sized on the first add
+	int m_gridRows, m_gridCols;
+};
+
+// Contiguous (row major) storage for the cells of a board, sized at runtime.
+// Indexing as grid[row][col] is kept so that the code reads the same as with a static 2D array.
+struct CellGrid
+{
+	CellGrid() : m_cells(nullptr), m_numRows(0), m_numCols(0) { resize(g_boardRows, g_boardCols); }
+	~CellGrid() { delete[] m_cells; }
+
+	// Reallocates the cells if the dimensions are different. All cells are default constructed in that case
+	void resize(const int numRows, const int numCols);
+
+	Cell* operator[](const int row) { return m_cells + row * m_numCols; }
+	const Cell* operator[](const int row) const { return m_cells + row * m_numCols; }
+
+	// Access by the linear index of a cell, i.e. row * numCols + col
+	Cell& at(const int index) { return m_cells[index]; }
+	const Cell& at(const int index) const { return m_cells[index]; }
+
+	int getNumRows() const { return m_numRows; }
+	int getNumCols() const { return m_numCols; }
+	int getNumCells() const { return m_numRows * m_numCols; }
+
+private:
+	// Cells keep pointers to their neighbors so the storage can't be copied around. Use BoardObject copy instead
+	CellGrid(const CellGrid& other) = delete;
+	void operator=(const CellGrid& other) = delete;
+
+	Cell* m_cells;
+	int m_numRows, m_numCols;
+};
+
 struct BoardObject
 {
-	Cell m_board[MAX_ROWS][MAX_COLS];
+	CellGrid m_board;
 	inline Cell& operator()(int row, int col)
 	{
 		return m_board[row][col];
@@ -100,9 +213,28 @@ struct BoardObject
 
 	BoardObject();
 	BoardObject(const BoardObject& other);
+
+	// Changes the board dimensions. All cells are reset if the dimensions are different
+	void resizeBoard(const int numRows, const int numCols);
 	void operator=(const BoardObject& other);
 	virtual ~BoardObject();
 
+	// Makes this board the same as a new copy of other, but reusing the memory this board already has
+	void resetAndCopyFrom(const BoardObject& other);
+
+	// Transactions: the changes done on this board after beginTransaction (cells, links, sources and the board state) are journaled,
+	// so rollbackTransaction can undo them at the cost of the cells touched instead of working on a full copy of the board.
+	// Transactions can be nested. applyTransaction keeps the changes, but an enclosing transaction can still roll them back.
+	// The board can't be copied into or resized while a transaction is open.
+	void beginTransaction();
+	void applyTransaction();
+	void rollbackTransaction();
+	bool isInTransaction() const { return m_numOpenTransactions > 0; }
+
+	// Call this before modifying a cell directly (not through the functions of this board) while in a transaction.
+	// It saves the cell and the cells linked to it
+	void onBeforeCellModified(const int row, const int col);
+
 #if RUNMODE == DIRECTIONAL_MODE
 	enum ProduceItemResult { P_RES_SUCCEED, P_RES_FAILED, P_RES_FINISHED };
 
@@ -143,6 +275,11 @@ struct BoardObject
 	void expandExternalTrees();
 	void expandInternalTrees();
 
+	// Adds cells at the best candidates (lazy greedy) while the flow improves. If addCandidatesAroundNewCells, the free positions around each new cell become candidates too.
+	// If addFirstCell, the best candidate is added even if it doesn't improve the flow
+	void expandTreesLazyGreedy(std::vector<ResourceAllocatedEval>& candidates, const CellType cellType, Cell::UniversalHash2D& hash2D,
+		const std::vector<char>& availableSymbolsToFill, const bool addCandidatesAroundNewCells, const bool addFirstCell);
+
 	void optimizeMembrane();
 	bool optimizeMembrane_byCutRowCols();
 	bool optimizeMembrane_byCutCorners();
@@ -207,8 +344,16 @@ struct BoardObject
 
 	void setAvailableSymbols(const std::vector<char>& allSymbols);
 
-	// A hash of sources with keys from TablePositions (no key collide guaranteed)
-	std::unordered_map<TablePos, SourceInfo> m_posToSourceMap;
+	// The sources on this board, indexed from 0 to getNumSources() - 1
+	const SourcesTable& getSources() const { return *m_sources; }
+	uint64_t getSourcesVersion() const { return m_sources->m_version; }
+
+	// The influence field for the current sources layout, rebuilt if the sources were added or removed since it was built.
+	// Valid until the sources change. Build it before starting parallel work on copies of this board, so they share it
+	const SourcesInfluenceField& getSourcesInfluenceField() const;
+
+	// Creates an immutable copy of this board to be shared by all cells on a structure broadcast. The snapshot shares the sources table with this board
+	BoardSnapshotPtr createSnapshot() const;
 
 	void resetCells(const bool resetSymbolsToo = true);
 	void reset(const bool withoutStatistics = false, const bool resetSymbolsToo = true);
@@ -226,6 +371,41 @@ struct BoardObject
 	void doDataFlowSimulation_serial(const int ticksToSimulate, const bool isRealTick = false, const bool considerForStatistics = true);
 	float doDataFlowSimulation_serial_WITHOUT_SIDE_EFFECTS(const int ticksToSimulate);
 
+	// Zobrist hash of the cell symbols and rented flags, the root and the sources
+	uint64_t getZobristHash() const;
+
+	// getZobristHash plus the data buffered in the cells, i.e. everything a data flow tick depends on except its random numbers
+	uint64_t getEvaluationKey() const;
+
+	// The average flow of one simulated tick, with random numbers drawn from a stream seeded by the evaluation key, so the result depends only on the key.
+	// Boards already evaluated are found in g_evaluationCache instead of simulated, so call it in a transaction that is rolled back
+	float evaluateDataFlow_serial();
+
+	// Upper bounds of the flow evaluateDataFlow_serial can give, so the elastic model skips the candidates that can't beat the best one found.
+	// Computed once on the current board: a leaf can't capture more than the sources give it when no other leaf takes a part (its capture in the influence field),
+	// a node more than what its children could give it, and no cell more than g_maxFlowPerCell. Then a candidate only recomputes the nodes above the cells it modifies
+	struct FlowUpperBounds
+	{
+		bool isValid = false; // Not for trees with shared or unlinked cells, where the candidates are only bounded by g_maxFlowPerCell
+		std::vector<float> cellCapture; // By linear cell index
+		std::vector<float> nodeBound; // By node of the tree layout
+	};
+
+	// A cell modified by a candidate, occupied or not after the modification
+	struct ModifiedCell
+	{
+		ModifiedCell(const int _cellIndex = INVALID_POS, const bool _isOccupied = false) : cellIndex(_cellIndex), isOccupied(_isOccupied) {}
+
+		int cellIndex;
+		bool isOccupied;
+	};
+
+	void computeFlowUpperBounds(FlowUpperBounds& outBounds) const;
+
+	// Upper bound of the flow of this board once the cells are modified and the links updated. The modified cells are sorted in place,
+	// a cell listed several times is occupied if any of its entries is
+	float getFlowUpperBound(const FlowUpperBounds& bounds, std::vector<ModifiedCell>& modifiedCells) const;
+
 
 	// Todo: parallel version
 
@@ -235,8 +415,27 @@ struct BoardObject
 	// Checks if the current board filling is compliant with the given patterns on row and column
 	// TODO: make it take input parametric not globally
 	// Returns the wrong position if you want
+	// Only the rows and columns modified since they were last found compliant are checked again
 	bool isCompliantWithRowColPatterns(int onlyTestRow = INVALID_POS, int onlyTestCol = INVALID_POS, TablePos* outWrongPos = nullptr) const;
 
+	// Same check for all the rows and columns except the given ones
+	bool isCompliantWithRowColPatternsExcept(const int skipRow, const int skipCol) const;
+
+	// The language check of the row and column through a position, for all the symbols tried there. The other segments of the row and column
+	// are checked once and the automata run up to the position, so a symbol only continues them. The position is seen as occupied, whatever is there now
+	struct PosLanguageCheck
+	{
+		TablePos pos;
+		bool areOtherSegmentsCompliant = false; // If not, no symbol can be compliant there
+		int rowState = 0, colState = 0; // The states of the automata before the position
+		int rowSegmentEnd = 0, colSegmentEnd = 0;
+	};
+
+	void preparePosLanguageCheck(const TablePos& pos, PosLanguageCheck& outCheck) const;
+
+	// Same as isCompliantWithRowColPatterns(pos.row, pos.col) once the symbol is set at the position, if the row and column are not modified elsewhere
+	bool isSymbolCompliantAtPos(const PosLanguageCheck& check, const char symbol) const;
+
 	// Checks if we have the same numbers of items after transformations - for debugging
 	bool isNumberOfCharactersGood() const;
 
@@ -244,17 +443,30 @@ struct BoardObject
 	void cutSubtree(const int row, const int col, SubtreeInfo& outSubtree);
 
 	// Apply a subtree on this board at given position if possible. 
-	// Returns false if there is a position / language issue and the check parameters are true
+	// Returns false if there is a position / language issue and the check parameters are true. The links are not updated on a language issue, so roll the board back
 	bool tryApplySubtree(const int row, const int col, const SubtreeInfo& subtree, const bool checkPositions, const bool checkLanguage);
 
 	// Check if we can paste the tree at the target positions only by considering their positions
 	bool canPasteSubtreeAtPos_noLangCheck(const int targetRow, const int targetCol, const SubtreeInfo& subTree) const;
 
 	// Gets all the available position to move the tree rooted in this Cell
-	void evaluatePositionsToMove(const int cellRow, const int cellCol, const SubtreeInfo& subtreeCut, AvailablePositionsToMove& outPos, int& outBestOptionIndex) const;
+	// The positions are tried in parallel, each in a transaction that is rolled back, so the board is the same on return.
+	// Each position is evaluated with evaluateDataFlow_serial, so the result is the same for any number of threads
+	void evaluatePositionsToMove(const int cellRow, const int cellCol, const SubtreeInfo& subtreeCut, AvailablePositionsToMove& outPos, int& outBestOptionIndex);
 
 	void printBoard(std::ostream& outStream);
 
+	// Writes the board and its sources as a TRACE_BOARD record of the given step, which the trace renderer prints as printBoard does
+	void writeTrace(TraceWriter& trace, const int step) const;
+
+	// The cells modified on this board are told to the frames writer, if any. Not copied with the board, so the copies used for evaluations have none
+	void setFramesWriter(BoardFramesWriter* framesWriter) { m_framesWriter = framesWriter; }
+
+	// Saves the full state of this board in a checkpoint: cells, root, sources, rented and garbage collected resources, the pending subtree cut
+	// and the snapshot last broadcasted to the cells. Loading resizes the board (and g_boardRows, g_boardCols), rebuilds the links from the symbols, then restores the rest
+	void saveCheckpoint(CheckpointWriter& writer) const;
+	bool loadCheckpoint(const CheckpointReader& reader);
+
 	// Sets the expression on row starting at a position from first character of the expressions
 	void setExprOnRow(const int row, const int startCol, const std::string& expr);
 
@@ -267,9 +479,14 @@ struct BoardObject
 	// Clear the expression on column starting at a position of a certain size
 	void clearExprOnCol(const int col, const int startRow, const uint size);
 
-	// Propagates source add/modify/remove through all cells' board views within this board
+	// Propagates source add/modify/remove to all cells' board views within this board.
+	// The views share the sources table of this board so this costs the same as a single update
 	bool propagateSourceEvent(const Cell::BroadcastEventType srcEventType, const TablePos& pos, const SourceInfo& sourceInfo, const bool allSources);
 
+	// Applies the events in order, with one version change of the sources table for all of them.
+	// Returns false if any of the events failed, the others are still applied
+	bool propagateSourceEvents(const SourceEventsBatch& events);
+
 	// Try several attempts to generate a column at pivotRow with trying of different columns between startCol and endCol
 	void generateCol(const int pivotROW, const int startCol, const int endCol, const int depth);
 	void generateRow(const int pivotCol, const int rowStart, const int rowEnd, const int depth);
@@ -308,6 +525,9 @@ struct BoardObject
 
 	void fillSimulationContext(SimulationContext& simContext) const;
 
+	// Heap allocations made by the last simulateTick_serial. Zero once the simulation buffers are large enough for the board
+	uint64_t getLastTickNumHeapAllocations() const { return m_lastTickNumHeapAllocations; }
+
 	bool isPosFree(const TablePos& pos) const { return m_board[pos.row][pos.col].isFree(); }
 	bool isPosFree(const int row, const int col) const { return m_board[row][col].isFree(); }
 
@@ -316,7 +536,7 @@ struct BoardObject
 	bool removeRentedSource(const TablePos& tablePos);
 	void addRentedResource(const char symbol, const TablePos& tablePos);
 
-	std::unordered_set<RentedResourceInfo> m_rentedResources;
+	std::set<RentedResourceInfo> m_rentedResources;
 
 	// Subtree that was cut and should be applied after m_remainingTicksUntilApplyCutSubtree ticks
 	struct SubtreeCutInfo
@@ -399,7 +619,8 @@ private:
 	// Returns true if the evaluation was successfully.
 	// Give the column to cut; 
 	// outputs the direction (LEFT / RIGHT to shift) and the flow difference than the given baseline (original board)
-	bool evaluateMembraneCut(membraneCutFunctorType func, const DIRECTION dirs[2], const int colIter, const float baselineFlowAvg, DIRECTION& outDir, float& outFlowDiff) const;
+	// The cuts are tried on scratchBoard, a copy of this board, which is the same on return. Logs to g_debugLogOutput
+	bool evaluateMembraneCut(BoardObject& scratchBoard, membraneCutFunctorType func, const DIRECTION dirs[2], const int colIter, const float baselineFlowAvg, DIRECTION& outDir, float& outFlowDiff) const;
 
 
 	// Returns true if any valid.
@@ -413,26 +634,27 @@ private:
 
 	// From symbol to number of collected resources
 	// m_garbageCollectedResources['e'] how many resources are available for type 'e'
-	std::unordered_map<char, int> m_garbageCollectedResources;
+	std::map<char, int> m_garbageCollectedResources;
 
 	// Min Max of membrane bounds per each column/row
-	std::pair<int, int> m_membraneBoundsPerRow[MAX_ROWS + 1];
-	std::pair<int, int> m_membraneBoundsPerCol[MAX_COLS + 1];
+	std::vector<std::pair<int, int>> m_membraneBoundsPerRow;
+	std::vector<std::pair<int, int>> m_membraneBoundsPerCol;
 	std::pair<int, int> m_membraneBoundsRows; // Minimum and maximum for rows and columns delimiting the membrane's bounding box
 	std::pair<int, int> m_membraneBoundsCols;
 
 	// Updated for each row and column the min, max values
 	void updateMembraneBounds(std::vector<Cell*>& membraneCells);
 
-	// allSources is used for removing event only
-	bool internalPropagateSourceEvent(const Cell::BroadcastEventType srcEventType, Cell* cell, const TablePos& tablePos, const SourceInfo& source, const bool allSources, const int depth);
-
 	// Recursively cuts the subtree starting at currCell - used by cutSubtree public func
 	void internalCutSubtree(const Cell& currCell, const int rowOff, const int colOff, SubtreeInfo& outSubtree);
 
 	// Helper to perform a deep copy of data from another board object
 	void copyDataFrom(const BoardObject& other);
 
+	// Save / load one of the boards of a checkpoint. The cells records are returned to the caller to add the views of the cells before saving them
+	void saveBoardState(CheckpointWriter& writer, const CheckpointBoard boardIndex, std::vector<CheckpointCell>& outCells) const;
+	bool loadBoardState(const CheckpointReader& reader, const CheckpointBoard boardIndex);
+
 #if RUNMODE == DIRECTIONAL_MODE
 	// Used inside update links
 
@@ -449,14 +671,251 @@ private:
 #else
 	// Used inside update links
 	void internalCreateLinks(Cell* prevCell, const DIRECTION dir, const int row, const int col);
+
+	// Linear indices of the cells linked by the last links update. Every cell with links is here, so the next update resets only these
+	std::vector<int> m_linkedCells;
+
+	// Saves m_linkedCells in the current transaction before it is rebuilt
+	void journalLinkedCells();
 #endif
 
 	bool checkRow(const int row, const int startCol, const int endCol) const;
 
 	bool checkCol(const int col, const int startRow, const int endRow) const;
 
+	// Check all the contiguous segments on a row / column
+	bool checkRowSegments(const int row, TablePos* outWrongPos) const;
+	bool checkColSegments(const int col, TablePos* outWrongPos) const;
+
+	// Same on the segments in a range only. The cells just outside the range must be free or outside the board
+	bool checkRowSegmentsInRange(const int row, const int startCol, const int endCol, TablePos* outWrongPos) const;
+	bool checkColSegmentsInRange(const int col, const int startRow, const int endRow, TablePos* outWrongPos) const;
+
+	// Any code changing symbols or rented flags on this board must mark the cells, so the language check and the Zobrist hash look at them again
+	void markSymbolModified(const int row, const int col)
+	{
+		m_languageDirtyRows[row] = true;
+		m_languageDirtyCols[col] = true;
+		m_zobristDirtyRows[row] = true;
+		m_linksVersion++;
+
+		if (m_framesWriter)
+			m_framesWriter->markCellChanged(row * m_board.getNumCols() + col);
+	}
+
+	void markAllSymbolsModified();
+
+	// Rows and columns with symbols modified since they were last found compliant with the language
+	mutable std::vector<bool> m_languageDirtyRows;
+	mutable std::vector<bool> m_languageDirtyCols;
+
+	// Zobrist hash of the cells: the XOR of a key per occupied cell, drawn from its position, symbol and rented flag.
+	// It's kept per row and only the rows modified since the last getZobristHash are hashed again
+	mutable std::vector<uint64_t> m_zobristRowHashes;
+	mutable std::vector<bool> m_zobristDirtyRows;
+	mutable uint64_t m_cellsZobristHash = 0;
+
 	void gatherLeafNodes(const Cell* currentCell, std::vector<TablePos>& outLeafNodes) const;
 
+	// Buffers reused by the simulation ticks, so they don't allocate once large enough. They are not copied with the board
+	struct SimulationScratch
+	{
+		struct CellTempCaptureInfo
+		{
+			const Cell* cell = nullptr;
+			TablePos pos;
+			float remainingCap = 0.0f;
+
+			float currentIterCapSum = 0.0f;
+
+			void onAddCapture(const float value)
+			{
+				remainingCap -= value;
+				assert(remainingCap >= 0.0f);
+
+				currentIterCapSum += value;
+			}
+		};
+
+		SimulationContext simContext;
+		std::vector<TablePos> leafNodes;
+		std::vector<CellTempCaptureInfo> leafNodesCapture;
+		std::vector<std::pair<TablePos, SourceInfo>> shuffledSources;
+		std::vector<int> leafNodesCaptureIndirection;
+		std::vector<int> sortedLeafNodesIndirection;
+		std::vector<int> distanceRingStart;
+
+		// Inputs and outputs of computeSourcesInfluence, in the order of leafNodesCapture and shuffledSources
+		std::vector<int> leafCells;
+		std::vector<const SourcesInfluenceField::SourceRow*> sourceRows;
+		std::vector<float> sourcePowers;
+		std::vector<int> sourcesDistance;
+		std::vector<float> sourcesInfluence;
+
+		// Buffers of captureFromNearbySources
+		struct NearbyCapture
+		{
+			int srcIndex; // In shuffledSources
+			int leafIndex; // In leafNodesCapture
+			int distance;
+			float influence;
+		};
+
+		std::vector<int> bucketStart; // The sources of bucket b are bucketSources[bucketStart[b] .. bucketStart[b + 1])
+		std::vector<int> bucketSources;
+		std::vector<NearbyCapture> nearbyCaptures;
+		std::vector<NearbyCapture> capturesBySource; // The captures of source s are [sourceCapturesStart[s] .. sourceCapturesStart[s + 1])
+		std::vector<int> sourceCapturesStart;
+
+#if RUNMODE == DIRECTIONAL_MODE
+		std::vector<Cell*> membraneCells;
+		std::vector<Cell*> interiorSubtrees;
+#endif
+	};
+
+	mutable SimulationScratch m_simulationScratch;
+
+	// Steps of fillSimulationContext: the leaves capture from the sources, in the order of scratch.shuffledSources
+	void captureFromAllSources(SimulationScratch& scratch) const;
+	void captureFromNearbySources(SimulationScratch& scratch) const;
+
+	// The tree from the root as arrays in post-order (children before their parent, the root last), so a tick is a linear sweep instead of a recursion over the links.
+	// It's a cache of the links: rebuilt when they were modified since it was built
+	struct TreeLayout
+	{
+		std::vector<int> nodeCell; // Linear index in m_board of the node's cell
+		std::vector<int> nodeParent; // Node index of the parent, INVALID_POS for the root
+		std::vector<int> nodeChildrenStart; // The children of node i are childNodes[nodeChildrenStart[i] .. nodeChildrenStart[i + 1]), in fillChildrenList order
+		std::vector<int> childNodes;
+		std::vector<int> leafNodes; // The nodes without children, in post-order
+		int rootCell = INVALID_POS;
+		int numBoardCells = 0;
+		uint64_t linksVersion = 0; // m_linksVersion when built
+		int buildId = 0; // Incremented on each build
+		bool hasSharedCells = false; // A cell linked from two parents is two nodes, so its node can't be found from the cell
+
+		std::vector<std::pair<int, int>> buildStack; // (cell, parent node) pairs to visit when building
+		std::vector<uint> nodeTickStamps; // The nodes already listed to tick, see simulateTick_serial
+	};
+
+	mutable TreeLayout m_treeLayout;
+
+	// The last tick of a cell: its inputs and what it left in itself and its children. The tick of a cell is a function of these inputs only,
+	// so a cell finding them unchanged takes the recorded result instead of capturing again. After a local change to the tree (a subtree moved, a cell added),
+	// only the cells on the paths from the changes to the root, and the leaves whose capture changed, compute their flow again
+	struct CellTickRecord
+	{
+		int numChildren = INVALID_POS; // INVALID_POS until the cell has a record
+		int childCells[DIR_COUNT];
+		float childrenBufferedBefore[DIR_COUNT]; // What the children had when the cell captured from them
+		float childrenBufferedAfter[DIR_COUNT];
+		float bufferedBefore = 0.0f;
+		float bufferedAfter = 0.0f;
+		float leafCapture = 0.0f;
+
+		int layoutBuildId = INVALID_POS; // The build of m_treeLayout having this cell as a node, and its node there
+		int node = INVALID_POS;
+		bool isDirty = false; // Listed in m_dirtyTickCells
+	};
+
+	// Indexed by cell. Kept between ticks and transactions, not copied with the board
+	mutable std::vector<CellTickRecord> m_cellTickRecords;
+
+	// A node is steady when it has the inputs of its record, so its tick replays the record and changes nothing below it. A tick skips the steady subtrees:
+	// only the nodes on the paths from these cells to the root tick. They are the cells with buffered data changed outside the ticks, the nodes new in the layout
+	// or with other children than in their records, and the ones that didn't reach a steady state in their last tick. The leaves capturing something else are added by the tick
+	mutable std::vector<int> m_dirtyTickCells;
+	bool m_areAllTicksDirty = true; // The records don't follow the cells, e.g. after a copy. The next tick goes through all the nodes
+	std::vector<int> m_tickNodes; // The nodes ticking, in post-order
+	uint m_lastTickStamp = 0;
+
+	void markTickDirty(const int cellIndex) const;
+
+	// The tick of a single node of m_treeLayout, once its children did their tick
+	void simulateNodeTick_serial(const int nodeIndex, const SimulationContext& simContext);
+
+	// Incremented when links may be modified, i.e. on symbols modified, links update and links restored by a rollback
+	uint64_t m_linksVersion = 0;
+
+	// Rebuilds m_treeLayout if the links were modified since it was built
+	void updateTreeLayout() const;
+	bool isTreeLayoutValid() const;
+	void buildTreeLayout() const;
+	uint64_t m_lastTickNumHeapAllocations = 0;
+
+	std::shared_ptr<SourcesTable> m_sources;
+
+	// Transactions journal
+	//------
+	struct CellJournalEntry
+	{
+		int index; // Linear index of the cell in m_board
+		Cell::SavedState state;
+	};
+
+	struct SourceJournalEntry
+	{
+		TablePos pos;
+		bool existed; // False if there was no source at pos
+		SourceInfo info;
+	};
+
+	// The board state saved when a transaction begins. Everything else is journaled on modification
+	struct TransactionSavepoint
+	{
+		uint stamp; // Unique on this board, marks the cells already saved in this transaction
+		size_t numCellEntries;
+		size_t numSourceEntries;
+		uint64_t sourcesVersion;
+		uint64_t sourcesLayoutVersion;
+
+		int rootRow, rootCol;
+		std::set<RentedResourceInfo> rentedResources;
+		std::map<char, int> garbageCollectedResources;
+		SubtreeCutInfo subtreeCut;
+		int remainingTicksUntilApplyCutSubtree;
+		bool useTicksToDelayDataFlowCapture;
+		int numTicksRemainingToUpdateSources;
+
+		std::vector<std::pair<int, int>> membraneBoundsPerRow;
+		std::vector<std::pair<int, int>> membraneBoundsPerCol;
+		std::pair<int, int> membraneBoundsRows;
+		std::pair<int, int> membraneBoundsCols;
+
+		DataFlowStatistics* rootStatistics;
+		std::vector<float> rootStatisticsRecords;
+
+#if RUNMODE != DIRECTIONAL_MODE
+		bool isLinkedCellsSaved; // linkedCells is saved on the first links update in the transaction
+		std::vector<int> linkedCells;
+#endif
+	};
+
+	// Save the cell's state if not already saved in the current transaction. Does nothing outside transactions
+	void journalCell(Cell& cell);
+
+	// Save the cell and the cells linked to it, which are modified too when a cell is emptied
+	void journalCellAndLinks(Cell& cell);
+
+	// Save the cells reached from the root by the structure messages
+	void journalTreeCells();
+
+	void journalAllCells();
+	void journalSource(const TablePos& pos);
+
+	// Applies a source event without changing the version of the sources table. Sets outLayoutModified if sources were added or removed
+	bool applySourceEvent(const SourceEvent& event, bool& outLayoutModified);
+
+	std::vector<CellJournalEntry> m_cellsJournal;
+	std::vector<SourceJournalEntry> m_sourcesJournal;
+	std::vector<Cell*> m_treeCellsToJournal; // Walk stack of journalTreeCells, kept to reuse its memory
+	std::vector<TransactionSavepoint> m_transactions; // Open transactions are the first m_numOpenTransactions. The others are kept to reuse their memory
+	int m_numOpenTransactions = 0;
+	uint m_lastTransactionStamp = 0;
+	// =====
+
+	BoardFramesWriter* m_framesWriter = nullptr;
+
 	Expression_Generator* m_rowGenerator;
 	Expression_Generator* m_colGenerator;
 	int m_numTicksRemainingToUpdateSources; // THe number of ticks remaining when all sources' targets should be updated
@@ -468,5 +927,70 @@ private:
 	int	 m_remainingTicksUntilApplyCutSubtree = 0; // Copy from the root cell of the subtree that was cut
 };
 
+// Recycles the scratch copies of boards. A new copy allocates its cells, sources table, flow statistics and containers,
+// while a recycled board is reset and copied into in place, reusing them.
+// Each thread of the task pool has its own boards, and a board goes back to the thread that acquired it, whichever thread releases it
+class BoardObjectPool
+{
+public:
+	struct Releaser
+	{
+		int threadIndex = INVALID_POS; // INVALID_POS for the boards made outside the pools
+		void operator()(BoardObject* board) const;
+	};
+	typedef std::unique_ptr<BoardObject, Releaser> BoardPtr;
+
+	BoardObjectPool() = default;
+
+	// Makes the boards of each thread. Before this, the boards are allocated and deleted each time
+	void init(const int numThreads);
+
+	// A copy of the given board, made from a board of the calling thread if it has one free
+	BoardPtr acquireCopy(const BoardObject& board);
+
+	// Statistics: the boards allocated, the copies acquired and the most boards in use at once (the high-water mark)
+	int getNumBoardsCreated() const { return m_numBoardsCreated; }
+	uint64_t getNumAcquires() const { return m_numAcquires; }
+	int getMaxBoardsInUse() const { return m_maxBoardsInUse; }
+
+private:
+	BoardObjectPool(const BoardObjectPool& other) = delete;
+	void operator=(const BoardObjectPool& other) = delete;
+
+	void release(BoardObject* board, const int threadIndex);
+
+	struct ThreadBoards
+	{
+		std::mutex mutex; // Boards can be released by the other threads
+		std::vector<std::unique_ptr<BoardObject>> freeBoards;
+	};
+	std::vector<std::unique_ptr<ThreadBoards>> m_threadBoards;
+
+	std::atomic<int> m_numBoardsCreated{ 0 };
+	std::atomic<uint64_t> m_numAcquires{ 0 };
+	std::atomic<int> m_numBoardsInUse{ 0 };
+	std::atomic<int> m_maxBoardsInUse{ 0 };
+};
+
+extern BoardObjectPool g_boardObjectPool;
+
+// Copies of a board for the tasks of a parallel loop, one per thread and made when the thread first needs it.
+// A task tries its changes on the copy of its thread in a transaction, and rolls them back before returning
+class ThreadScratchBoards
+{
+public:
+	explicit ThreadScratchBoards(const BoardObject& board);
+
+	// The copy of the calling thread
+	BoardObject& get();
+
+private:
+	ThreadScratchBoards(const ThreadScratchBoards& other) = delete;
+	void operator=(const ThreadScratchBoards& other) = delete;
+
+	const BoardObject& m_board;
+	std::vector<BoardObjectPool::BoardPtr> m_threadBoards;
+};
+
 
 #endif
@@ -1,6 +1,7 @@
 #include "Cell.h"
 #include "BoardObject.h"
-#include <regex>
+#include "TaskPool.h"
+#include "Checkpoint.h"
 #include <sstream>
 #include <iostream>
 #include <iomanip>
@@ -36,10 +37,8 @@ extern int g_247eModelRootRow;
 extern bool g_verboseElasticModel_All;
 extern bool g_verboseElasticModel_Results;
 
-extern std::ostream* g_debugLogOutput;
+extern thread_local std::ostream* g_debugLogOutput;
 
-extern std::regex g_colRXExpr;
-extern std::regex g_rowRXExpr;
 
 DIRECTION getOppositeDirection(const DIRECTION dir)
 {
@@ -71,19 +70,31 @@ const std::unordered_map<char, DIRECTION> Cell::g_symbolToDirection =
 };
 
 float getCostForResource(char symbol) { return g_costPerResource[symbol]; }
-void Cell::UniversalHash2D::reset() { memset(cellsHash, false, sizeof(cellsHash)); }
+void Cell::UniversalHash2D::reset() { cellsHash.assign(g_boardRows * g_boardCols, false); }
+
+static const float NO_LEAF_CAPTURE = -1.0f;
+
+void SimulationContext::resetLeafNodeCaptures()
+{
+	mLeafNodeToCaptureValue.assign(g_boardRows * g_boardCols, NO_LEAF_CAPTURE);
+}
+
+void SimulationContext::setLeafNodeCapture(const TablePos& leafPos, const float value)
+{
+	mLeafNodeToCaptureValue[leafPos.row * g_boardCols + leafPos.col] = value;
+}
 
 bool SimulationContext::getLeafNodeCapture(const TablePos& leafPos, float& outValue) const
 {
 	outValue = 0.0f;
-	auto it = mLeafNodeToCaptureValue.find(leafPos);
-	if (it == mLeafNodeToCaptureValue.end())
+	const float value = mLeafNodeToCaptureValue[leafPos.row * g_boardCols + leafPos.col];
+	if (value == NO_LEAF_CAPTURE)
 	{
 		assert(false && "Couldn't find cached data for this leaf in the simulation context");
 		return false;
 	}
 
-	outValue = it->second;
+	outValue = value;
 	return true;
 }
 
@@ -95,7 +106,7 @@ Cell::Cell() : m_bufferedData((float)g_maxFlowPerCell), m_flowStatistics(nullptr
 bool Cell::isRoot() const
 {
 #if RUNMODE != DIRECTIONAL_MODE
-	//assert(m_row != 0 && m_column != MAX_COLS - 1);
+	//assert(m_row != 0 && m_column != g_boardCols - 1);
 	return m_parent == nullptr;
 #else
 	if (m_cellType != CELL_MEMBRANE)
@@ -128,7 +139,16 @@ void Cell::operator=(const Cell& other)
 {
 	if (other.m_flowStatistics)
 	{
-		m_flowStatistics = other.m_flowStatistics->duplicate();
+		// The copy starts with no records. Reuse the statistics of this cell if they have the same size
+		if (m_flowStatistics && m_flowStatistics->getMaxStats() == other.m_flowStatistics->getMaxStats())
+		{
+			m_flowStatistics->clearStats();
+		}
+		else
+		{
+			delete m_flowStatistics;
+			m_flowStatistics = other.m_flowStatistics->duplicate();
+		}
 	}
 	else
 	{
@@ -150,6 +170,7 @@ void Cell::operator=(const Cell& other)
 #endif
 
 	m_boardView = nullptr;
+	m_sharedBoardView.reset();
 #if RUNMODE != DIRECTIONAL_MODE
 	m_parent = nullptr;
 #endif
@@ -157,6 +178,141 @@ void Cell::operator=(const Cell& other)
 	m_prevLeft = m_prevRight = m_prevDown = m_prevUp = nullptr;
 }
 
+void Cell::saveState(SavedState& outState) const
+{
+	outState.symbol = m_symbol;
+	outState.distanceToRoot = m_distanceToRoot;
+	for (int dirIter = 0; dirIter < DIR_COUNT; dirIter++)
+	{
+		outState.followers[dirIter] = *m_followersByDir[dirIter];
+		outState.previous[dirIter] = *m_previousByDir[dirIter];
+	}
+#if RUNMODE != DIRECTIONAL_MODE
+	outState.parent = m_parent;
+#endif
+	outState.cellType = m_cellType;
+	outState.boardView = m_boardView;
+	outState.sharedBoardView = m_sharedBoardView;
+	outState.isEmpty = m_isEmpty;
+	outState.row = m_row;
+	outState.column = m_column;
+	outState.isRented = m_isRented;
+	outState.flowStatistics = m_flowStatistics;
+	outState.remainingTicksToDelayDataFlowCapture = m_remainingTicksToDelayDataFlowCapture;
+	outState.bufferedData = m_bufferedData.getCurrentCap();
+#if RUNMODE == DIRECTIONAL_MODE
+	outState.lastEnergyConsumedStat = m_lastEnergyConsumedStat;
+#endif
+	outState.journalStamp = m_journalStamp;
+}
+
+void Cell::restoreState(const SavedState& state)
+{
+	m_symbol = state.symbol;
+	m_distanceToRoot = state.distanceToRoot;
+	for (int dirIter = 0; dirIter < DIR_COUNT; dirIter++)
+	{
+		*m_followersByDir[dirIter] = state.followers[dirIter];
+		*m_previousByDir[dirIter] = state.previous[dirIter];
+	}
+#if RUNMODE != DIRECTIONAL_MODE
+	m_parent = state.parent;
+#endif
+	m_cellType = state.cellType;
+	m_boardView = state.boardView;
+	m_sharedBoardView = state.sharedBoardView;
+	m_isEmpty = state.isEmpty;
+	m_row = state.row;
+	m_column = state.column;
+	m_isRented = state.isRented;
+	m_flowStatistics = state.flowStatistics;
+	m_remainingTicksToDelayDataFlowCapture = state.remainingTicksToDelayDataFlowCapture;
+	m_bufferedData.reset();
+	m_bufferedData.add(state.bufferedData, true);
+#if RUNMODE == DIRECTIONAL_MODE
+	m_lastEnergyConsumedStat = state.lastEnergyConsumedStat;
+#endif
+	m_journalStamp = state.journalStamp;
+}
+
+bool Cell::hasSameLinks(const SavedState& state) const
+{
+	for (int dirIter = 0; dirIter < DIR_COUNT; dirIter++)
+	{
+		if (*m_followersByDir[dirIter] != state.followers[dirIter] || *m_previousByDir[dirIter] != state.previous[dirIter])
+			return false;
+	}
+
+#if RUNMODE != DIRECTIONAL_MODE
+	if (m_parent != state.parent)
+		return false;
+#endif
+
+	return m_row == state.row && m_column == state.column;
+}
+
+void Cell::saveCheckpoint(CheckpointCell& outRecord, std::vector<float>& outFlowStats) const
+{
+	outRecord = CheckpointCell();
+	outRecord.symbol = m_symbol;
+	outRecord.cellType = (uint8_t)m_cellType;
+	outRecord.isRented = m_isRented;
+	outRecord.remainingTicksToDelayDataFlowCapture = m_remainingTicksToDelayDataFlowCapture;
+	outRecord.bufferedData = m_bufferedData.getCurrentCap();
+#if RUNMODE == DIRECTIONAL_MODE
+	outRecord.lastEnergyConsumedStat = m_lastEnergyConsumedStat;
+#endif
+
+	if (m_flowStatistics)
+	{
+		const size_t firstRecord = outFlowStats.size();
+		std::vector<float> records;
+		m_flowStatistics->saveRecords(records);
+		outFlowStats.insert(outFlowStats.end(), records.begin(), records.end());
+
+		outRecord.maxFlowStats = m_flowStatistics->getMaxStats();
+		outRecord.numFlowStats = (int32_t)(outFlowStats.size() - firstRecord);
+	}
+}
+
+void Cell::loadCheckpoint(const CheckpointCell& record, const float* flowStats)
+{
+	assert(m_symbol == record.symbol && "The cell symbols are set before loading the checkpoint, to build the links");
+	m_cellType = (CellType)record.cellType;
+	m_isRented = record.isRented != 0;
+	m_remainingTicksToDelayDataFlowCapture = record.remainingTicksToDelayDataFlowCapture;
+	m_bufferedData.reset();
+	m_bufferedData.add(record.bufferedData, true);
+#if RUNMODE == DIRECTIONAL_MODE
+	m_lastEnergyConsumedStat = record.lastEnergyConsumedStat;
+#endif
+
+	if (record.maxFlowStats > 0)
+	{
+		initFlowStatistics(record.maxFlowStats);
+		m_flowStatistics->restoreRecords(flowStats, record.numFlowStats);
+	}
+}
+
+void Cell::initFlowStatistics(const int maxNumRecords)
+{
+	if (m_flowStatistics && m_flowStatistics->getMaxStats() == maxNumRecords)
+	{
+		m_flowStatistics->clearStats();
+		return;
+	}
+
+	delete m_flowStatistics;
+	m_flowStatistics = new DataFlowStatistics(maxNumRecords);
+}
+
+void Cell::resetAsNew()
+{
+	reset();
+	m_bufferedData.reset();
+	m_cellType = CELL_NOTSET;
+}
+
 void Cell::resetLinks()
 {
 #if RUNMODE != DIRECTIONAL_MODE
@@ -181,6 +337,7 @@ void Cell::reset(const bool resetSymbolToo /*= true*/)
 	m_row = -1;
 	m_column = -1;
 	m_boardView = nullptr;
+	m_sharedBoardView.reset();
 	m_remainingTicksToDelayDataFlowCapture = 0;
 	m_isRented = false;
 
@@ -222,7 +379,7 @@ void Cell::broadcastMessage(const BroadcastEventType eventType, const BroadcastM
 }
 */
 
-void Cell::onMsgBroadcastStructure(BoardObject* structure)
+void Cell::onMsgBroadcastStructure(const BoardSnapshotPtr& structure)
 {
 
 #if RUNMODE == DIRECTIONAL_MODE
@@ -249,30 +406,31 @@ void Cell::onMsgBroadcastStructure(BoardObject* structure)
 
 #endif
 
-	// Update the local blackboard
-	if (m_boardView == nullptr)
-		m_boardView = new BoardObject();
-
-	*m_boardView = *structure;
+	// Update the local blackboard. Only a reference is kept, the structure is shared by all cells
+	m_sharedBoardView = structure;
 }
 
 void Cell::onRootMsgBroadcastStructure(BoardObject* structure)
 {
+	// The structure is copied only once, then all the other cells share this snapshot
+	const BoardSnapshotPtr snapshot = structure->createSnapshot();
+
 #if RUNMODE == DIRECTIONAL_MODE
 	// Get the cell below and send it the stuff. It will send further the structure
-	// Can get it from board since Root is using the main (real) board while the others have a private copy. 
+	// Can get it from board since Root is using the main (real) board while the others have a shared snapshot. 
 	Cell* prev = &structure->m_board[m_row + 1][m_column];
 	assert(prev->m_up == this); // Sanity check to be sure that we take it from the right board...
-	prev->onMsgBroadcastStructure(structure);
+	prev->onMsgBroadcastStructure(snapshot);
 #else 
 	if (m_left)
-		m_left->onMsgBroadcastStructure(structure);
+		m_left->onMsgBroadcastStructure(snapshot);
 
 	if (m_down)
-		m_down->onMsgBroadcastStructure(structure);
+		m_down->onMsgBroadcastStructure(snapshot);
 #endif
 
 	m_boardView = structure;
+	m_sharedBoardView.reset();
 }
 
 void Cell::onMsgDiscoverStructure(int currRow, int currCol, int depth)
@@ -314,12 +472,12 @@ void Cell::onMsgDiscoverStructure(int currRow, int currCol, int depth)
 #endif
 }
 
-bool Cell::onRootMsgReorganize()
+bool Cell::onRootMsgReorganize(AvailablePosInfoAndDeltaScore* outDecision)
 {
 #if RUNMODE == DIRECTIONAL_MODE
 	assert(m_column == g_247eModelRootCol && m_row == g_247eModelRootRow);
 #else
-	assert(m_column == MAX_COLS - 1 && m_row == 0);	// Just a check for sanity :)
+	assert(m_column == g_boardCols - 1 && m_row == 0);	// Just a check for sanity :)
 #endif
 	// In the case we call reorganize and we still have a subtree that waiting to be applied
 	// Only in a simulation should be true
@@ -328,16 +486,39 @@ bool Cell::onRootMsgReorganize()
 		return false;
 	}
 
-	// Allocate an array for results - TODO: optimize we should know easily how many nodes are in the tree 
-	std::vector<AvailablePosInfoAndDeltaScore> localBestResults;
-	localBestResults.reserve(MAX_COLS * MAX_ROWS);
+	// Gather the cells that will look for a better place of their subtree
+	std::vector<Cell*> participants;
+	participants.reserve(g_boardCols * g_boardRows);
 
 	// Send message to children first
 	if (m_left)
-		m_left->onMsgReorganizeStart(localBestResults);
+		m_left->onMsgReorganizeStart(participants);
 
 	if (m_down)
-		m_down->onMsgReorganizeStart(localBestResults);
+		m_down->onMsgReorganizeStart(participants);
+
+	// The participants search on copies of the board, which share its sources influence field if it's built before
+	m_boardView->getSourcesInfluenceField();
+
+	// The cells evaluate in parallel, then their results are gathered in the order of the messages above
+	std::vector<AvailablePosInfoAndDeltaScore> participantsBestOption(participants.size());
+	std::vector<char> participantsHasOption(participants.size(), false);
+	std::vector<std::string> participantsLog(participants.size());
+	g_taskPool.parallelFor((int)participants.size(), [&](const int participantIndex)
+	{
+		participantsHasOption[participantIndex] = participants[participantIndex]->onMsgReorganizeEvaluate(participantsBestOption[participantIndex], participantsLog[participantIndex]);
+	});
+
+	std::vector<AvailablePosInfoAndDeltaScore> localBestResults;
+	localBestResults.reserve(participants.size());
+	for (uint i = 0; i < participants.size(); i++)
+	{
+		if (!participantsLog[i].empty())
+			*g_debugLogOutput << participantsLog[i];
+
+		if (participantsHasOption[i])
+			localBestResults.push_back(participantsBestOption[i]);
+	}
 
 	// Get the best result and send the decision further
 	int maxIndex = INVALID_POS;
@@ -391,61 +572,71 @@ bool Cell::onRootMsgReorganize()
 		// Send empty decision further
 		AvailablePosInfoAndDeltaScore dummy;
 		onMsgReorganizeEnd(INVALID_POS, INVALID_POS, dummy);
+		if (outDecision)
+			*outDecision = dummy;
 	}
 	else
 	{
 		const AvailablePosInfoAndDeltaScore& bestRes = localBestResults[maxIndex];
 		assert(isCoordinateValid(bestRes.selectedRow, bestRes.selectedColumn) && "It looks like the selected row/column for restructuring has failed to fill correctly. There is a bug !");
 		onMsgReorganizeEnd(bestRes.selectedRow, bestRes.selectedColumn, bestRes);
+		if (outDecision)
+			*outDecision = bestRes;
 	}
 
 	return true;
 }
 
-void Cell::onMsgReorganizeStart(std::vector<AvailablePosInfoAndDeltaScore>& output)
+void Cell::onMsgReorganizeStart(std::vector<Cell*>& outParticipants)
 {
 	// Send message to children first
 	if (m_left)
-		m_left->onMsgReorganizeStart(output);
+		m_left->onMsgReorganizeStart(outParticipants);
 
 	if (m_down)
-		m_down->onMsgReorganizeStart(output);
+		m_down->onMsgReorganizeStart(outParticipants);
+
+	outParticipants.push_back(this);
+}
 
+bool Cell::onMsgReorganizeEvaluate(AvailablePosInfoAndDeltaScore& outBestOption, std::string& outLog) const
+{
 	// Copy the global structure and delete from it this subtree
-	BoardObject boardWithoutMySubtree = *m_boardView;
+	BoardObjectPool::BoardPtr boardWithoutMySubtree = g_boardObjectPool.acquireCopy(*getBoardView());
 	SubtreeInfo subTreeCut;
-	boardWithoutMySubtree.cutSubtree(m_row, m_column, subTreeCut);
+	boardWithoutMySubtree->cutSubtree(m_row, m_column, subTreeCut);
 
 	// Get and evaluate the available positions to move this cut subtree
 	AvailablePositionsToMove localOptions;
 	int localBestOptionIndex = INVALID_POS;
 
-	boardWithoutMySubtree.evaluatePositionsToMove(m_row, m_column, subTreeCut, localOptions, localBestOptionIndex);
+	boardWithoutMySubtree->evaluatePositionsToMove(m_row, m_column, subTreeCut, localOptions, localBestOptionIndex);
 
 	// No local option ?
 	if (localBestOptionIndex == INVALID_POS)
 	{
 		// Send empty decision from this node
+		return false;
 	}
-	else // Send my best option then
-	{
-		const AvailablePosInfoAndDeltaScore& bestOption = localOptions[localBestOptionIndex];
-		output.push_back(bestOption);
 
-		if (g_verboseLocalSolutions)
-		{
-			std::ostringstream outMsg;
-			outMsg << "Cell (" << m_row << ", " << m_column << ") ";
-			outMsg << "Best: " << bestOption << "Curr Sc: " << bestOption.score << " others: ";
-			for (const AvailablePosInfoAndDeltaScore& sol : localOptions)
-			{
-				outMsg << " " << sol;
-			}
+	// Send my best option then
+	outBestOption = localOptions[localBestOptionIndex];
 
-			outMsg << "\n";
-			*g_debugLogOutput << outMsg.str();
+	if (g_verboseLocalSolutions)
+	{
+		std::ostringstream outMsg;
+		outMsg << "Cell (" << m_row << ", " << m_column << ") ";
+		outMsg << "Best: " << outBestOption << "Curr Sc: " << outBestOption.score << " others: ";
+		for (const AvailablePosInfoAndDeltaScore& sol : localOptions)
+		{
+			outMsg << " " << sol;
 		}
+
+		outMsg << "\n";
+		outLog = outMsg.str();
 	}
+
+	return true;
 }
 
 // The decision has been made: move the subtree rooted at selectedRow and selectedCol to targetPosAndDir
@@ -489,7 +680,7 @@ void Cell::onMsgReorganizeEnd(int selectedRow, int selectedCol, const AvailableP
 	if (isBoardChanged)
 	{
 		onMsgDiscoverStructure(m_row, m_column, 0);
-		onMsgBroadcastStructure(m_boardView);
+		onRootMsgBroadcastStructure(m_boardView);
 	}
 }
 
@@ -533,7 +724,7 @@ void Cell::fillChildrenList(Cell* children[], const bool shuffleList /* = false*
 
 	if (shuffleList)
 	{
-		std::random_shuffle(&children[0], &children[DIR_COUNT]);
+		std::random_shuffle(&children[0], &children[DIR_COUNT], randIndex);
 		assert(false && "Check this shit");
 	}
 }
@@ -557,7 +748,7 @@ void Cell::fillFollowersList(Cell* followers[], const bool shuffleList /*= false
 
 	if (shuffleList)
 	{
-		std::random_shuffle(followers[0], followers[DIR_COUNT - 1]);
+		std::random_shuffle(followers[0], followers[DIR_COUNT - 1], randIndex);
 		assert(false && "Check this shit");
 	}
 }
@@ -644,9 +835,18 @@ void Cell::simulateTick_serial(const SimulationContext& simContext)
 	m_lastEnergyConsumedStat += g_costPerResource[m_symbol];
 #endif
 
-	// Then capture their data 
+	simulateCellTick_serial(simContext);
+}
+
+void Cell::simulateCellTick_serial(const SimulationContext& simContext)
+{
+	// Capture the children's data 
 	captureDataFlow(simContext);
+	endCellTick_serial();
+}
 
+void Cell::endCellTick_serial()
+{
 #if RUNMODE != DIRECTIONAL_MODE
 	if (isRoot())
 	{
@@ -702,19 +902,44 @@ void Cell::gatherNewResourcesPos(Cell* cell, std::vector<TablePos>& outPositions
 	}
 }
 
-void Cell::elasticBoardCompare(BoardObject& copyBoard, const bool isResourceAdded, const char symbolOfResource, const TablePos& resourcePos, ElasticResourceEval& outResult, const float oldAvgFlow, std::ostream& outDebugStream)
+// An upper bound of the benefit diff of adding or removing a resource, from an upper bound of the flow of the candidate (see BoardObject::getFlowUpperBound).
+// The bound has a bit of margin for the rounding of the average flow
+static float getElasticBenefitUpperBound(const bool isResourceAdded, const char symbolOfResource, const float oldBenefitValue, const float flowUpperBound)
+{
+	const float maxAvgFlow = flowUpperBound * 1.001f;
+	const float costForResource = getCostForResource(symbolOfResource);
+	return (maxAvgFlow * g_benefitPerUnitOfFlow) + (isResourceAdded ? -costForResource : +costForResource) - oldBenefitValue;
+}
+
+// A candidate can be skipped if it can't give a valid result or beat the best one found so far.
+// Nothing is skipped while all the tries are logged, so the log doesn't depend on the order the tasks run
+static bool canSkipElasticCandidate(const float benefitUpperBound, const std::atomic<float>& bestBenefitSoFar)
+{
+	if (g_verboseElasticModel_All)
+		return false;
+
+	return benefitUpperBound <= 0.0f || benefitUpperBound < bestBenefitSoFar.load();
+}
+
+void Cell::elasticBoardCompare(BoardObject& copyBoard, const bool isResourceAdded, const char symbolOfResource, const TablePos& resourcePos, ElasticCandidateEval& outEval, const float oldAvgFlow, std::atomic<float>& bestBenefitSoFar, const std::ostream& debugStreamFormat)
 {
 	float costForResource = getCostForResource(symbolOfResource);
-	copyBoard.doDataFlowSimulation_serial(1);
 	const float oldBenefitValue = oldAvgFlow * g_benefitPerUnitOfFlow;
-	const float newAvgFlow = copyBoard.getLastSimulationAvgDataFlowPerUnit();
+	const float newAvgFlow = copyBoard.evaluateDataFlow_serial();
 	const float newResourceBenefit = (newAvgFlow * g_benefitPerUnitOfFlow) + (isResourceAdded ? -costForResource : +costForResource);
 	const float newResourceBenefitDiff = newResourceBenefit - oldBenefitValue;
-	outResult.augment(copyBoard, symbolOfResource, newResourceBenefitDiff, resourcePos);
+	outEval.isTried = true;
+	outEval.benefit = newResourceBenefitDiff;
+
+	float currBest = bestBenefitSoFar.load();
+	while (newResourceBenefitDiff > currBest && !bestBenefitSoFar.compare_exchange_weak(currBest, newResourceBenefitDiff)) {}
 
 	if (g_verboseElasticModel_All)
 	{
+		std::ostringstream outDebugStream;
+		outDebugStream.copyfmt(debugStreamFormat);
 		outDebugStream << " Trying resource Symbol-" << symbolOfResource << " at position " << resourcePos.row << "," << resourcePos.col << " and benefit diff to before is " << newResourceBenefitDiff << "(flow before: " << oldAvgFlow << ", after: " << newAvgFlow << "\n";
+		outEval.debugLog = outDebugStream.str();
 	}
 }
 
@@ -728,7 +953,7 @@ bool Cell::root_checkAddResources(std::ostream& outDebugStream)
 
 	assert(isRoot());
 	std::vector<TablePos> potentialAddPos;
-	potentialAddPos.reserve(MAX_ROWS * MAX_ROWS / 2);// just a priori allocation
+	potentialAddPos.reserve(g_boardRows * g_boardCols / 2);// just a priori allocation
 
 	// Find the potential positions where resources can be added
 	UniversalHash2D hash;
@@ -739,63 +964,149 @@ bool Cell::root_checkAddResources(std::ostream& outDebugStream)
 	const float currentAvgFlow = m_boardView->getLastSimulationAvgDataFlowPerUnit();
 	const float oldBenefitValue = currentAvgFlow * g_benefitPerUnitOfFlow;
 
-	// Over all resource symbols and positions where we can apply this resource find the best possible place to add a new resource
-	// TODO: there is some redundancy here but i'm too lazy to optimize - basically if you need that it failed under some conditions with a previous symbol, it will fail for the next ones too so we can reduce CPU cycles with this
-	ElasticResourceEval bestResult;
-	bestResult.bestBoard_onlySymbols = new ((BoardObject*)alloca(sizeof(BoardObject))) BoardObject();
-	for (char symbolToAdd : g_allSymbolsSet)
+	// Horizontal shift (left side) and vertical shift (down) of the subtree at an occupied position
+	constexpr int numDirs = 2;
+	const int offsetsPerDirection[numDirs][2] = { {0,-1}, {1,0} }; // for each direction put the offsets of row/col
+
+	// Over all resource symbols and positions where we can apply this resource find the best possible place to add a new resource.
+	// The positions are tried in parallel, each thread on its own copy of the board with a transaction per candidate.
+	// A position cuts its subtree once for all the symbols, and a shift that doesn't fit the positions is not tried again for the next symbols
+	const int numSymbols = (int)g_allSymbolsSet.size();
+	const int numPositions = (int)potentialAddPos.size();
+	std::vector<ElasticCandidateEval> candidatesEval(numSymbols * numPositions * numDirs); // per (symbol, position, direction)
+	std::atomic<float> bestBenefitSoFar(0.0f);
+
+	BoardObject::FlowUpperBounds flowUpperBounds;
+	m_boardView->computeFlowUpperBounds(flowUpperBounds);
+
+	ThreadScratchBoards scratchBoards(*m_boardView);
+
+	g_taskPool.parallelFor(numPositions, [&](const int posIndex)
 	{
-		// For each potential position try to cut / move subtree if needed
-		for (const TablePos& addPos : potentialAddPos)
+		const TablePos& addPos = potentialAddPos[posIndex];
+		const bool isAddPosFree = m_boardView->isPosFree(addPos);
+		BoardObject& scratchBoard = scratchBoards.get();
+
+		scratchBoard.beginTransaction();
+		SubtreeInfo subtree;
+		if (isAddPosFree == false)
 		{
-			// Is the position close to a leaf actually ?
-			if (m_boardView->isPosFree(addPos))
-			{
-				BoardObject copyBoard = *m_boardView;
-				Cell& targetCell = copyBoard(addPos.row, addPos.col);
-				targetCell.setEmpty();
-				targetCell.setSymbol(symbolToAdd);	// We already know from pos list if this cell is a valid one or not
+			scratchBoard.cutSubtree(addPos.row, addPos.col, subtree);
+		}
 
-				// If the board is complaint with the language for row and column update internal links and compare against best result
-				if (copyBoard.isCompliantWithRowColPatterns(addPos.row, addPos.col))
+		// The flow bounds don't depend on the symbol added: one for the position, or one for each direction the subtree is shifted to
+		std::vector<BoardObject::ModifiedCell> modifiedCells;
+		float flowBoundInDir[numDirs] = { 0.0f, 0.0f };
+		float posFlowBound = 0.0f;
+		if (isAddPosFree)
+		{
+			modifiedCells.push_back(BoardObject::ModifiedCell(addPos.row * g_boardCols + addPos.col, true));
+			posFlowBound = m_boardView->getFlowUpperBound(flowUpperBounds, modifiedCells);
+		}
+		else
+		{
+			for (int dirIter = 0; dirIter < numDirs; dirIter++)
+			{
+				modifiedCells.clear();
+				modifiedCells.push_back(BoardObject::ModifiedCell(addPos.row * g_boardCols + addPos.col, true));
+				for (const OffsetAndSymbol& offsetAndSymbol : subtree.m_offsets)
 				{
-					copyBoard.updateInternalCellsInfo();
-					elasticBoardCompare(copyBoard, true, symbolToAdd, addPos, bestResult, currentAvgFlow, outDebugStream);
+					const TablePos cutPos(addPos.row + offsetAndSymbol.rowOff, addPos.col + offsetAndSymbol.colOff);
+					const TablePos pastePos(cutPos.row + offsetsPerDirection[dirIter][0], cutPos.col + offsetsPerDirection[dirIter][1]);
+					modifiedCells.push_back(BoardObject::ModifiedCell(cutPos.row * g_boardCols + cutPos.col, false));
+					if (isCoordinateValid(pastePos))
+						modifiedCells.push_back(BoardObject::ModifiedCell(pastePos.row * g_boardCols + pastePos.col, true));
 				}
+
+				flowBoundInDir[dirIter] = m_boardView->getFlowUpperBound(flowUpperBounds, modifiedCells);
+				posFlowBound = std::max(posFlowBound, flowBoundInDir[dirIter]);
+			}
+		}
+
+		// The language failures of the row and column through the position don't depend on the symbol either
+		BoardObject::PosLanguageCheck posLanguageCheck;
+		scratchBoard.preparePosLanguageCheck(addPos, posLanguageCheck);
+
+		// For each direction: -1 not checked yet, otherwise if the shifted subtree fits the free positions and the language out of the row and column of the position
+		int canShiftInDir[numDirs] = { -1, -1 };
+
+		for (int symbolIndex = 0; symbolIndex < numSymbols && posLanguageCheck.areOtherSegmentsCompliant; symbolIndex++)
+		{
+			const char symbolToAdd = g_allSymbolsSet[symbolIndex];
+			if (canSkipElasticCandidate(getElasticBenefitUpperBound(true, symbolToAdd, oldBenefitValue, posFlowBound), bestBenefitSoFar))
+				continue;
+
+			// If the board is complaint with the language for row and column with this symbol update internal links and compare against best result
+			if (scratchBoard.isSymbolCompliantAtPos(posLanguageCheck, symbolToAdd) == false)
+				continue;
+
+			scratchBoard.beginTransaction();
+			scratchBoard.onBeforeCellModified(addPos.row, addPos.col);
+			Cell& targetCell = scratchBoard(addPos.row, addPos.col);
+			targetCell.setEmpty();
+			targetCell.setSymbol(symbolToAdd);	// We already know from pos list if this cell is a valid one or not
+
+			ElasticCandidateEval* evalPerDir = &candidatesEval[(symbolIndex * numPositions + posIndex) * numDirs];
+
+			// Is the position close to a leaf actually ?
+			if (isAddPosFree)
+			{
+				scratchBoard.updateInternalCellsInfo();
+				elasticBoardCompare(scratchBoard, true, symbolToAdd, addPos, evalPerDir[0], currentAvgFlow, bestBenefitSoFar, outDebugStream);
 			}
 			else
 			{
-				// Horizontal shift (left side) and vertical shift (down)
-				constexpr int numDirs = 2;
-				int offsetsPerDirection[numDirs][2] = { {0,-1}, {1,0} }; // for each direction put the offsets of row/col
-
-				BoardObject baseBoard = *m_boardView;
-				SubtreeInfo subtree;
-				baseBoard.cutSubtree(addPos.row, addPos.col, subtree);
-				Cell& targetCell = baseBoard(addPos.row, addPos.col);
-				targetCell.setEmpty();
-				targetCell.setSymbol(symbolToAdd);
-
-				// Check compliance first
-				if (baseBoard.isCompliantWithRowColPatterns(addPos.row, addPos.col))
+				for (int dirIter = 0; dirIter < numDirs; dirIter++)
 				{
-					for (int dirIter = 0; dirIter < numDirs; dirIter++)
+					const TablePos newSubtreeRoot(addPos.row + offsetsPerDirection[dirIter][0], addPos.col + offsetsPerDirection[dirIter][1]);
+					if (canShiftInDir[dirIter] == -1)
 					{
-						BoardObject copyBoard = baseBoard;
-
-						const int offsetRow = offsetsPerDirection[dirIter][0];
-						const int offsetCol = offsetsPerDirection[dirIter][1];
-						TablePos newSubtreeRoot(addPos.row + offsetRow, addPos.col + offsetCol);
-						const bool res = copyBoard.tryApplySubtree(newSubtreeRoot.row, newSubtreeRoot.col, subtree, true, true);
-						if (res)
+						canShiftInDir[dirIter] = scratchBoard.canPasteSubtreeAtPos_noLangCheck(newSubtreeRoot.row, newSubtreeRoot.col, subtree) ? 1 : 0;
+						if (canShiftInDir[dirIter] == 1)
 						{
-							copyBoard.doDataFlowSimulation_serial(1);
-							copyBoard.getLastSimulationAvgDataFlowPerUnit();
-							elasticBoardCompare(copyBoard, true, symbolToAdd, addPos, bestResult, currentAvgFlow, outDebugStream);
+							scratchBoard.beginTransaction();
+							scratchBoard.tryApplySubtree(newSubtreeRoot.row, newSubtreeRoot.col, subtree, false, false);
+							canShiftInDir[dirIter] = scratchBoard.isCompliantWithRowColPatternsExcept(addPos.row, addPos.col) ? 1 : 0;
+							scratchBoard.rollbackTransaction();
 						}
 					}
+
+					if (canShiftInDir[dirIter] == 0 || canSkipElasticCandidate(getElasticBenefitUpperBound(true, symbolToAdd, oldBenefitValue, flowBoundInDir[dirIter]), bestBenefitSoFar))
+						continue;
+
+					// Only the row and column of the position are left to check for this symbol
+					scratchBoard.beginTransaction();
+					scratchBoard.tryApplySubtree(newSubtreeRoot.row, newSubtreeRoot.col, subtree, false, false);
+					if (scratchBoard.isCompliantWithRowColPatterns(addPos.row, addPos.col))
+					{
+						elasticBoardCompare(scratchBoard, true, symbolToAdd, addPos, evalPerDir[dirIter], currentAvgFlow, bestBenefitSoFar, outDebugStream);
+					}
+					scratchBoard.rollbackTransaction();
 				}
 			}
+
+			scratchBoard.rollbackTransaction();
+		}
+
+		scratchBoard.rollbackTransaction();
+	});
+
+	// Gather the results in the order of the symbols, positions and directions
+	ElasticResourceEval bestResult;
+	int bestCandidateIndex = INVALID_POS;
+	for (int candidateIndex = 0; candidateIndex < (int)candidatesEval.size(); candidateIndex++)
+	{
+		const ElasticCandidateEval& candidateEval = candidatesEval[candidateIndex];
+		if (candidateEval.isTried == false)
+			continue;
+
+		outDebugStream << candidateEval.debugLog;
+
+		const int symbolIndex = candidateIndex / (numPositions * numDirs);
+		const int posIndex = (candidateIndex / numDirs) % numPositions;
+		if (bestResult.augment(g_allSymbolsSet[symbolIndex], candidateEval.benefit, potentialAddPos[posIndex]))
+		{
+			bestCandidateIndex = candidateIndex;
 		}
 	}
 
@@ -809,8 +1120,31 @@ bool Cell::root_checkAddResources(std::ostream& outDebugStream)
 	// If the result is valid apply the optimal board and move on.
 	if (bestResult.isValid())
 	{
+		// Redo the best candidate on a copy of the board
+		const TablePos& addPos = bestResult.pos;
+		BoardObjectPool::BoardPtr bestBoardCopy = g_boardObjectPool.acquireCopy(*m_boardView);
+		BoardObject& bestBoard = *bestBoardCopy;
+		if (m_boardView->isPosFree(addPos))
+		{
+			bestBoard.onBeforeCellModified(addPos.row, addPos.col);
+			bestBoard(addPos.row, addPos.col).setEmpty();
+			bestBoard(addPos.row, addPos.col).setSymbol(bestResult.symbolAdded);
+		}
+		else
+		{
+			const int dirIter = bestCandidateIndex % numDirs;
+			SubtreeInfo subtree;
+			bestBoard.cutSubtree(addPos.row, addPos.col, subtree);
+			bestBoard.onBeforeCellModified(addPos.row, addPos.col);
+			bestBoard(addPos.row, addPos.col).setEmpty();
+			bestBoard(addPos.row, addPos.col).setSymbol(bestResult.symbolAdded);
+
+			const bool res = bestBoard.tryApplySubtree(addPos.row + offsetsPerDirection[dirIter][0], addPos.col + offsetsPerDirection[dirIter][1], subtree, true, true);
+			assert(res && "[Cell::root_checkAddResources] Couldn't redo the best candidate");
+		}
+
 		BoardObject* boardViewAddressCopy = m_boardView;	// This will be canceled after copyJustCells call
-		m_boardView->copyJustCells(*bestResult.bestBoard_onlySymbols);
+		m_boardView->copyJustCells(bestBoard);
 		assert(m_boardView == nullptr || m_boardView == boardViewAddressCopy);
 
 		m_boardView = boardViewAddressCopy;
@@ -823,6 +1157,27 @@ bool Cell::root_checkAddResources(std::ostream& outDebugStream)
 	return false;
 }
 
+// The subtrees below and on the left side of a rented resource, which can be shifted to its position when it's removed
+static int gatherSubtreesToShiftOnRemove(const BoardObject& board, const TablePos& rcPos, TablePos outSubtreesPos[2])
+{
+	int numValidSubtreesToShift = 0;
+	const TablePos subtreesAttempts[2] = {
+		TablePos(rcPos.row + 1, rcPos.col), // Down pos
+		TablePos(rcPos.row, rcPos.col - 1), // Left pos
+	};
+
+	for (const TablePos& subtreePos : subtreesAttempts)
+	{
+		// Check if there is something there and the coordinate is valid
+		if (isCoordinateValid(subtreePos) && board.isPosFree(subtreePos) == false)
+		{
+			outSubtreesPos[numValidSubtreesToShift++] = subtreePos;
+		}
+	}
+
+	return numValidSubtreesToShift;
+}
+
 bool Cell::root_checkRemoveResources(std::ostream& outDebugStream)
 {
 	// Debug stuff
@@ -832,68 +1187,107 @@ bool Cell::root_checkRemoveResources(std::ostream& outDebugStream)
 	}
 
 	assert(isRoot());
-	auto& rentedResources = m_boardView->m_rentedResources;
+	const std::vector<RentedResourceInfo> rentedResources(m_boardView->m_rentedResources.begin(), m_boardView->m_rentedResources.end());
 
 	// Find the current board's flow and benefit value
 	m_boardView->doDataFlowSimulation_serial(1);
 	const float currentAvgFlow = m_boardView->getLastSimulationAvgDataFlowPerUnit();
 	const float oldBenefitValue = currentAvgFlow * g_benefitPerUnitOfFlow;
 
-	ElasticResourceEval bestResult;
-	bestResult.bestBoard_onlySymbols = new ((BoardObject*)alloca(sizeof(BoardObject))) BoardObject();
-	for (auto it = rentedResources.begin(); it != rentedResources.end(); it++)
+	// The rented resources are tried in parallel like in root_checkAddResources, each removed once for all its shifts
+	constexpr int MAX_NUM_TRIES = 2;
+	const int numResources = (int)rentedResources.size();
+	std::vector<ElasticCandidateEval> candidatesEval(numResources * MAX_NUM_TRIES); // per (resource, shift)
+	std::atomic<float> bestBenefitSoFar(0.0f);
+
+	BoardObject::FlowUpperBounds flowUpperBounds;
+	m_boardView->computeFlowUpperBounds(flowUpperBounds);
+
+	ThreadScratchBoards scratchBoards(*m_boardView);
+
+	g_taskPool.parallelFor(numResources, [&](const int resourceIndex)
 	{
-		const RentedResourceInfo& rcRented = *it;
+		const RentedResourceInfo& rcRented = rentedResources[resourceIndex];
 		const TablePos& rcPos = rcRented.pos;
 
 		// If we have something below and on the left side we can shift those subtrees
 		// to the deleted rented position
-		constexpr int MAX_NUM_TRIES = 2;
-		int numValidSubtreesToShift = 0;
 		TablePos validSubtreesToShift[MAX_NUM_TRIES];
-		TablePos subtreesAttempts[MAX_NUM_TRIES] = {
-			TablePos(rcPos.row + 1, rcPos.col), // Down pos
-			TablePos(rcPos.row, rcPos.col - 1), // Left pos
-		};
+		const int numValidSubtreesToShift = gatherSubtreesToShiftOnRemove(*m_boardView, rcPos, validSubtreesToShift);
 
-		for (int attemptIter = 0; attemptIter < MAX_NUM_TRIES; attemptIter++)
+		// Without a subtree to shift only the position is emptied. The shifted subtrees are bounded once cut, before they are pasted and their links updated
+		std::vector<BoardObject::ModifiedCell> modifiedCells;
+		float resourceFlowBound = (float)g_maxFlowPerCell;
+		if (numValidSubtreesToShift == 0)
 		{
-			const TablePos& subtreePos = subtreesAttempts[attemptIter];
-
-			// Check if there is something there and the coordinate is valid
-			if (isCoordinateValid(subtreePos) && m_boardView->isPosFree(subtreePos) == false)
-			{
-				validSubtreesToShift[numValidSubtreesToShift++] = subtreePos;
-			}
+			modifiedCells.push_back(BoardObject::ModifiedCell(rcPos.row * g_boardCols + rcPos.col, false));
+			resourceFlowBound = m_boardView->getFlowUpperBound(flowUpperBounds, modifiedCells);
 		}
 
+		if (canSkipElasticCandidate(getElasticBenefitUpperBound(false, rcRented.symbol, oldBenefitValue, resourceFlowBound), bestBenefitSoFar))
+			return;
+
+		BoardObject& scratchBoard = scratchBoards.get();
+		scratchBoard.beginTransaction();
+		scratchBoard.onBeforeCellModified(rcPos.row, rcPos.col);
+		scratchBoard(rcPos.row, rcPos.col).setEmpty();
+		scratchBoard.updateInternalCellsInfo();
+
 		// Now bring the best subtree here (if any available). 
 		// Otherwise compare the benefit of the current configuration
+		ElasticCandidateEval* evalPerTry = &candidatesEval[resourceIndex * MAX_NUM_TRIES];
 		if (numValidSubtreesToShift > 0)
 		{
 			for (int validSubtreeIter = 0; validSubtreeIter < numValidSubtreesToShift; validSubtreeIter++)
 			{
 				const TablePos& subtreePos = validSubtreesToShift[validSubtreeIter];
 
-				BoardObject copyBoardBase = *m_boardView;
-				copyBoardBase(rcPos.row, rcPos.col).setEmpty();
-				copyBoardBase.updateInternalCellsInfo();
-
+				scratchBoard.beginTransaction();
 				SubtreeInfo outSubtree;
-				copyBoardBase.cutSubtree(subtreePos.row, subtreePos.col, outSubtree);
-				if (copyBoardBase.tryApplySubtree(rcPos.row, rcPos.col, outSubtree, true, true))
+				scratchBoard.cutSubtree(subtreePos.row, subtreePos.col, outSubtree);
+
+				modifiedCells.clear();
+				modifiedCells.push_back(BoardObject::ModifiedCell(rcPos.row * g_boardCols + rcPos.col, false));
+				for (const OffsetAndSymbol& offsetAndSymbol : outSubtree.m_offsets)
 				{
-					elasticBoardCompare(copyBoardBase, false, rcRented.symbol, rcPos, bestResult, currentAvgFlow, outDebugStream);
+					const TablePos cutPos(subtreePos.row + offsetAndSymbol.rowOff, subtreePos.col + offsetAndSymbol.colOff);
+					const TablePos pastePos(rcPos.row + offsetAndSymbol.rowOff, rcPos.col + offsetAndSymbol.colOff);
+					modifiedCells.push_back(BoardObject::ModifiedCell(cutPos.row * g_boardCols + cutPos.col, false));
+					if (isCoordinateValid(pastePos))
+						modifiedCells.push_back(BoardObject::ModifiedCell(pastePos.row * g_boardCols + pastePos.col, true));
 				}
+
+				if (!canSkipElasticCandidate(getElasticBenefitUpperBound(false, rcRented.symbol, oldBenefitValue, m_boardView->getFlowUpperBound(flowUpperBounds, modifiedCells)), bestBenefitSoFar)
+					&& scratchBoard.tryApplySubtree(rcPos.row, rcPos.col, outSubtree, true, true))
+				{
+					elasticBoardCompare(scratchBoard, false, rcRented.symbol, rcPos, evalPerTry[validSubtreeIter], currentAvgFlow, bestBenefitSoFar, outDebugStream);
+				}
+				scratchBoard.rollbackTransaction();
 			}
 		}
 		else
 		{
-			BoardObject copyBoardBase = *m_boardView;
-			copyBoardBase(rcPos.row, rcPos.col).setEmpty();
-			copyBoardBase.updateInternalCellsInfo();
+			elasticBoardCompare(scratchBoard, false, rcRented.symbol, rcPos, evalPerTry[0], currentAvgFlow, bestBenefitSoFar, outDebugStream);
+		}
+
+		scratchBoard.rollbackTransaction();
+	});
+
+	// Gather the results in the order of the rented resources
+	ElasticResourceEval bestResult;
+	int bestCandidateIndex = INVALID_POS;
+	for (int candidateIndex = 0; candidateIndex < (int)candidatesEval.size(); candidateIndex++)
+	{
+		const ElasticCandidateEval& candidateEval = candidatesEval[candidateIndex];
+		if (candidateEval.isTried == false)
+			continue;
 
-			elasticBoardCompare(copyBoardBase, false, rcRented.symbol, rcPos, bestResult, currentAvgFlow, outDebugStream);
+		outDebugStream << candidateEval.debugLog;
+
+		const RentedResourceInfo& rcRented = rentedResources[candidateIndex / MAX_NUM_TRIES];
+		if (bestResult.augment(rcRented.symbol, candidateEval.benefit, rcRented.pos))
+		{
+			bestCandidateIndex = candidateIndex;
 		}
 	}
 
@@ -907,10 +1301,28 @@ bool Cell::root_checkRemoveResources(std::ostream& outDebugStream)
 	// If the result is valid apply the optimal board and move on.
 	if (bestResult.isValid())
 	{
+		// Redo the best candidate on a copy of the board
+		const TablePos& rcPos = bestResult.pos;
+		BoardObjectPool::BoardPtr bestBoardCopy = g_boardObjectPool.acquireCopy(*m_boardView);
+		BoardObject& bestBoard = *bestBoardCopy;
+		bestBoard.onBeforeCellModified(rcPos.row, rcPos.col);
+		bestBoard(rcPos.row, rcPos.col).setEmpty();
+		bestBoard.updateInternalCellsInfo();
+
+		TablePos validSubtreesToShift[MAX_NUM_TRIES];
+		if (gatherSubtreesToShiftOnRemove(*m_boardView, rcPos, validSubtreesToShift) > 0)
+		{
+			const TablePos& subtreePos = validSubtreesToShift[bestCandidateIndex % MAX_NUM_TRIES];
+			SubtreeInfo outSubtree;
+			bestBoard.cutSubtree(subtreePos.row, subtreePos.col, outSubtree);
+			const bool res = bestBoard.tryApplySubtree(rcPos.row, rcPos.col, outSubtree, true, true);
+			assert(res && "[Cell::root_checkRemoveResources] Couldn't redo the best candidate");
+		}
+
 		m_boardView->removeRentedSource(bestResult.pos);
 
 		BoardObject* boardViewAddressCopy = m_boardView;	// This will be canceled after copyJustCells call
-		m_boardView->copyJustCells(*bestResult.bestBoard_onlySymbols);
+		m_boardView->copyJustCells(bestBoard);
 		m_boardView = boardViewAddressCopy;
 		m_boardView->updateInternalCellsInfo();
 
@@ -1042,16 +1454,17 @@ bool Cell::analyzeElasticModel(std::ostream& outDebugStream)
 	return (anyResourceAdded || anyResourceRemoved);
 }
 
-void ElasticResourceEval::augment(const BoardObject& copyBoard, const char _symbolAdded, const float _benefit, const TablePos& _pos)
+bool ElasticResourceEval::augment(const char _symbolAdded, const float _benefit, const TablePos& _pos)
 {
 	if (_benefit > benefit)
 	{
 		benefit = _benefit;
 		symbolAdded = _symbolAdded;
 		pos = _pos;
-
-		bestBoard_onlySymbols->copyJustCells(copyBoard);
+		return true;
 	}
+
+	return false;
 }
 
 std::ostream& operator <<(std::ostream& out, const ElasticResourceEval& data)
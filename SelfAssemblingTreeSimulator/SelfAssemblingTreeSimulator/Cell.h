@@ -6,11 +6,17 @@
 #include <iostream>
 #include <vector>
 #include <unordered_map>
+#include <memory>
+#include <algorithm>
 
 #define EMPTY_SYMBOL ' '
 
 struct BoardObject;
 struct SubtreeInfo;
+struct CheckpointCell;
+
+// Immutable board structure broadcasted by root and shared by all cells
+typedef std::shared_ptr<const BoardObject> BoardSnapshotPtr;
 
 ///////////////////////////////////////////////////////////////////////////////
 enum DIRECTION
@@ -31,7 +37,11 @@ DIRECTION getOppositeDirection(const DIRECTION dir);
 struct SimulationContext
 {
 	// For performance reasons, we currently cache before a simulation how much data flow each leaf node will capture
-	std::unordered_map<TablePos, float> mLeafNodeToCaptureValue;
+	// Indexed by row * g_boardCols + col. Cells that are not leaves have a negative value
+	std::vector<float> mLeafNodeToCaptureValue;
+
+	void resetLeafNodeCaptures();
+	void setLeafNodeCapture(const TablePos& leafPos, const float value);
 	bool getLeafNodeCapture(const TablePos& leafPos, float& outValue) const;
 };
 
@@ -84,6 +94,18 @@ public:
 		return copy;
 	}
 
+	int getMaxStats() const { return m_maxStats; }
+
+	// Used by board transactions to restore the records on rollback
+	void saveRecords(std::vector<float>& outRecords) const { outRecords.assign(m_flowPerTick, m_flowPerTick + m_head); }
+	void restoreRecords(const std::vector<float>& records) { restoreRecords(records.data(), (int)records.size()); }
+	void restoreRecords(const float* records, const int numRecords)
+	{
+		assert(numRecords <= m_maxStats);
+		std::copy(records, records + numRecords, m_flowPerTick);
+		m_head = numRecords;
+	}
+
 private:
 	float *m_flowPerTick;
 	int m_head; // head of current record
@@ -117,12 +139,19 @@ struct ElasticResourceEval {
 	bool isValid() const { return benefit > 0.0f; }
 	char symbolAdded = '#';
 	TablePos pos;
-	BoardObject* bestBoard_onlySymbols;	// Best board found but only with symbols on cells !!! You have to call the updateInternal stuff to create links and other data structures
-	void augment(const BoardObject& copyBoard, const char _symbolAdded, const float _benefit, const TablePos& _pos);
+	// Returns true if the given candidate is the new best one
+	bool augment(const char _symbolAdded, const float _benefit, const TablePos& _pos);
 
 	friend std::ostream& operator<<(std::ostream& out, const ElasticResourceEval& data);
 };
 
+// The result of trying one candidate of the elastic model. The candidates are tried in parallel and gathered in their serial order
+struct ElasticCandidateEval {
+	bool isTried = false;
+	float benefit = 0.0f;
+	std::string debugLog;
+};
+
 enum CellType
 {
 	CELL_NOTSET = 0x01,
@@ -182,7 +211,11 @@ struct Cell
 	CellType m_cellType = CELL_NOTSET;
 	//#endif
 
-	BoardObject* m_boardView; // This is broadcasted by root. I;m the owner of this, even if it's a pointer
+	BoardObject* m_boardView; // The board this cell lives on. Root works directly on it
+	BoardSnapshotPtr m_sharedBoardView; // The structure broadcasted by root. All cells that got the same broadcast share it
+
+	// The board as seen by this cell: the last broadcasted structure or, if none was received, the board it lives on
+	const BoardObject* getBoardView() const { return m_sharedBoardView ? m_sharedBoardView.get() : m_boardView; }
 
 	//bool m_isSource;	// True if this cell is actually a source
 	bool m_isEmpty;
@@ -205,6 +238,9 @@ struct Cell
 	void reset(const bool resetSymbolToo = true);
 	void resetLinks();
 
+	// Back to the state of a new cell, but keeping the flow statistics allocated for reuse
+	void resetAsNew();
+
 	bool isFree() const
 	{
 		assert(m_isEmpty == (m_symbol == EMPTY_SYMBOL));
@@ -287,11 +323,12 @@ struct Cell
 	*/
 
 	/// Messages simulation ------------------------
-	void onMsgBroadcastStructure(BoardObject* structure);
+	void onMsgBroadcastStructure(const BoardSnapshotPtr& structure);
 	void onRootMsgBroadcastStructure(BoardObject* structure);
 	void onMsgDiscoverStructure(int currRow, int currCol, int depth);
-	void onMsgReorganizeStart(std::vector<AvailablePosInfoAndDeltaScore>& output); // Called to reorganize the tree for better performance | On other nodes than root
-	bool onRootMsgReorganize(); // Called to reorganize the tree for better performance | Root only !
+	void onMsgReorganizeStart(std::vector<Cell*>& outParticipants); // Called to reorganize the tree for better performance | On other nodes than root. Gathers the subtree's cells, children first
+	bool onMsgReorganizeEvaluate(AvailablePosInfoAndDeltaScore& outBestOption, std::string& outLog) const; // Finds the best place to move this cell's subtree, if any | Can run on any thread
+	bool onRootMsgReorganize(AvailablePosInfoAndDeltaScore* outDecision = nullptr); // Called to reorganize the tree for better performance, gives the move decided if any | Root only !
 								// Returns false if there is another reorganization in progress - for simulator/simulation purpose
 								//----------------------------------------------
 
@@ -300,7 +337,8 @@ struct Cell
 	// Returns true if elastic model added/removed something
 	bool analyzeElasticModel(std::ostream& outDebugStream);
 
-	void initFlowStatistics(const int maxNumRecords) { m_flowStatistics = new DataFlowStatistics(maxNumRecords); }
+	// Reuses the statistics already allocated if they have the same size
+	void initFlowStatistics(const int maxNumRecords);
 	void addNewFlowRecord(const float value) { m_flowStatistics->addStat(value); }
 	void retractLastFlowRecord() { m_flowStatistics->removeLastValue(); }
 
@@ -309,6 +347,15 @@ struct Cell
 	// physical processes).
 	void simulateTick_serial(const SimulationContext& simContext);
 
+	// The part of simulateTick_serial done by this cell alone, once its children did their tick
+	void simulateCellTick_serial(const SimulationContext& simContext);
+
+	// Captures as much as it can from environment (if leaf) or from children if internal node
+	void captureDataFlow(const SimulationContext& simContext);
+
+	// The end of a cell tick, after the capture: the root uses the captured data
+	void endCellTick_serial();
+
 	float getAvgFlow() const { return m_flowStatistics->getAvgDataFlow(); }
 
 	float getRemainingCap() const;
@@ -350,6 +397,7 @@ struct Cell
 	void addData(const float _value, const bool _ignoreContraints = false) { m_bufferedData.add(_value, _ignoreContraints); }
 	void subtractData(const float _value) { m_bufferedData.subtract(_value); }
 	float getCurrentBufferedCap() const { return m_bufferedData.getCurrentCap(); }
+	void setBufferedData(const float _value) { m_bufferedData.set(_value); }
 	void resetCapacityUsedInSubtree();
 
 	void resetTicksToDelayDataFlowCapture() { m_remainingTicksToDelayDataFlowCapture = 0; }
@@ -364,12 +412,12 @@ struct Cell
 	{
 		UniversalHash2D() { reset(); }
 
-		bool cellsHash[MAX_ROWS][MAX_COLS];
+		std::vector<bool> cellsHash; // Indexed by row * g_boardCols + col
 
 		bool isCellSet(const TablePos& pos) const { assert(isCoordinateValid(pos)); return isCellSet(pos.row, pos.col); }
-		bool isCellSet(const int row, const int col) const { assert(isCoordinateValid(row, col)); return cellsHash[row][col]; }
+		bool isCellSet(const int row, const int col) const { assert(isCoordinateValid(row, col)); return cellsHash[row * g_boardCols + col]; }
 		void setCell(const TablePos& pos) { setCell(pos.row, pos.col); }
-		void setCell(const int row, const int col) { assert(isCoordinateValid(row, col)); cellsHash[row][col] = true; }
+		void setCell(const int row, const int col) { assert(isCoordinateValid(row, col)); cellsHash[row * g_boardCols + col] = true; }
 		void reset();
 	};
 
@@ -377,16 +425,50 @@ struct Cell
 	// This records the flow statistics when requested, on the root only
 	DataFlowStatistics* m_flowStatistics;
 
-private:
+	// The state of a cell as saved by a board transaction before modifying it. See BoardObject::beginTransaction
+	struct SavedState
+	{
+		char symbol;
+		uint distanceToRoot;
+		Cell* followers[DIR_COUNT];
+		Cell* previous[DIR_COUNT];
+#if RUNMODE != DIRECTIONAL_MODE
+		Cell* parent;
+#endif
+		CellType cellType;
+		BoardObject* boardView;
+		BoardSnapshotPtr sharedBoardView;
+		bool isEmpty;
+		int row, column;
+		bool isRented;
+		DataFlowStatistics* flowStatistics;
+		int remainingTicksToDelayDataFlowCapture;
+		float bufferedData;
+#if RUNMODE == DIRECTIONAL_MODE
+		float lastEnergyConsumedStat;
+#endif
+		uint journalStamp;
+	};
 
-	void gatherNewResourcesPos(Cell* cell, std::vector<TablePos>& outPositions, UniversalHash2D& hash);
+	void saveState(SavedState& outState) const;
+	void restoreState(const SavedState& state);
 
+	// True if the saved state has the same links and position as the cell
+	bool hasSameLinks(const SavedState& state) const;
 
-	// Captures as much as it can from environment (if leaf) or from children if internal node
-	void captureDataFlow(const SimulationContext& simContext);
+	// The state of the cell kept in a checkpoint, besides the links which are rebuilt from the symbols. The flow records are appended to outFlowStats
+	void saveCheckpoint(CheckpointCell& outRecord, std::vector<float>& outFlowStats) const;
+	void loadCheckpoint(const CheckpointCell& record, const float* flowStats);
+
+	// The last board transaction that saved this cell, such that a cell is saved only once per transaction
+	uint m_journalStamp = 0;
+
+private:
+
+	void gatherNewResourcesPos(Cell* cell, std::vector<TablePos>& outPositions, UniversalHash2D& hash);
 
-	void elasticBoardCompare(BoardObject& copyBoard, const bool isResourceAdded, const char symbolOfResource, const TablePos& resourcePos, ElasticResourceEval& outResult,
-		const float oldBenefitValue, std::ostream& outDebugStream);
+	void elasticBoardCompare(BoardObject& copyBoard, const bool isResourceAdded, const char symbolOfResource, const TablePos& resourcePos, ElasticCandidateEval& outEval,
+		const float oldAvgFlow, std::atomic<float>& bestBenefitSoFar, const std::ostream& debugStreamFormat);
 
 
 	// How many ticks is data capture disabled for this node because this is a root of a subtree changing its position
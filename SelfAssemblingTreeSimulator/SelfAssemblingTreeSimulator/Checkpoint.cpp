@@ -0,0 +1,191 @@
+#include "Checkpoint.h"
+#include <fstream>
+#include <cstring>
+#include <cassert>
+#include <cstdio>
+#include <string>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <io.h>
+#include <share.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+static const char CHECKPOINT_MAGIC[8] = { 'A', 'G', 'P', 'C', 'K', 'P', 'T', '\0' };
+
+static uint64_t alignOffset(const uint64_t offset)
+{
+	return (offset + 7) & ~(uint64_t)7;
+}
+
+CheckpointWriter::CheckpointWriter()
+{
+	memset(&m_header, 0, sizeof(m_header));
+	memcpy(m_header.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+	m_header.version = CHECKPOINT_VERSION;
+	m_header.byteOrderMark = CHECKPOINT_BYTE_ORDER_MARK;
+	m_header.headerSize = sizeof(CheckpointHeader);
+}
+
+bool CheckpointWriter::writeToFile(const char* fileName)
+{
+	uint64_t offset = alignOffset(sizeof(CheckpointHeader));
+	for (int board = 0; board < CHECKPOINT_NUM_BOARDS; board++)
+	{
+		for (int section = 0; section < CHECKPOINT_NUM_SECTIONS; section++)
+		{
+			m_header.boards[board].sections[section].offset = offset;
+			offset = alignOffset(offset + m_sectionsData[board][section].size());
+		}
+	}
+	m_header.fileSize = offset;
+
+	const std::string tempFileName = std::string(fileName) + ".tmp";
+	std::ofstream outFile(tempFileName.c_str(), std::ios::binary | std::ios::trunc);
+	if (!outFile.is_open())
+	{
+		assert(false && "The given checkpoint file can't be opened for writing !");
+		return false;
+	}
+
+	static const char zeros[8] = {};
+	outFile.write(reinterpret_cast<const char*>(&m_header), sizeof(m_header));
+	uint64_t written = sizeof(m_header);
+	for (int board = 0; board < CHECKPOINT_NUM_BOARDS; board++)
+	{
+		for (int section = 0; section < CHECKPOINT_NUM_SECTIONS; section++)
+		{
+			const std::vector<char>& data = m_sectionsData[board][section];
+			const uint64_t offset = m_header.boards[board].sections[section].offset;
+			outFile.write(zeros, (std::streamsize)(offset - written));
+			outFile.write(data.data(), (std::streamsize)data.size());
+			written = offset + data.size();
+		}
+	}
+	outFile.write(zeros, (std::streamsize)(m_header.fileSize - written));
+	outFile.close();
+	if (!outFile.good())
+		return false;
+
+#ifdef _WIN32
+	std::remove(fileName); // rename doesn't replace an existing file on Windows
+#endif
+	return std::rename(tempFileName.c_str(), fileName) == 0;
+}
+
+bool CheckpointReader::open(const char* fileName)
+{
+	close();
+
+#ifdef _WIN32
+	HANDLE fileHandle = CreateFileA(fileName, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (fileHandle == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER fileSize;
+	HANDLE mappingHandle = GetFileSizeEx(fileHandle, &fileSize) && fileSize.QuadPart > 0 ? CreateFileMappingA(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr) : nullptr;
+	const void* data = mappingHandle ? MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0) : nullptr;
+	m_fileHandle = fileHandle;
+	m_mappingHandle = mappingHandle;
+	if (data == nullptr)
+	{
+		close();
+		return false;
+	}
+	m_size = (size_t)fileSize.QuadPart;
+#else
+	const int fileDesc = ::open(fileName, O_RDONLY);
+	if (fileDesc < 0)
+		return false;
+
+	struct stat fileStat;
+	void* data = fstat(fileDesc, &fileStat) == 0 && fileStat.st_size > 0 ? mmap(nullptr, (size_t)fileStat.st_size, PROT_READ, MAP_PRIVATE, fileDesc, 0) : MAP_FAILED;
+	::close(fileDesc); // The mapping keeps the file
+	if (data == MAP_FAILED)
+		return false;
+	m_size = (size_t)fileStat.st_size;
+#endif
+
+	m_data = static_cast<const char*>(data);
+	if (!isValid())
+	{
+		close();
+		return false;
+	}
+
+	return true;
+}
+
+void CheckpointReader::close()
+{
+#ifdef _WIN32
+	if (m_data)
+		UnmapViewOfFile(m_data);
+	if (m_mappingHandle)
+		CloseHandle(m_mappingHandle);
+	if (m_fileHandle)
+		CloseHandle(m_fileHandle);
+	m_fileHandle = m_mappingHandle = nullptr;
+#else
+	if (m_data)
+		munmap(const_cast<char*>(m_data), m_size);
+#endif
+
+	m_data = nullptr;
+	m_size = 0;
+}
+
+bool CheckpointReader::isCheckpointFile(const char* fileName)
+{
+	std::ifstream inFile(fileName, std::ios::binary);
+	char magic[sizeof(CHECKPOINT_MAGIC)] = {};
+	inFile.read(magic, sizeof(magic));
+	return inFile.good() && memcmp(magic, CHECKPOINT_MAGIC, sizeof(magic)) == 0;
+}
+
+bool CheckpointReader::isValid() const
+{
+	if (m_size < sizeof(CheckpointHeader))
+		return false;
+
+	const CheckpointHeader& header = getHeader();
+	if (memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC)) != 0 || header.version != CHECKPOINT_VERSION
+		|| header.byteOrderMark != CHECKPOINT_BYTE_ORDER_MARK || header.headerSize != sizeof(CheckpointHeader) || header.fileSize != m_size)
+	{
+		return false;
+	}
+
+	for (int board = 0; board < CHECKPOINT_NUM_BOARDS; board++)
+	{
+		for (int section = 0; section < CHECKPOINT_NUM_SECTIONS; section++)
+		{
+			const CheckpointSectionInfo& info = header.boards[board].sections[section];
+			if (info.offset % 8 != 0 || info.offset > m_size || (uint64_t)info.numRecords * info.recordSize > m_size - info.offset)
+				return false;
+		}
+	}
+
+	return header.boards[CHECKPOINT_BOARD].isSaved != 0;
+}
+
+bool truncateFile(const char* fileName, const uint64_t size)
+{
+#ifdef _WIN32
+	int fileDesc = -1;
+	if (_sopen_s(&fileDesc, fileName, _O_RDWR | _O_BINARY, _SH_DENYNO, _S_IREAD | _S_IWRITE) != 0)
+		return false;
+
+	const bool isTruncated = _chsize_s(fileDesc, (__int64)size) == 0;
+	_close(fileDesc);
+	return isTruncated;
+#else
+	return truncate(fileName, (off_t)size) == 0;
+#endif
+}
@@ -0,0 +1,201 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// Binary checkpoint of the simulator: the board with all the cells' state, the root, the sources, the rented and garbage collected resources,
+// the pending subtree cut and the random stream of the main thread. The snapshot last broadcasted to the cells is saved as a second board,
+// since the cells evaluate their moves on it.
+// The file is a header followed by arrays of fixed size records, at the 8 bytes aligned offsets given in the header, in the native byte order.
+// It's loaded by mapping the file in memory and reading the records in place, without parsing.
+// Any change to the records must increase CHECKPOINT_VERSION: files of other versions are refused
+#define CHECKPOINT_VERSION 3
+
+enum CheckpointBoard
+{
+	CHECKPOINT_BOARD,
+	CHECKPOINT_BROADCAST_VIEW, // Shares the sources of CHECKPOINT_BOARD
+	CHECKPOINT_NUM_BOARDS,
+};
+
+enum CheckpointSection
+{
+	CHECKPOINT_CELLS,
+	CHECKPOINT_FLOW_STATS, // The flow records of all the cells, in the order of the cells
+	CHECKPOINT_SOURCES,
+	CHECKPOINT_RENTED_RESOURCES,
+	CHECKPOINT_GARBAGE_COLLECTED,
+	CHECKPOINT_SUBTREE_CUT, // The offsets of the pending subtree cut
+	CHECKPOINT_NUM_SECTIONS,
+};
+
+struct CheckpointSectionInfo
+{
+	uint64_t offset;
+	uint32_t numRecords;
+	uint32_t recordSize;
+};
+
+struct CheckpointCell
+{
+	char symbol;
+	uint8_t cellType;
+	uint8_t isRented;
+	uint8_t usesBroadcastView; // The cell's view of the board is CHECKPOINT_BROADCAST_VIEW
+	int32_t remainingTicksToDelayDataFlowCapture;
+	float bufferedData;
+	float lastEnergyConsumedStat; // Directional mode only
+	int32_t maxFlowStats; // 0 if the cell has no flow statistics
+	int32_t numFlowStats;
+};
+
+struct CheckpointSource
+{
+	int32_t row, col;
+	float power;
+	float target;
+};
+
+struct CheckpointRentedResource
+{
+	int32_t row, col;
+	char symbol;
+	char padding[3];
+};
+
+struct CheckpointGarbageCollected
+{
+	char symbol;
+	char padding[3];
+	int32_t count;
+};
+
+struct CheckpointSubtreeOffset
+{
+	int32_t rowOff, colOff;
+	char symbol;
+	uint8_t isRented;
+	char padding[2];
+};
+
+struct CheckpointBoardInfo
+{
+	CheckpointSectionInfo sections[CHECKPOINT_NUM_SECTIONS];
+
+	int32_t isSaved;
+	int32_t numRows, numCols;
+	int32_t rootRow, rootCol;
+	int32_t numTicksRemainingToUpdateSources;
+	int32_t remainingTicksUntilApplyCutSubtree;
+	int32_t useTicksToDelayDataFlowCapture;
+	int32_t isSubtreeCut;
+	int32_t subtreeCutSelectedRow, subtreeCutSelectedCol;
+	int32_t subtreeCutTargetRow, subtreeCutTargetCol;
+	float subtreeCutScore;
+	int32_t subtreeCutMinRowOffset, subtreeCutMaxRowOffset;
+	int32_t subtreeCutMinColOffset, subtreeCutMaxColOffset;
+};
+
+struct CheckpointHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t byteOrderMark; // CHECKPOINT_BYTE_ORDER_MARK as written by the machine that saved it
+	uint32_t headerSize;
+	uint32_t padding;
+	uint64_t fileSize;
+
+	CheckpointBoardInfo boards[CHECKPOINT_NUM_BOARDS];
+
+	// Simulator
+	int32_t sunRow, sunCol;
+	uint64_t randomSeed;
+	uint64_t randomCounter;
+
+	// Auto simulation: the step to continue from and the size of its output files at that step
+	int32_t autoSimulateNextStep;
+	uint32_t padding2;
+	uint64_t autoSimulateResultsOffset;
+	uint64_t autoSimulateCSVOffset;
+	uint64_t autoSimulateFramesOffset;
+};
+
+#define CHECKPOINT_BYTE_ORDER_MARK 0x01020304
+
+// Gathers the header and the sections of a checkpoint, then writes them to a file
+class CheckpointWriter
+{
+public:
+	CheckpointWriter();
+
+	CheckpointHeader& getHeader() { return m_header; }
+
+	template <typename T>
+	void setSection(const CheckpointBoard board, const CheckpointSection section, const std::vector<T>& records)
+	{
+		CheckpointSectionInfo& info = m_header.boards[board].sections[section];
+		info.numRecords = (uint32_t)records.size();
+		info.recordSize = (uint32_t)sizeof(T);
+		const char* data = reinterpret_cast<const char*>(records.data());
+		m_sectionsData[board][section].assign(data, data + records.size() * sizeof(T));
+	}
+
+	// Fills the offsets and the size in the header and writes the file.
+	// The file is written under a temporary name then renamed, so a crash while writing leaves the previous file intact
+	bool writeToFile(const char* fileName);
+
+private:
+	CheckpointHeader m_header;
+	std::vector<char> m_sectionsData[CHECKPOINT_NUM_BOARDS][CHECKPOINT_NUM_SECTIONS];
+};
+
+// A checkpoint file mapped in memory, read only. The records are read in place from the mapping, which lives as long as the reader
+class CheckpointReader
+{
+public:
+	CheckpointReader() = default;
+	~CheckpointReader() { close(); }
+
+	// Returns false if the file can't be mapped or isn't a valid checkpoint of this version
+	bool open(const char* fileName);
+	void close();
+
+	// True if the file starts like a checkpoint, whatever its version
+	static bool isCheckpointFile(const char* fileName);
+
+	const CheckpointHeader& getHeader() const { return *reinterpret_cast<const CheckpointHeader*>(m_data); }
+
+	template <typename T>
+	const T* getSection(const CheckpointBoard board, const CheckpointSection section, int& outNumRecords) const
+	{
+		const CheckpointSectionInfo& info = getHeader().boards[board].sections[section];
+		if (info.recordSize != sizeof(T))
+		{
+			outNumRecords = 0;
+			return nullptr;
+		}
+
+		outNumRecords = (int)info.numRecords;
+		return reinterpret_cast<const T*>(m_data + info.offset);
+	}
+
+private:
+	CheckpointReader(const CheckpointReader& other) = delete;
+	void operator=(const CheckpointReader& other) = delete;
+
+	bool isValid() const;
+
+	const char* m_data = nullptr;
+	size_t m_size = 0;
+#ifdef _WIN32
+	void* m_fileHandle = nullptr;
+	void* m_mappingHandle = nullptr;
+#endif
+};
+
+// Cuts a file back to the given size, e.g. an output file to its size at a checkpoint, so what was written after it is dropped
+bool truncateFile(const char* fileName, const uint64_t size);
+
+#endif
@@ -0,0 +1,44 @@
+#include "EvaluationCache.h"
+
+EvaluationCache g_evaluationCache;
+
+void EvaluationCache::init(const int numEntries)
+{
+	m_entries.assign(numEntries > 0 ? numEntries : 0, Entry());
+	m_numHits = 0;
+	m_numMisses = 0;
+}
+
+bool EvaluationCache::find(const uint64_t key, float& outDataFlow)
+{
+	if (m_entries.empty())
+		return false;
+
+	const size_t entryIndex = key % m_entries.size();
+	{
+		std::lock_guard<std::mutex> lock(m_locks[entryIndex % NUM_LOCKS]);
+		const Entry& entry = m_entries[entryIndex];
+		if (entry.isValid && entry.key == key)
+		{
+			outDataFlow = entry.dataFlow;
+			m_numHits++;
+			return true;
+		}
+	}
+
+	m_numMisses++;
+	return false;
+}
+
+void EvaluationCache::insert(const uint64_t key, const float dataFlow)
+{
+	if (m_entries.empty())
+		return;
+
+	const size_t entryIndex = key % m_entries.size();
+	std::lock_guard<std::mutex> lock(m_locks[entryIndex % NUM_LOCKS]);
+	Entry& entry = m_entries[entryIndex];
+	entry.key = key;
+	entry.dataFlow = dataFlow;
+	entry.isValid = true;
+}
@@ -0,0 +1,48 @@
+#ifndef EVALUATION_CACHE_H
+#define EVALUATION_CACHE_H
+
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+
+// A bounded cache of board evaluations (the average flow of a simulated tick), keyed by BoardObject::getEvaluationKey.
+// Like a transposition table, each key has a single slot (key modulo the size) and a new evaluation replaces the one in its slot.
+// It can be used from any thread: each lock guards the slots with the same index modulo NUM_LOCKS
+class EvaluationCache
+{
+public:
+	EvaluationCache() = default;
+
+	// Allocates numEntries slots, all empty. 0 disables the cache
+	void init(const int numEntries);
+
+	// Returns false if there is no evaluation for this key
+	bool find(const uint64_t key, float& outDataFlow);
+	void insert(const uint64_t key, const float dataFlow);
+
+	uint64_t getNumHits() const { return m_numHits; }
+	uint64_t getNumMisses() const { return m_numMisses; }
+
+private:
+	EvaluationCache(const EvaluationCache& other) = delete;
+	void operator=(const EvaluationCache& other) = delete;
+
+	struct Entry
+	{
+		uint64_t key = 0;
+		float dataFlow = 0.0f;
+		bool isValid = false;
+	};
+
+	static const int NUM_LOCKS = 64;
+
+	std::vector<Entry> m_entries;
+	std::mutex m_locks[NUM_LOCKS];
+	std::atomic<uint64_t> m_numHits{ 0 };
+	std::atomic<uint64_t> m_numMisses{ 0 };
+};
+
+extern EvaluationCache g_evaluationCache;
+
+#endif
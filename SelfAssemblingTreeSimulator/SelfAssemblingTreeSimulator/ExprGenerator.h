@@ -6,6 +6,7 @@
 #include <assert.h>
 #include "Utils.h"
 #include <algorithm>
+#include <map>
 
 // Result def of a matching operation
 struct ExprMatchResult
@@ -869,4 +870,248 @@ private:
 	unsigned int amount;
 };
 
+// Deterministic automaton compiled once from a row / column expression, to check the board language without std::regex.
+// Supports symbols, grouping and the |, *, + and ? operators, with the same full match semantic as std::regex_match.
+// Matching is table driven: one lookup per symbol and no allocation.
+class Expression_DFA
+{
+public:
+	enum
+	{
+		DEAD_STATE = 0, // Nothing can be matched anymore from this state
+		NUM_SYMBOLS = 256,
+	};
+
+	Expression_DFA() { compile(""); }
+
+	// Returns false if the expression is malformed. The automaton then matches nothing
+	bool compile(const std::string& expression)
+	{
+		m_nfa.clear();
+		m_expression = &expression;
+		m_parsePos = 0;
+
+		const NFAFragment fragment = parseAlternation();
+		const bool isValid = m_parsePos == expression.size();
+		if (!isValid)
+		{
+			assert(false && "invalid expression for the language checker");
+		}
+
+		buildDFA(fragment, isValid);
+
+		m_nfa.clear();
+		m_expression = nullptr;
+		return isValid;
+	}
+
+	int getStartState() const { return m_startState; }
+	int getNextState(const int state, const char symbol) const { return m_transitions[state * NUM_SYMBOLS + (unsigned char)symbol]; }
+	bool isAccepting(const int state) const { return m_isAccepting[state]; }
+
+	bool match(const char* str, const int len) const
+	{
+		int state = m_startState;
+		for (int i = 0; i < len && state != DEAD_STATE; i++)
+			state = getNextState(state, str[i]);
+
+		return isAccepting(state);
+	}
+
+private:
+
+	// Thompson construction: each state has either a single symbol transition or some epsilon transitions
+	struct NFAState
+	{
+		int symbol = -1; // -1 if only epsilon transitions
+		int symbolTarget = -1;
+		std::vector<int> epsilonTargets;
+	};
+
+	struct NFAFragment
+	{
+		int start, end;
+	};
+
+	int addNFAState()
+	{
+		m_nfa.emplace_back();
+		return (int)m_nfa.size() - 1;
+	}
+
+	bool isParseEnd() const { return m_parsePos >= m_expression->size(); }
+	char peekChar() const { return (*m_expression)[m_parsePos]; }
+
+	NFAFragment parseAlternation()
+	{
+		NFAFragment result = parseConcatenation();
+		while (!isParseEnd() && peekChar() == '|')
+		{
+			m_parsePos++;
+			const NFAFragment right = parseConcatenation();
+
+			NFAFragment alternation;
+			alternation.start = addNFAState();
+			alternation.end = addNFAState();
+			m_nfa[alternation.start].epsilonTargets.push_back(result.start);
+			m_nfa[alternation.start].epsilonTargets.push_back(right.start);
+			m_nfa[result.end].epsilonTargets.push_back(alternation.end);
+			m_nfa[right.end].epsilonTargets.push_back(alternation.end);
+			result = alternation;
+		}
+
+		return result;
+	}
+
+	NFAFragment parseConcatenation()
+	{
+		NFAFragment result;
+		result.start = result.end = addNFAState();
+		while (!isParseEnd() && peekChar() != '|' && peekChar() != ')')
+		{
+			const NFAFragment next = parseRepetition();
+			m_nfa[result.end].epsilonTargets.push_back(next.start);
+			result.end = next.end;
+		}
+
+		return result;
+	}
+
+	NFAFragment parseRepetition()
+	{
+		NFAFragment result = parseAtom();
+		while (!isParseEnd() && (peekChar() == '*' || peekChar() == '+' || peekChar() == '?'))
+		{
+			const char op = peekChar();
+			m_parsePos++;
+
+			NFAFragment repetition;
+			repetition.start = addNFAState();
+			repetition.end = addNFAState();
+			m_nfa[repetition.start].epsilonTargets.push_back(result.start);
+			m_nfa[result.end].epsilonTargets.push_back(repetition.end);
+
+			if (op != '+')
+				m_nfa[repetition.start].epsilonTargets.push_back(repetition.end); // Can be skipped
+
+			if (op != '?')
+				m_nfa[result.end].epsilonTargets.push_back(result.start); // Can be repeated
+
+			result = repetition;
+		}
+
+		return result;
+	}
+
+	NFAFragment parseAtom()
+	{
+		if (isParseEnd())
+		{
+			return parseConcatenation(); // Empty, the caller reports the error
+		}
+
+		const char c = peekChar();
+		if (c == '(')
+		{
+			m_parsePos++;
+			const NFAFragment inner = parseAlternation();
+			if (isParseEnd() || peekChar() != ')')
+			{
+				m_parsePos = m_expression->size() + 1; // Unbalanced paranthesis
+				return inner;
+			}
+
+			m_parsePos++;
+			return inner;
+		}
+		else if (c == '*' || c == '+' || c == '?')
+		{
+			m_parsePos = m_expression->size() + 1; // Nothing to repeat
+			return parseConcatenation();
+		}
+
+		m_parsePos++;
+		NFAFragment symbolFragment;
+		symbolFragment.start = addNFAState();
+		symbolFragment.end = addNFAState();
+		m_nfa[symbolFragment.start].symbol = (unsigned char)c;
+		m_nfa[symbolFragment.start].symbolTarget = symbolFragment.end;
+		return symbolFragment;
+	}
+
+	void addEpsilonClosure(const int nfaState, std::vector<bool>& inSet, std::vector<int>& outSet) const
+	{
+		if (inSet[nfaState])
+			return;
+
+		inSet[nfaState] = true;
+		outSet.push_back(nfaState);
+		for (const int target : m_nfa[nfaState].epsilonTargets)
+			addEpsilonClosure(target, inSet, outSet);
+	}
+
+	// Subset construction. The DFA states are the epsilon closed sets of NFA states
+	void buildDFA(const NFAFragment& fragment, const bool isValid)
+	{
+		m_transitions.assign(NUM_SYMBOLS, DEAD_STATE);
+		m_isAccepting.assign(1, false);
+		m_startState = DEAD_STATE;
+		if (!isValid)
+			return;
+
+		std::map<std::vector<int>, int> setToDFAState;
+		std::vector<std::vector<int>> dfaStateToSet;
+
+		auto getOrAddDFAState = [&](std::vector<int>& nfaSet) -> int
+		{
+			std::sort(nfaSet.begin(), nfaSet.end());
+			auto it = setToDFAState.find(nfaSet);
+			if (it != setToDFAState.end())
+				return it->second;
+
+			const int newState = (int)dfaStateToSet.size() + 1; // 0 is the dead state
+			setToDFAState.insert(std::make_pair(nfaSet, newState));
+			dfaStateToSet.push_back(nfaSet);
+
+			m_transitions.resize((newState + 1) * NUM_SYMBOLS, DEAD_STATE);
+			m_isAccepting.push_back(std::find(nfaSet.begin(), nfaSet.end(), fragment.end) != nfaSet.end());
+			return newState;
+		};
+
+		std::vector<bool> inSet(m_nfa.size(), false);
+		std::vector<int> closure;
+		addEpsilonClosure(fragment.start, inSet, closure);
+		m_startState = getOrAddDFAState(closure);
+
+		for (int dfaState = 1; dfaState <= (int)dfaStateToSet.size(); dfaState++)
+		{
+			for (int symbol = 0; symbol < NUM_SYMBOLS; symbol++)
+			{
+				inSet.assign(m_nfa.size(), false);
+				closure.clear();
+				for (const int nfaState : dfaStateToSet[dfaState - 1])
+				{
+					if (m_nfa[nfaState].symbol == symbol)
+						addEpsilonClosure(m_nfa[nfaState].symbolTarget, inSet, closure);
+				}
+
+				if (!closure.empty())
+				{
+					const int target = getOrAddDFAState(closure);
+					m_transitions[dfaState * NUM_SYMBOLS + symbol] = target;
+				}
+			}
+		}
+	}
+
+	std::vector<int> m_transitions; // m_transitions[state * NUM_SYMBOLS + symbol] = next state
+	std::vector<bool> m_isAccepting;
+	int m_startState = DEAD_STATE;
+
+	// Used only while compiling
+	std::vector<NFAState> m_nfa;
+	const std::string* m_expression = nullptr;
+	size_t m_parsePos = 0;
+};
+
 #endif
@@ -1,8 +1,14 @@
 #include "SimulatorBoard.h"
+#include "TaskPool.h"
+#include "Trace.h"
 #include <fstream>
 #include <float.h>
 #include <sstream>
 #include <random>
+#include <algorithm>
+#include <cctype>
+#include <mutex>
+#include <cstdio>
 
 using namespace std;
 
@@ -19,18 +25,25 @@ extern int g_247eModelRootCol;
 extern int g_247eModelRootRow;
 
 extern int g_useEModel;
-extern int FIXED_SEED;
 std::vector<char> g_allSymbolsSet;
 extern float g_costPerResource[];
-extern std::ostream* g_debugLogOutput;
+extern thread_local std::ostream* g_debugLogOutput;
 
 extern double g_variationDistribution;
 extern int g_numberOfTicksOnDay;
 extern bool g_outputCSVFileBestSourcesInTime;
 extern bool g_debugSourceEventAutosimulator;
+extern int g_autoSimulateCheckpointInterval;
+extern const char* g_autoSimulateCheckpointFile;
+extern bool g_resumeAutoSimulate;
+extern bool g_autoSimulateTrace;
+extern const char* g_autoSimulateTraceFile;
+extern bool g_boardFrames;
+extern const char* g_boardFramesFile;
+extern int g_boardFramesKeyframeInterval;
 
 // Returns a float between 0 & 1
-#define RANDOM_NUM      ((float)rand()/(RAND_MAX+1))
+#define RANDOM_NUM      ((float)randInt()/(RAND_INT_MAX+1.0f))
 
 Simulator::Simulator(const std::string rowExpr, std::string columnExpr, const int speedOnConduct)
 	: m_speedOnConduct(speedOnConduct)
@@ -63,9 +76,9 @@ bool Simulator::saveBoard(const char* fileNameToSave)
 		return false;
 	}
 
-	for (uint i = 0; i < MAX_ROWS; i++)
+	for (int i = 0; i < g_boardRows; i++)
 	{
-		for (uint j = 0; j < MAX_COLS; j++)
+		for (int j = 0; j < g_boardCols; j++)
 		{
 			if (m_board(i, j).isFree())
 			{
@@ -80,11 +93,12 @@ bool Simulator::saveBoard(const char* fileNameToSave)
 		outFile << std::endl;
 	}
 
-	outFile << m_board.m_posToSourceMap.size() << endl;
-	for (auto& it : m_board.m_posToSourceMap)
+	const SourcesTable& sources = m_board.getSources();
+	outFile << sources.getNumSources() << endl;
+	for (int srcIndex = 0; srcIndex < sources.getNumSources(); srcIndex++)
 	{
-		const TablePos& pos = it.first;
-		const SourceInfo& srcInfo = it.second;
+		const TablePos& pos = sources.getPos(srcIndex);
+		const SourceInfo srcInfo = sources.getInfo(srcIndex);
 
 		outFile << pos.row << " " << pos.col << " " << srcInfo.getPower() << endl;
 	}
@@ -93,6 +107,58 @@ bool Simulator::saveBoard(const char* fileNameToSave)
 	return true;
 }
 
+bool Simulator::saveCheckpoint(const char* fileNameToSave, const AutoSimulateProgress& progress)
+{
+	CheckpointWriter writer;
+	m_board.saveCheckpoint(writer);
+
+	CheckpointHeader& header = writer.getHeader();
+	header.sunRow = m_sunPos.row;
+	header.sunCol = m_sunPos.col;
+	getRandomState(header.randomSeed, header.randomCounter);
+	header.autoSimulateNextStep = progress.nextStep;
+	header.autoSimulateResultsOffset = progress.resultsFileOffset;
+	header.autoSimulateCSVOffset = progress.csvFileOffset;
+	header.autoSimulateFramesOffset = progress.framesFileOffset;
+
+	return writer.writeToFile(fileNameToSave);
+}
+
+bool Simulator::loadCheckpoint(const char* fileToLoadFrom, AutoSimulateProgress* outProgress)
+{
+	CheckpointReader reader;
+	if (!reader.open(fileToLoadFrom))
+	{
+		assert(false && "The given checkpoint can't be opened or was saved by a different version !");
+		return false;
+	}
+
+	m_board.setRowAndColGenerators(&m_rowGenerator, &m_colGenerator);
+	if (!m_board.loadCheckpoint(reader))
+		return false;
+
+	m_root = m_board.getRootCell();
+	if (g_useEModel)
+	{
+		g_247eModelRootRow = m_root->m_row;
+		g_247eModelRootCol = m_root->m_column;
+	}
+
+	const CheckpointHeader& header = reader.getHeader();
+	m_sunPos = TablePos(header.sunRow, header.sunCol);
+	setRandomState(header.randomSeed, header.randomCounter);
+
+	if (outProgress)
+	{
+		outProgress->nextStep = header.autoSimulateNextStep;
+		outProgress->resultsFileOffset = header.autoSimulateResultsOffset;
+		outProgress->csvFileOffset = header.autoSimulateCSVOffset;
+		outProgress->framesFileOffset = header.autoSimulateFramesOffset;
+	}
+
+	return true;
+}
+
 // Initialize from the given expressions
 bool Simulator::initialize_random(int maxBranchDepth)
 {
@@ -110,8 +176,6 @@ bool Simulator::initialize_random(int maxBranchDepth)
 
 bool Simulator::initialize_fromFile(const char* fileToInitializeFrom)
 {
-	m_board.reset();
-
 	ifstream inFile(fileToInitializeFrom);
 
 	if (!inFile.is_open())
@@ -131,48 +195,61 @@ bool Simulator::initialize_fromFile(const char* fileToInitializeFrom)
 		inFile >> g_247eModelRootRow >> g_247eModelRootCol;
 	}
 
-	// Step 1: read board and create the links
-	char buffLine[MAX_COLS + 1];
-	for (int i = 0; i < MAX_ROWS; i++)
+	// Step 1: read the board, boardRows lines (see config.ini). The number of columns is the length of its first line. Blank lines are skipped
+	std::vector<std::string> boardLines;
+	std::string line;
+	while ((int)boardLines.size() < g_boardRows && std::getline(inFile, line))
 	{
-		for (int j = 0; j < MAX_COLS; j++)
+		line.erase(std::remove_if(line.begin(), line.end(), ::isspace), line.end());
+		if (line.empty())
+			continue;
+
+		if (!boardLines.empty() && line.size() != boardLines[0].size())
 		{
-			inFile >> buffLine[j];
-			if (buffLine[j] == '\0' || buffLine[j] == '\r' || buffLine[j] == '\n')
-			{
-				j = -1;
-				continue;
-			}
+			assert(false && "The lines of the board in the input have different sizes !");
+			return false;
 		}
 
-		buffLine[MAX_COLS] = 0;
-
-		assert(strlen(buffLine) == MAX_COLS && "The size of the input is incorrect !");
-		for (int j = 0; j < MAX_COLS; j++)
-		{
-			if (buffLine[j] == BOARD_SKIP_CHARACTER)
-				continue;
+		boardLines.push_back(line);
+	}
 
-			m_board(i, j).setSymbol(buffLine[j]);
-		}
+	if ((int)boardLines.size() != g_boardRows || g_boardRows < 2)
+	{
+		assert(false && "The size of the input is incorrect !");
+		return false;
 	}
+	g_boardCols = (int)boardLines[0].size();
 
 	// The E model has root at any give pos. In TC it is in upper right
 	int rootColumn = g_247eModelRootCol;
 	int rootRow = g_247eModelRootRow;
 	if (g_useEModel == false)
 	{
-		rootColumn = MAX_COLS - 1;
+		rootColumn = g_boardCols - 1;
 		rootRow = 0;
 	}
 
-	m_board.setAvailableSymbols(g_allSymbolsSet);
+	m_board.resizeBoard(g_boardRows, g_boardCols);
 	m_board.setRootLocation(rootRow, rootColumn);
+	m_board.reset();
+
+	for (int i = 0; i < g_boardRows; i++)
+	{
+		for (int j = 0; j < g_boardCols; j++)
+		{
+			if (boardLines[i][j] == BOARD_SKIP_CHARACTER)
+				continue;
+
+			m_board(i, j).setSymbol(boardLines[i][j]);
+		}
+	}
+
+	m_board.setAvailableSymbols(g_allSymbolsSet);
 	m_board.updateBoardAfterSymbolsInit();
 
 	m_root = &m_board(rootRow, rootColumn);
 
-	// Step 2: Populate the sources
+	// Step 2: Populate the sources. Their number follows the board, possibly after blank lines
 	int numSources = 0;
 	inFile >> numSources;
 	for (int i = 0; i < numSources; i++)
@@ -248,6 +325,7 @@ void Simulator::doStepByStepSimulation(const bool writeHelperOutput, std::istrea
 		outStream << "Debug 24e7 model (IF ENABLED): 1 - Run GB 2-expand external 3-expand internal 4-optimize membrane G 5 - optimize by row/column cut  6 - optimize by corner cut\n";
 		outStream << "Undo: U \n";
 		outStream << "Save: V   |   Load: W\n";
+		outStream << "Save checkpoint: K   |   Load checkpoint: L\n";
 		outStream << "Print current board: P\n";
 		outStream << "Quit: Q \n";
 	}
@@ -450,6 +528,25 @@ void Simulator::doStepByStepSimulation(const bool writeHelperOutput, std::istrea
 		}
 		break;
 
+		case 'K':
+		{
+			static char fileNameBuff[2048];
+			if (writeHelperOutput) { outStream << "File name: "; }
+			inStream >> fileNameBuff;
+			saveCheckpoint(fileNameBuff);
+		}
+		break;
+
+		case 'L':
+		{
+			static char fileNameBuff[2048];
+			if (writeHelperOutput) { outStream << "File name: "; }
+			inStream >> fileNameBuff;
+
+			loadCheckpoint(fileNameBuff);
+		}
+		break;
+
 		case 'P':
 		{
 			printBoard(outStream);
@@ -475,6 +572,7 @@ struct LogStep
 	TablePos sourcePos;
 	bool isModfiedSource = false;
 	bool isReorganization = false;
+	AvailablePosInfoAndDeltaScore reorganizeDecision;
 	float sourceNewPower = 0;
 	int id = -1;
 
@@ -496,31 +594,113 @@ struct LogStep
 
 		outStream << endl;
 	}
+
+	// Same as printLog, for the trace renderer
+	void writeTrace(TraceWriter& trace)
+	{
+		TraceRecord record = { TRACE_SOURCE_REMOVED, id, sourcePos.row, sourcePos.col, INVALID_POS, INVALID_POS, sourceNewPower };
+		if (isRemovedSource)
+			trace.write(record);
+
+		record.type = TRACE_SOURCE_ADDED;
+		if (isAddedSource)
+			trace.write(record);
+
+		record.type = TRACE_SOURCE_MODIFIED;
+		if (isModfiedSource)
+			trace.write(record);
+
+		if (isReorganization)
+		{
+			const TraceRecord reorganizeRecord = { TRACE_REORGANIZATION, id, reorganizeDecision.selectedRow, reorganizeDecision.selectedColumn, reorganizeDecision.row, reorganizeDecision.col, reorganizeDecision.score };
+			trace.write(reorganizeRecord);
+		}
+
+		const TraceRecord stepRecord = { TRACE_STEP_END, id, ev, INVALID_POS, INVALID_POS, INVALID_POS, 0.0f };
+		trace.write(stepRecord);
+	}
 };
 
 bool Simulator::autoSimulate(const int numSteps, int minPower, int maxPower, const char* resultsFileName)
 {
-	ofstream outFile("result.txt", std::ofstream::out);
-	assert(outFile.is_open() == true && "can't open the results file ! Is it opened or something ?");
+	// When resuming, the output files are cut back to their size at the checkpoint and written again from there
+	AutoSimulateProgress progress;
+	const bool isResumed = g_resumeAutoSimulate && loadCheckpoint(g_autoSimulateCheckpointFile, &progress);
+	const std::ios::openmode resumeMode = std::ofstream::in | std::ofstream::out;
+	if (isResumed)
+	{
+		bool isTruncated = truncateFile(g_autoSimulateTrace ? g_autoSimulateTraceFile : "result.txt", progress.resultsFileOffset);
+		if (g_outputCSVFileBestSourcesInTime)
+			isTruncated &= truncateFile("Sources.csv", progress.csvFileOffset);
+		if (g_boardFrames && progress.framesFileOffset > 0)
+			isTruncated &= truncateFile(g_boardFramesFile, progress.framesFileOffset);
+
+		if (!isTruncated)
+		{
+			assert(false && "Can't cut the output files back to their size at the checkpoint !");
+		}
+	}
+
+	// With g_autoSimulateTrace the results are written as a binary trace instead of result.txt, see Trace.h
+	TraceWriter trace;
+	ofstream outFile;
+	if (g_autoSimulateTrace)
+	{
+		trace.open(g_autoSimulateTraceFile, progress.resultsFileOffset);
+	}
+	else
+	{
+		outFile.open("result.txt", isResumed ? resumeMode : std::ofstream::out);
+		assert(outFile.is_open() == true && "can't open the results file ! Is it opened or something ?");
+		outFile.seekp(progress.resultsFileOffset);
+	}
 
     ofstream outCSVFile;
     if (g_outputCSVFileBestSourcesInTime)
     {
-        outCSVFile.open("Sources.csv");
+        outCSVFile.open("Sources.csv", isResumed ? resumeMode : std::ofstream::out);
         assert(outCSVFile.is_open() == true && "can't open the Sources.csv file to write the info about the sources! Is it opened or something ?");
-        outCSVFile << "Tick" << "," << "Day" << "," << "Tick of day" << "," << "Source Position" << "," << "Source Power" << endl;
+        if (isResumed)
+        {
+            outCSVFile.seekp(progress.csvFileOffset);
+        }
+        else
+        {
+            outCSVFile << "Tick" << "," << "Day" << "," << "Tick of day" << "," << "Source Position" << "," << "Source Power" << endl;
+        }
     }
 
+	BoardFramesWriter framesWriter;
+	if (g_boardFrames)
+	{
+		framesWriter.open(g_boardFramesFile, g_boardFramesKeyframeInterval, progress.framesFileOffset);
+		m_board.setFramesWriter(&framesWriter);
+	}
+
 	m_board.setUseDelayTicksDataFlowCapture(true); // use by default delay ticks data flow capture
 
 	int day, tickOfDay;
-	for (int i = 0; i < numSteps; i++)
+	for (int i = progress.nextStep; i < numSteps; i++)
 	{
+		if (g_autoSimulateCheckpointInterval > 0 && i % g_autoSimulateCheckpointInterval == 0 && i != progress.nextStep)
+		{
+			AutoSimulateProgress checkpointProgress;
+			checkpointProgress.nextStep = i;
+			checkpointProgress.resultsFileOffset = g_autoSimulateTrace ? trace.flush() : (uint64_t)outFile.flush().tellp();
+			checkpointProgress.csvFileOffset = g_outputCSVFileBestSourcesInTime ? (uint64_t)outCSVFile.flush().tellp() : 0;
+			if (g_boardFrames)
+			{
+				checkpointProgress.framesFileOffset = framesWriter.flush();
+				framesWriter.requestKeyframe(); // The resumed stream starts with a keyframe
+			}
+			saveCheckpoint(g_autoSimulateCheckpointFile, checkpointProgress);
+		}
+
 		// Calculate the current position of the sun
 		day = i / g_numberOfTicksOnDay;
 		tickOfDay = i % g_numberOfTicksOnDay;
-		int sunRow = randRange(0, MAX_ROWS - 1); // TODO-MIRUNA
-		int sunCol = tickOfDay / (g_numberOfTicksOnDay / MAX_COLS);
+		int sunRow = randRange(0, g_boardRows - 1); // TODO-MIRUNA
+		int sunCol = tickOfDay / (g_numberOfTicksOnDay / g_boardCols);
 		m_sunPos = TablePos(sunRow, sunCol);
 		// ----------------------------------
 
@@ -542,15 +722,21 @@ bool Simulator::autoSimulate(const int numSteps, int minPower, int maxPower, con
 		// 40% for reorganization
 		else if (choice <= 7)
 		{
-			if (!(logStep.isReorganization = m_root->onRootMsgReorganize())) // Don't do another reorganization if there is one in progress but simulate the current tick
+			if (!(logStep.isReorganization = m_root->onRootMsgReorganize(&logStep.reorganizeDecision))) // Don't do another reorganization if there is one in progress but simulate the current tick
 			{
 				m_board.doDataFlowSimulation_serial(1);
+
+				if (g_autoSimulateTrace)
+				{
+					const TraceRecord flowRecord = { TRACE_FLOW_SAMPLE, i, INVALID_POS, INVALID_POS, INVALID_POS, INVALID_POS, m_board.getLastSimulationAvgDataFlowPerUnit() };
+					trace.write(flowRecord);
+				}
 			}
 		}
 		else // 30% source events
 		{
-			auto& mapOfSources = m_board.m_posToSourceMap;
-			if (mapOfSources.empty() || choice <= 8)
+			const SourcesTable& sources = m_board.getSources();
+			if (sources.isEmpty() || choice <= 8)
 			{
 				SourceInfo src;
 				float newPower = (float)randRange(minPower, maxPower);
@@ -560,7 +746,7 @@ bool Simulator::autoSimulate(const int numSteps, int minPower, int maxPower, con
                 {
                     outCSVFile << i << "," << day << "," << tickOfDay << "," << std::string(std::to_string(pos.row) + std::string("; ") + std::to_string(pos.col)) << "," << newPower << endl;
                 }
-				//TablePos(randRange(0, MAX_ROWS - 1), randRange(0, MAX_COLS - 1)); // [TODO-MRIUNA] gaussian - media unde bate soarele si cat mai in centru hartii
+				//TablePos(randRange(0, g_boardRows - 1), randRange(0, g_boardCols - 1)); // [TODO-MRIUNA] gaussian - media unde bate soarele si cat mai in centru hartii
 				
 				// variation-cat vreau - niste factori tunabili in config.ini
 				// de simulat distrubutia si de vazut ca merge!
@@ -611,10 +797,24 @@ bool Simulator::autoSimulate(const int numSteps, int minPower, int maxPower, con
 			}
 		}
 
-		logStep.printLog(outFile);
-		printBoard(outFile);
+		if (g_autoSimulateTrace)
+		{
+			logStep.writeTrace(trace);
+			m_board.writeTrace(trace, i);
+		}
+		else
+		{
+			logStep.printLog(outFile);
+			printBoard(outFile);
+		}
+
+		if (g_boardFrames)
+		{
+			framesWriter.writeFrame(m_board.m_board, i);
+		}
 	}
 
+	m_board.setFramesWriter(nullptr);
 	return true;
 }
 
@@ -653,6 +853,15 @@ void Simulator::doDataFlowSimulation_serial(const bool withReconfiguration, std:
 	output << "Per unit of time there is an avg flow of: " << flowRes << endl;
 }
 
+// The flow of a tick simulated on the board itself, bypassing the evaluation cache, with the random numbers of the given seed.
+// Boards that must be the same are compared with it, since the cache would return the flow of any board with the same key
+static float simulateUncachedDataFlow(BoardObject& board, const uint64_t seed)
+{
+	ScopedRandomStream randomStream(seed);
+	board.doDataFlowSimulation_serial(1);
+	return board.getLastSimulationAvgDataFlowPerUnit();
+}
+
 void Simulator::doUnitTests()
 {
 	{
@@ -677,6 +886,73 @@ void Simulator::doUnitTests()
 			optionIter++;
 		}
 	}
+
+#ifdef COUNT_HEAP_ALLOCATIONS
+	// Once its buffers are large enough, a simulation tick must not allocate
+	{
+		BoardObject copyBoard = m_board;
+		copyBoard.doDataFlowSimulation_serial(1);
+
+		uint64_t numHeapAllocations = 0;
+		for (int tickIter = 0; tickIter < 10; tickIter++)
+		{
+			copyBoard.doDataFlowSimulation_serial(1);
+			numHeapAllocations += copyBoard.getLastTickNumHeapAllocations();
+		}
+
+		cout << endl << "Test 2 res: " << endl;
+		cout << "Heap allocations in 10 ticks: " << numHeapAllocations << endl;
+		assert(numHeapAllocations == 0 && "The simulation tick allocated memory");
+	}
+#endif
+
+	// A recycled scratch board must behave like a fresh copy of the board it was acquired from
+	{
+		const int numBoardsCreatedBefore = g_boardObjectPool.getNumBoardsCreated();
+		{
+			BoardObjectPool::BoardPtr usedBoard = g_boardObjectPool.acquireCopy(m_board);
+			SubtreeInfo outSubtree;
+			usedBoard->cutSubtree(0, 3, outSubtree);
+			usedBoard->doDataFlowSimulation_serial(5);
+		}
+
+		BoardObjectPool::BoardPtr recycledBoard = g_boardObjectPool.acquireCopy(m_board);
+		BoardObject freshBoard = m_board;
+		const uint64_t seed = m_board.getEvaluationKey();
+		const float recycledFlow = simulateUncachedDataFlow(*recycledBoard, seed);
+		const float freshFlow = simulateUncachedDataFlow(freshBoard, seed);
+
+		cout << endl << "Test 3 res: " << endl;
+		cout << "Boards created for 2 copies: " << g_boardObjectPool.getNumBoardsCreated() - numBoardsCreatedBefore << " flow recycled: " << recycledFlow << " fresh: " << freshFlow << endl;
+		assert(recycledFlow == freshFlow && "The recycled board differs from a fresh copy");
+	}
+
+	// A board loaded from a checkpoint must be the same as the board saved
+	{
+		const char* checkpointFileName = "unitTest.ckpt";
+		CheckpointWriter writer;
+		m_board.saveCheckpoint(writer);
+		writer.writeToFile(checkpointFileName);
+
+		BoardObject loadedBoard;
+		CheckpointReader reader;
+		const bool isLoaded = reader.open(checkpointFileName) && loadedBoard.loadCheckpoint(reader);
+		assert(isLoaded && "Couldn't load the checkpoint");
+
+		// Unmapped first, a mapped file can't be removed on Windows
+		reader.close();
+		std::remove(checkpointFileName);
+
+		// The simulator's board stays untouched
+		BoardObject savedBoard = m_board;
+		const uint64_t seed = savedBoard.getEvaluationKey();
+		const float savedFlow = simulateUncachedDataFlow(savedBoard, seed);
+		const float loadedFlow = simulateUncachedDataFlow(loadedBoard, seed);
+
+		cout << endl << "Test 4 res: " << endl;
+		cout << "Loaded: " << isLoaded << " same hash: " << (m_board.getEvaluationKey() == loadedBoard.getEvaluationKey()) << " flow saved: " << savedFlow << " loaded: " << loadedFlow << endl;
+		assert(savedFlow == loadedFlow && "The board loaded from the checkpoint differs from the saved one");
+	}
 }
 
 void Simulator::generateOptimalAndRandomBoard(BoardObject& outOptimalBoard, BoardObject& outRandomBoard)
@@ -702,10 +978,10 @@ void Simulator::generateOptimalAndRandomBoard(BoardObject& outOptimalBoard, Boar
 
 	TablePos bestS1, bestS2;
 	float maxFlow = MIN_SCORE;
-	//for (int s1Row = 0; s1Row < MAX_ROWS; s1Row++)
-		//for (int s1Col = 0; s1Col < MAX_COLS; s1Col++)
-			//for (int s2Row = 0; s2Row < MAX_ROWS; s2Row++)
-				//for (int s2Col = 0; s2Col < MAX_COLS; s2Col++)
+	//for (int s1Row = 0; s1Row < g_boardRows; s1Row++)
+		//for (int s1Col = 0; s1Col < g_boardCols; s1Col++)
+			//for (int s2Row = 0; s2Row < g_boardRows; s2Row++)
+				//for (int s2Col = 0; s2Col < g_boardCols; s2Col++)
 				// {
 
 	for (int tryy = 0; tryy < 10; tryy++)
@@ -719,13 +995,13 @@ void Simulator::generateOptimalAndRandomBoard(BoardObject& outOptimalBoard, Boar
 
 		{
 			// Remove all sources and add these two
-			outOptimalBoard.propagateSourceEvent(Cell::EVENT_SOURCE_REMOVE, TablePos(0, 0), SourceInfo(), true);
-
-			// Add the new sources
 			TablePos s1Pos(s1Row, s1Col);
 			TablePos s2Pos(s2Row, s2Col);
-			outOptimalBoard.propagateSourceEvent(Cell::EVENT_SOURCE_ADD, s1Pos, s1Info, false);
-			outOptimalBoard.propagateSourceEvent(Cell::EVENT_SOURCE_ADD, s2Pos, s2Info, false);
+			SourceEventsBatch sourceEvents;
+			sourceEvents.emplace_back(Cell::EVENT_SOURCE_REMOVE, TablePos(0, 0), SourceInfo(), true);
+			sourceEvents.emplace_back(Cell::EVENT_SOURCE_ADD, s1Pos, s1Info);
+			sourceEvents.emplace_back(Cell::EVENT_SOURCE_ADD, s2Pos, s2Info);
+			outOptimalBoard.propagateSourceEvents(sourceEvents);
 
 			outOptimalBoard.doDataFlowSimulation_serial(1);
 			const float flow = outOptimalBoard.getLastSimulationAvgDataFlowPerUnit();
@@ -740,9 +1016,13 @@ void Simulator::generateOptimalAndRandomBoard(BoardObject& outOptimalBoard, Boar
 	}
 
 	// Apply the best option for this board
-	outOptimalBoard.propagateSourceEvent(Cell::EVENT_SOURCE_REMOVE, TablePos(), SourceInfo(), true);
-	outOptimalBoard.propagateSourceEvent(Cell::EVENT_SOURCE_ADD, bestS1, s1Info, false);
-	outOptimalBoard.propagateSourceEvent(Cell::EVENT_SOURCE_ADD, bestS2, s2Info, false);
+	{
+		SourceEventsBatch sourceEvents;
+		sourceEvents.emplace_back(Cell::EVENT_SOURCE_REMOVE, TablePos(), SourceInfo(), true);
+		sourceEvents.emplace_back(Cell::EVENT_SOURCE_ADD, bestS1, s1Info);
+		sourceEvents.emplace_back(Cell::EVENT_SOURCE_ADD, bestS2, s2Info);
+		outOptimalBoard.propagateSourceEvents(sourceEvents);
+	}
 	outOptimalBoard.reorganizeMaxFlow(nullptr);
 
 	// Step 2: copy the optimal board and modify sources then reorganize for a random number of frames. 
@@ -756,14 +1036,16 @@ void Simulator::generateOptimalAndRandomBoard(BoardObject& outOptimalBoard, Boar
 	for (int attemptIter = 0; attemptIter < numAttemptsToModifyStructure; attemptIter++)
 	{
 		// Remove existent sources
-		outRandomBoard.propagateSourceEvent(Cell::EVENT_SOURCE_REMOVE, TablePos(), SourceInfo(), true);
+		SourceEventsBatch sourceEvents;
+		sourceEvents.emplace_back(Cell::EVENT_SOURCE_REMOVE, TablePos(), SourceInfo(), true);
 
 		for (int sourceAddIter = 0; sourceAddIter < g_numSourcesOnRandomBoard; sourceAddIter++)
 		{
 			TablePos pos = getRandomTablePos();
 			SourceInfo s; s.overridePower((float)randRange(g_minPowerForWirelessSource, g_maxPowerForWirelessSource));
-			outRandomBoard.propagateSourceEvent(Cell::EVENT_SOURCE_ADD, pos, s, false);
+			sourceEvents.emplace_back(Cell::EVENT_SOURCE_ADD, pos, s);
 		}
+		outRandomBoard.propagateSourceEvents(sourceEvents);
 
 		// Call reorganize
 		float prevAvgFlow = 0;
@@ -781,13 +1063,56 @@ void Simulator::generateOptimalAndRandomBoard(BoardObject& outOptimalBoard, Boar
 	}
 
 	// Copy the sources from the optimal board to the random one
-	outRandomBoard.propagateSourceEvent(Cell::EVENT_SOURCE_REMOVE, TablePos(), SourceInfo(), true);
-	for (auto& it : outOptimalBoard.m_posToSourceMap)
+	SourceEventsBatch sourceEvents;
+	sourceEvents.emplace_back(Cell::EVENT_SOURCE_REMOVE, TablePos(), SourceInfo(), true);
+	const SourcesTable& optimalSources = outOptimalBoard.getSources();
+	for (int srcIndex = 0; srcIndex < optimalSources.getNumSources(); srcIndex++)
 	{
-		outRandomBoard.propagateSourceEvent(Cell::EVENT_SOURCE_ADD, it.first, it.second, false);
+		sourceEvents.emplace_back(Cell::EVENT_SOURCE_ADD, optimalSources.getPos(srcIndex), optimalSources.getInfo(srcIndex));
 	}
+	outRandomBoard.propagateSourceEvents(sourceEvents);
 }
 
+// Buffers the output and the debug log of scenarios running in parallel.
+// A scenario is written to the targets as soon as all the scenarios before it are done, so the targets get the same text as in a serial run
+class OrderedScenariosOutput
+{
+public:
+	OrderedScenariosOutput(const int numScenarios, std::ostream& outputTarget, std::ostream& logTarget)
+		: m_outputs(numScenarios)
+		, m_logs(numScenarios)
+		, m_isScenarioDone(numScenarios, false)
+		, m_outputTarget(outputTarget)
+		, m_logTarget(logTarget)
+	{
+	}
+
+	std::ostream& getOutput(const int scenario) { return m_outputs[scenario]; }
+	std::ostream& getLog(const int scenario) { return m_logs[scenario]; }
+
+	void onScenarioDone(const int scenario)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_isScenarioDone[scenario] = true;
+		for (; m_nextScenarioToWrite < (int)m_isScenarioDone.size() && m_isScenarioDone[m_nextScenarioToWrite]; m_nextScenarioToWrite++)
+		{
+			m_outputTarget << m_outputs[m_nextScenarioToWrite].str();
+			m_logTarget << m_logs[m_nextScenarioToWrite].str();
+			m_outputs[m_nextScenarioToWrite].str(std::string());
+			m_logs[m_nextScenarioToWrite].str(std::string());
+		}
+	}
+
+private:
+	std::vector<std::ostringstream> m_outputs;
+	std::vector<std::ostringstream> m_logs;
+	std::vector<char> m_isScenarioDone;
+	int m_nextScenarioToWrite = 0;
+	std::mutex m_mutex;
+	std::ostream& m_outputTarget;
+	std::ostream& m_logTarget;
+};
+
 void Simulator::simulateOptimalReconfigurationScenarios(const int numScenarios, const char* filename)
 {
 	// Disable the verbose on this
@@ -816,10 +1141,19 @@ void Simulator::simulateOptimalReconfigurationScenarios(const int numScenarios,
 		int numReconfigMade = 0;
 	};
 
-	std::vector<OptimalVsInitialReconfigFlow> simStats;
+	std::vector<OptimalVsInitialReconfigFlow> simStats(numScenarios, OptimalVsInitialReconfigFlow(0, 0, 0));
 
-	for (int scenario = 0; scenario < numScenarios; scenario++)
+	// The scenarios are independent so they run in parallel, each with its own random stream and output buffers
+	OrderedScenariosOutput scenariosOutput(numScenarios, outputStream, *g_debugLogOutput);
+
+	const uint64_t scenariosSeed = randSeed();
+	g_taskPool.parallelFor(numScenarios, [&](const int scenario)
 	{
+		ScopedRandomStream scenarioStream(combineSeeds(scenariosSeed, scenario));
+		std::ostream& scenarioOutput = scenariosOutput.getOutput(scenario);
+		std::ostream* const prevDebugLogOutput = g_debugLogOutput;
+		g_debugLogOutput = &scenariosOutput.getLog(scenario);
+
 		// Generate an optimal and a random board
 		BoardObject optimalBoard;
 		BoardObject randomBoard;
@@ -828,12 +1162,12 @@ void Simulator::simulateOptimalReconfigurationScenarios(const int numScenarios,
 
 		//if (writeOutput)
 		//{
-		outputStream << " ===== Scenario " << scenario << "=====" << endl;
+		scenarioOutput << " ===== Scenario " << scenario << "=====" << endl;
 		const float optimalBoardMaxFlow = optimalBoard.getLastSimulationAvgDataFlowPerUnit();
-		outputStream << "A. Optimal board with flow " << optimalBoardMaxFlow << " : " << endl;
-		optimalBoard.printBoard(outputStream);
-		outputStream << "B. Random initial board: " << endl;
-		randomBoard.printBoard(outputStream);
+		scenarioOutput << "A. Optimal board with flow " << optimalBoardMaxFlow << " : " << endl;
+		optimalBoard.printBoard(scenarioOutput);
+		scenarioOutput << "B. Random initial board: " << endl;
+		randomBoard.printBoard(scenarioOutput);
 		//}
 
 		// Check how much the random board get to the optima board and after how many reconfiguration
@@ -841,11 +1175,14 @@ void Simulator::simulateOptimalReconfigurationScenarios(const int numScenarios,
 		randomBoard.reorganizeMaxFlow(&numReorganizationsMade);
 
 		const float randomBoardMaxFlow = randomBoard.getLastSimulationAvgDataFlowPerUnit();
-		outputStream << "C. Board after reconfigurations has flow " << randomBoardMaxFlow << endl;
-		randomBoard.printBoard(outputStream);
+		scenarioOutput << "C. Board after reconfigurations has flow " << randomBoardMaxFlow << endl;
+		randomBoard.printBoard(scenarioOutput);
 
-		simStats.push_back(OptimalVsInitialReconfigFlow((int)optimalBoardMaxFlow, (int)randomBoardMaxFlow, numReorganizationsMade));
-	}
+		simStats[scenario] = OptimalVsInitialReconfigFlow((int)optimalBoardMaxFlow, (int)randomBoardMaxFlow, numReorganizationsMade);
+
+		g_debugLogOutput = prevDebugLogOutput;
+		scenariosOutput.onScenarioDone(scenario);
+	});
 
 	ofstream resStatsFile("resultsStats.txt", std::ofstream::out);
 
@@ -881,20 +1218,17 @@ void Simulator::checkSourceModifyEvent(BoardObject& board, const float probForSo
 		if (generateSourceEvent)
 		{
 			// Select one, clear it then create a new one
-			std::vector<TablePos> allSources(board.m_posToSourceMap.size());
-			for (auto it : board.m_posToSourceMap)
+			const int numSources = board.getSources().getNumSources();
+			if (numSources > 0)
 			{
-				allSources.push_back(it.first);
-			}
-
-			const int sourceToDelete = randRange(0, (int)allSources.size() - 1);
-			if (sourceToDelete >= 0)
-			{
-				board.propagateSourceEvent(Cell::EVENT_SOURCE_REMOVE, allSources[sourceToDelete], SourceInfo(), false);
-
+				const TablePos sourceToDelete = board.getSources().getPos(randIndex(numSources));
 				const TablePos newSourcePos = getRandomTablePos();
 				const SourceInfo newSourceInfo = getRandomSourceInfo();
-				board.propagateSourceEvent(Cell::EVENT_SOURCE_ADD, newSourcePos, newSourceInfo, false);
+
+				SourceEventsBatch sourceEvents;
+				sourceEvents.emplace_back(Cell::EVENT_SOURCE_REMOVE, sourceToDelete);
+				sourceEvents.emplace_back(Cell::EVENT_SOURCE_ADD, newSourcePos, newSourceInfo);
+				board.propagateSourceEvents(sourceEvents);
 
 				sourcesModified = true;
 			}
@@ -978,8 +1312,27 @@ void Simulator::simulateOptimalVsRandomFlowScenario(const char* fileToInitialize
 	float avgFlowDynamic = 0.0f;
 	const float probForSourceEvent = ticksBetweenSourceEvent / (float)sampleTicks;
 
-	for (int scenarioIter = 0; scenarioIter < numScenarios; scenarioIter++)
+	// In the E model we initialize a model from file since we don't have yet a random generation procedure
+	// All scenarios start from it, so it is loaded once
+	if (g_useEModel)
 	{
+		initialize_fromFile(fileToInitializeModel);
+	}
+
+	// The scenarios are independent so they run in parallel, each with its own random stream and output buffers.
+	// The flows are summed in scenario order after, so the result is the same as for a serial run
+	std::vector<float> scenariosFlowStatic(numScenarios, 0.0f);
+	std::vector<float> scenariosFlowDynamic(numScenarios, 0.0f);
+	OrderedScenariosOutput scenariosOutput(numScenarios, outStream, *g_debugLogOutput);
+
+	const uint64_t scenariosSeed = randSeed();
+	g_taskPool.parallelFor(numScenarios, [&](const int scenarioIter)
+	{
+		ScopedRandomStream scenarioStream(combineSeeds(scenariosSeed, scenarioIter));
+		std::ostream& scenarioOutput = scenariosOutput.getOutput(scenarioIter);
+		std::ostream* const prevDebugLogOutput = g_debugLogOutput;
+		g_debugLogOutput = &scenariosOutput.getLog(scenarioIter);
+
 		BoardObject* staticBoard = new BoardObject();
 		BoardObject* dynamicBoard = new BoardObject();
 
@@ -990,8 +1343,6 @@ void Simulator::simulateOptimalVsRandomFlowScenario(const char* fileToInitialize
 		}
 		else
 		{
-			// In the E model we initialize a model from file since we don't have yet a random generation procedure
-			initialize_fromFile(fileToInitializeModel);
 			*staticBoard = m_board;
 			*dynamicBoard = m_board;
 		}
@@ -999,20 +1350,37 @@ void Simulator::simulateOptimalVsRandomFlowScenario(const char* fileToInitialize
 
 		float scenarioFlowStatic = 0.0f;
 		float scenarioFlowDynamic = 0.0f;
-		std::srand(FIXED_SEED);
-		simulateFlowScenario(*staticBoard, probForSourceEvent, false, sampleCount, sampleTicks, scenarioFlowStatic, outStream);
-		std::srand(FIXED_SEED);
-		simulateFlowScenario(*dynamicBoard, probForSourceEvent, true, sampleCount, sampleTicks, scenarioFlowDynamic, outStream);
 
-		avgFlowStatic += scenarioFlowStatic;
-		avgFlowDynamic += scenarioFlowDynamic;
+		// Both boards see the same source events
+		const uint64_t sourceEventsSeed = randSeed();
+		{
+			ScopedRandomStream sourceEventsStream(sourceEventsSeed);
+			simulateFlowScenario(*staticBoard, probForSourceEvent, false, sampleCount, sampleTicks, scenarioFlowStatic, scenarioOutput);
+		}
+		{
+			ScopedRandomStream sourceEventsStream(sourceEventsSeed);
+			simulateFlowScenario(*dynamicBoard, probForSourceEvent, true, sampleCount, sampleTicks, scenarioFlowDynamic, scenarioOutput);
+		}
 
-		checkBoardLanguageConstraints();
+		scenariosFlowStatic[scenarioIter] = scenarioFlowStatic;
+		scenariosFlowDynamic[scenarioIter] = scenarioFlowDynamic;
 
 		delete staticBoard;
 		delete dynamicBoard;
+
+		g_debugLogOutput = prevDebugLogOutput;
+		scenariosOutput.onScenarioDone(scenarioIter);
+	});
+
+	for (int scenarioIter = 0; scenarioIter < numScenarios; scenarioIter++)
+	{
+		avgFlowStatic += scenariosFlowStatic[scenarioIter];
+		avgFlowDynamic += scenariosFlowDynamic[scenarioIter];
 	}
 
+	// The scenarios work on their own boards, the simulator's board is the same for all
+	checkBoardLanguageConstraints();
+
 	avgFlowStatic /= numScenarios;
 	avgFlowDynamic /= numScenarios;
 
@@ -1060,19 +1428,19 @@ void Simulator::gatherAllDistinctSymbols(std::vector<char>& symbols)
 
 TablePos Simulator::getSourcePosByNormalDistribution()
 {
-	double mean = 0.0f; // define between 0 and MAX_COLS depends on the position related by sun
+	double mean = 0.0f; // define between 0 and g_boardCols depends on the position related by sun
 	mean = getSunPosition().col;
 
 	std::default_random_engine generator;
 	std::normal_distribution<double> distribution(mean, g_variationDistribution);
 
-	int distributionBoard[MAX_COLS]= { 0 };
+	std::vector<int> distributionBoard(g_boardCols, 0);
 	int nExperiments = 1000;
 	int nStars = 100; // Maximum number of stars to distribute
 	for (int i = 0; i < nExperiments; i++)
 	{
 		double number = distribution(generator);
-		if (number >= 0.0 && number <= MAX_ROWS)
+		if (number >= 0.0 && number < g_boardCols)
 		{
 			distributionBoard[int(number)]++;
 		}
@@ -1080,7 +1448,7 @@ TablePos Simulator::getSourcePosByNormalDistribution()
     if (g_debugSourceEventAutosimulator)
     {
         // For debug to see the distribution
-        for (int i = 0; i < 10; ++i)
+        for (int i = 0; i < g_boardCols; ++i)
         {
             std::cout << i << "-" << (i + 1) << ": ";
             std::cout << std::string((distributionBoard[i] * nStars) / nExperiments, '*') << std::endl;
@@ -1089,7 +1457,7 @@ TablePos Simulator::getSourcePosByNormalDistribution()
 	
 
 	int totalFitness = 0;
-	for (int i = 0; i < 10; ++i)
+	for (int i = 0; i < g_boardCols; ++i)
 	{
 		totalFitness += distributionBoard[i];
 	}
@@ -1100,7 +1468,7 @@ TablePos Simulator::getSourcePosByNormalDistribution()
 	int row = 0; // found the best row
 	TablePos pick = TablePos();
 
-	for (int i = 0; i < MAX_COLS; i++)
+	for (int i = 0; i < g_boardCols; i++)
 	{
 		offset += distributionBoard[i];
 		if (offset >= slice)
@@ -1,7 +1,6 @@
 #ifndef SIMULATOR_BOARD_H
 #define SIMULATOR_BOARD_H
 
-#include <regex>
 #include "Utils.h"
 #include "ExprGenerator.h"
 #include <iostream>
@@ -9,6 +8,15 @@
 #include "BoardObject.h"
 #include <ostream>
 
+// Where an auto simulation is, saved with its checkpoints to resume it
+struct AutoSimulateProgress
+{
+	int nextStep = 0;
+	uint64_t resultsFileOffset = 0; // The sizes of the output files when the step begins
+	uint64_t csvFileOffset = 0;
+	uint64_t framesFileOffset = 0;
+};
+
 // Definition of the simulation bord composing all cells and sources
 struct Simulator
 {
@@ -25,6 +33,9 @@ public:
 	bool removeSource(const TablePos& tablePos);
 
 	// Simulates and outputs result to a file
+	// Writes a checkpoint every g_autoSimulateCheckpointInterval steps. With g_resumeAutoSimulate, continues from the last one with the same output
+	// With g_autoSimulateTrace, the results are a binary trace (see Trace.h) instead of result.txt
+	// With g_boardFrames, the changes of the board are written at the end of each step as frames (see BoardFrames.h)
 	bool autoSimulate(const int numSteps, int minPower, int maxPower, const char* resultsFileName);
 	void doStepByStepSimulation(const bool writeHelperOutput, std::istream& inStream, std::ostream& outStream);
 	
@@ -34,6 +45,10 @@ public:
 	// Save/Load board to file
 	bool saveBoard(const char* fileNameToSave);
 
+	// Save/Load the full state of the simulation (board, sources, sun position and the random numbers) as a binary checkpoint. See Checkpoint.h
+	bool saveCheckpoint(const char* fileNameToSave, const AutoSimulateProgress& progress = AutoSimulateProgress());
+	bool loadCheckpoint(const char* fileToLoadFrom, AutoSimulateProgress* outProgress = nullptr);
+
 	void reorganize(); // Called to optimize the tree
 	bool initialize_random(int maxDepth); // Called to initialize the tree with random nodes by the given specification
 	bool initialize_fromFile(const char* fileToInitializeFrom);
@@ -0,0 +1,147 @@
+#include "TaskPool.h"
+#include <algorithm>
+#include <assert.h>
+
+TaskPool g_taskPool;
+
+static thread_local int t_threadIndex = 0;
+
+int TaskPool::getCurrentThreadIndex()
+{
+	return t_threadIndex;
+}
+
+void TaskPool::init(int numThreads)
+{
+	shutdown();
+
+	if (numThreads <= 0)
+	{
+		numThreads = std::max(1, (int)std::thread::hardware_concurrency());
+	}
+
+	m_isShuttingDown = false;
+	for (int threadIndex = 1; threadIndex < numThreads; threadIndex++)
+	{
+		m_workers.emplace_back(&TaskPool::workerMain, this, threadIndex);
+	}
+}
+
+void TaskPool::shutdown()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		assert(m_activeLoops.empty() && "Can't stop the pool while loops are running");
+		m_isShuttingDown = true;
+	}
+	m_workAvailable.notify_all();
+
+	for (std::thread& worker : m_workers)
+	{
+		worker.join();
+	}
+	m_workers.clear();
+}
+
+void TaskPool::parallelFor(const int numTasks, const std::function<void(int)>& func)
+{
+	// Nothing to share
+	if (m_workers.empty() || numTasks <= 1)
+	{
+		for (int taskIndex = 0; taskIndex < numTasks; taskIndex++)
+		{
+			func(taskIndex);
+		}
+		return;
+	}
+
+	Loop loop;
+	loop.func = &func;
+	loop.numTasks = numTasks;
+	loop.nextTask = 0;
+	loop.numTasksDone = 0;
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_activeLoops.push_back(&loop);
+	}
+	m_workAvailable.notify_all();
+
+	// Work on this loop too, then wait for the tasks taken by the other threads
+	while (runNextTask(loop))
+	{
+	}
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+	auto it = std::find(m_activeLoops.begin(), m_activeLoops.end(), &loop);
+	if (it != m_activeLoops.end())
+	{
+		m_activeLoops.erase(it);
+	}
+
+	m_loopDone.wait(lock, [&loop]() { return loop.numTasksDone == loop.numTasks; });
+}
+
+bool TaskPool::runNextTask(Loop& loop)
+{
+	const int taskIndex = loop.nextTask++;
+	if (taskIndex >= loop.numTasks)
+		return false;
+
+	(*loop.func)(taskIndex);
+
+	// The loop can be gone as soon as its last task is counted, so don't touch it after that
+	const int numTasks = loop.numTasks;
+	if (++loop.numTasksDone == numTasks)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_loopDone.notify_all();
+	}
+
+	return true;
+}
+
+void TaskPool::workerMain(const int threadIndex)
+{
+	t_threadIndex = threadIndex;
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+	while (true)
+	{
+		// Claim a task under the lock, so the loop can't finish before we run it. The latest loop is usually the innermost one
+		Loop* loop = nullptr;
+		int taskIndex = 0;
+		while (!m_activeLoops.empty() && loop == nullptr)
+		{
+			Loop* candidate = m_activeLoops.back();
+			taskIndex = candidate->nextTask++;
+			if (taskIndex < candidate->numTasks)
+			{
+				loop = candidate;
+			}
+			else
+			{
+				m_activeLoops.pop_back(); // All its tasks are taken
+			}
+		}
+
+		if (loop)
+		{
+			lock.unlock();
+			(*loop->func)(taskIndex);
+
+			const int numTasks = loop->numTasks;
+			lock.lock();
+			if (++loop->numTasksDone == numTasks)
+			{
+				m_loopDone.notify_all();
+			}
+			continue;
+		}
+
+		if (m_isShuttingDown)
+			return;
+
+		m_workAvailable.wait(lock);
+	}
+}
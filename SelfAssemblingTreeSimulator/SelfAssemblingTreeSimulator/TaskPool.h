@@ -0,0 +1,60 @@
+#ifndef TASK_POOL_H
+#define TASK_POOL_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+
+// A pool of worker threads running parallel loops.
+// The thread calling parallelFor works on its own loop too, so the loops can be nested: a task can start a loop of its own,
+// and idle workers take tasks from any loop in progress (latest first).
+// The tasks are split dynamically between the threads, so each task must write its result in its own slot. Reduce them after the loop, in index order, to get the same result for any number of threads.
+class TaskPool
+{
+public:
+	TaskPool() = default;
+	~TaskPool() { shutdown(); }
+
+	// Starts the worker threads. numThreads counts the calling thread too; 0 uses all the hardware threads
+	void init(int numThreads);
+	void shutdown();
+
+	// Number of threads that can run tasks: the workers plus the main thread
+	int getNumThreads() const { return (int)m_workers.size() + 1; }
+
+	// Index of the thread running the current task, in [0, getNumThreads()). The main thread is 0
+	static int getCurrentThreadIndex();
+
+	// Runs func(taskIndex) for each taskIndex in [0, numTasks) and returns when all are done
+	void parallelFor(const int numTasks, const std::function<void(int)>& func);
+
+private:
+	TaskPool(const TaskPool& other) = delete;
+	void operator=(const TaskPool& other) = delete;
+
+	struct Loop
+	{
+		const std::function<void(int)>* func;
+		int numTasks;
+		std::atomic<int> nextTask;
+		std::atomic<int> numTasksDone;
+	};
+
+	// Claims and runs a task from the loop. Returns false if there are no tasks left to claim
+	bool runNextTask(Loop& loop);
+	void workerMain(const int threadIndex);
+
+	std::vector<std::thread> m_workers;
+	std::vector<Loop*> m_activeLoops; // Loops that still have tasks to claim
+	std::mutex m_mutex;
+	std::condition_variable m_workAvailable;
+	std::condition_variable m_loopDone;
+	bool m_isShuttingDown = false;
+};
+
+extern TaskPool g_taskPool;
+
+#endif
@@ -0,0 +1,123 @@
+#include "Trace.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <cassert>
+
+static const char TRACE_MAGIC[8] = { 'A', 'G', 'P', 'T', 'R', 'A', 'C', 'E' };
+
+bool isValidTraceHeader(const TraceFileHeader& header)
+{
+	return memcmp(header.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC)) == 0 && header.version == TRACE_VERSION && header.byteOrderMark == TRACE_BYTE_ORDER_MARK;
+}
+
+bool TraceWriter::open(const char* fileName, const uint64_t resumeOffset)
+{
+	close();
+
+	if (resumeOffset > 0)
+	{
+		// The caller cut the file back to the offset, what an interrupted run wrote after it is written again
+		m_file.open(fileName, std::ios::binary | std::ios::in | std::ios::out);
+		m_file.seekp(resumeOffset);
+	}
+	else
+	{
+		m_file.open(fileName, std::ios::binary | std::ios::trunc);
+		TraceFileHeader header;
+		memcpy(header.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+		header.version = TRACE_VERSION;
+		header.byteOrderMark = TRACE_BYTE_ORDER_MARK;
+		m_file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	}
+
+	if (!m_file.good())
+	{
+		assert(false && "The given trace file can't be opened for writing !");
+		m_file.close();
+		return false;
+	}
+
+	m_buffer.resize(BUFFER_SIZE);
+	m_startOffset = resumeOffset > 0 ? resumeOffset : sizeof(TraceFileHeader);
+	m_numBytesQueued = m_numBytesWritten = m_numBytesFlushed = 0;
+	m_isClosing = false;
+	m_thread = std::thread(&TraceWriter::writerMain, this);
+	return true;
+}
+
+void TraceWriter::close()
+{
+	if (!isOpen())
+		return;
+
+	m_isClosing.store(true, std::memory_order_release);
+	m_thread.join();
+	m_file.close();
+}
+
+void TraceWriter::write(const void* data, size_t size)
+{
+	assert(isOpen());
+
+	const char* bytes = static_cast<const char*>(data);
+	uint64_t numBytesQueued = m_numBytesQueued.load(std::memory_order_relaxed);
+	while (size > 0)
+	{
+		const size_t freeSize = BUFFER_SIZE - (size_t)(numBytesQueued - m_numBytesWritten.load(std::memory_order_acquire));
+		if (freeSize == 0)
+		{
+			std::this_thread::yield(); // Wait for the writer thread to make some room
+			continue;
+		}
+
+		const size_t begin = (size_t)(numBytesQueued % BUFFER_SIZE);
+		const size_t chunkSize = std::min(size, std::min(freeSize, BUFFER_SIZE - begin));
+		memcpy(&m_buffer[begin], bytes, chunkSize);
+		bytes += chunkSize;
+		size -= chunkSize;
+		numBytesQueued += chunkSize;
+		m_numBytesQueued.store(numBytesQueued, std::memory_order_release);
+	}
+}
+
+uint64_t TraceWriter::flush()
+{
+	assert(isOpen());
+
+	const uint64_t numBytesQueued = m_numBytesQueued.load(std::memory_order_relaxed);
+	while (m_numBytesFlushed.load(std::memory_order_acquire) < numBytesQueued)
+		std::this_thread::yield();
+
+	return m_startOffset + numBytesQueued;
+}
+
+void TraceWriter::writerMain()
+{
+	for (;;)
+	{
+		const uint64_t numBytesQueued = m_numBytesQueued.load(std::memory_order_acquire);
+		const uint64_t numBytesWritten = m_numBytesWritten.load(std::memory_order_relaxed);
+		if (numBytesQueued == numBytesWritten)
+		{
+			// Flush the file once the queue is empty, to let flush() know the records are in the file
+			if (m_numBytesFlushed.load(std::memory_order_relaxed) != numBytesWritten)
+			{
+				m_file.flush();
+				m_numBytesFlushed.store(numBytesWritten, std::memory_order_release);
+			}
+
+			// The last records are queued before closing
+			if (m_isClosing.load(std::memory_order_acquire) && m_numBytesQueued.load(std::memory_order_acquire) == numBytesWritten)
+				break;
+
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			continue;
+		}
+
+		const size_t begin = (size_t)(numBytesWritten % BUFFER_SIZE);
+		const size_t chunkSize = (size_t)std::min(numBytesQueued - numBytesWritten, (uint64_t)(BUFFER_SIZE - begin));
+		m_file.write(&m_buffer[begin], (std::streamsize)chunkSize);
+		m_numBytesWritten.store(numBytesWritten + chunkSize, std::memory_order_release);
+	}
+}
@@ -0,0 +1,118 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <fstream>
+#include <cstdint>
+#include <cstddef>
+
+// Binary trace of the auto simulator, written instead of the text of result.txt: the events of each step and the board after it.
+// The file is a TraceFileHeader followed by TraceRecord, each one possibly followed by its payload, in the native byte order.
+// The text is rendered offline from it by the trace renderer (TraceRenderer.cpp), the same as the auto simulator would write it.
+// The board frames stream (see BoardFrames.h) is written in the same format, with its own record types.
+// Any change to the records must increase TRACE_VERSION
+#define TRACE_VERSION 2
+#define TRACE_BYTE_ORDER_MARK 0x01020304
+
+enum TraceRecordType
+{
+	TRACE_SOURCE_ADDED,		// (row, col) with value = power
+	TRACE_SOURCE_MODIFIED,	// (row, col) with value = the new power
+	TRACE_SOURCE_REMOVED,	// (row, col)
+	TRACE_REORGANIZATION,	// The subtree of (row, col) moved to (targetRow, targetCol) with value = score. row is INVALID_POS if nothing was moved
+	TRACE_FLOW_SAMPLE,		// value = the average flow of a simulated tick
+	TRACE_STEP_END,			// A logged step, with row = the event chosen. Its events are the records before it with the same step
+	TRACE_BOARD,			// The board after the step, with row, col = its size and targetRow = its number of sources. Followed by row * col TraceCell then the TraceSource
+	TRACE_KEYFRAME,			// All the cells of the board after the step, with row, col = its size. Followed by row * col TraceCell
+	TRACE_FRAME,			// The cells changed since the previous frame, with row, col = the board size and targetRow = their number. Followed by the TraceCellChange
+};
+
+struct TraceFileHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t byteOrderMark;
+};
+
+struct TraceRecord
+{
+	int32_t type;
+	int32_t step;
+	int32_t row, col;
+	int32_t targetRow, targetCol;
+	float value;
+};
+
+// Flags of a TraceCell, next to its CellType in the low bits
+#define TRACE_CELL_TYPE_MASK 0x0F
+#define TRACE_CELL_FREE 0x40
+#define TRACE_CELL_RENTED 0x80
+
+struct TraceCell
+{
+	char symbol;
+	uint8_t flags;
+};
+
+struct TraceCellChange
+{
+	int32_t index; // row * numCols + col
+	TraceCell cell;
+	char padding[2];
+};
+
+struct TraceSource
+{
+	int32_t row, col;
+	float power;
+};
+
+// True if the file starts like a trace of this version, written on a machine with the same byte order
+bool isValidTraceHeader(const TraceFileHeader& header);
+
+// Writes the trace from a background thread. The simulation thread only copies the records in a lock-free ring buffer
+// with a single producer (the simulation) and a single consumer (the writer thread), so it never waits for the file unless the buffer is full
+class TraceWriter
+{
+public:
+	TraceWriter() = default;
+	~TraceWriter() { close(); }
+
+	// Starts a new trace, or continues an existing one from resumeOffset, without its header. The file must have been truncated to resumeOffset
+	bool open(const char* fileName, const uint64_t resumeOffset = 0);
+	// Waits for the queued records to be written
+	void close();
+	bool isOpen() const { return m_thread.joinable(); }
+
+	void write(const void* data, size_t size);
+
+	template <typename T>
+	void write(const T& record) { write(&record, sizeof(T)); }
+
+	template <typename T>
+	void write(const std::vector<T>& records) { write(records.data(), records.size() * sizeof(T)); }
+
+	// Waits until everything queued so far is in the file and returns the file size
+	uint64_t flush();
+
+private:
+	TraceWriter(const TraceWriter& other) = delete;
+	void operator=(const TraceWriter& other) = delete;
+
+	void writerMain();
+
+	static const size_t BUFFER_SIZE = 1 << 20; // Power of two
+
+	std::vector<char> m_buffer;
+	std::atomic<uint64_t> m_numBytesQueued{ 0 };	// Written by the simulation thread only
+	std::atomic<uint64_t> m_numBytesWritten{ 0 };	// Written by the writer thread only
+	std::atomic<uint64_t> m_numBytesFlushed{ 0 };	// Written by the writer thread only
+	std::atomic<bool> m_isClosing{ false };
+	std::thread m_thread;
+	std::ofstream m_file;
+	uint64_t m_startOffset = 0;
+};
+
+#endif
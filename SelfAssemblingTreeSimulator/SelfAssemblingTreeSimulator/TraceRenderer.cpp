@@ -0,0 +1,233 @@
+// Renders the binary trace of the auto simulator (see Trace.h) as the text it writes in result.txt.
+// Built as its own program: traceRenderer <trace file> [output file, result.txt by default] [-events]
+// With -events, every record is printed on a line instead, including the flow samples and the moves decided by the reorganizations.
+// The board frames (see BoardFrames.h) are rendered as the board at each frame
+
+#include "Trace.h"
+#include "Utils.h"
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <cstring>
+
+using namespace std;
+
+// The events of the step being read, indexed by their TraceRecordType
+struct RenderedStep
+{
+	TraceRecord sourceEvents[TRACE_SOURCE_REMOVED + 1];
+	bool hasSourceEvent[TRACE_SOURCE_REMOVED + 1] = {};
+	bool isReorganization = false;
+};
+
+// Same as LogStep::printLog
+static void printStep(const TraceRecord& stepRecord, const RenderedStep& step, ostream& outStream)
+{
+	outStream << "=============== Event:  " << stepRecord.step << "  (ev: " << stepRecord.row << ") ===============" << endl;
+
+	const TraceRecord& removedSource = step.sourceEvents[TRACE_SOURCE_REMOVED];
+	if (step.hasSourceEvent[TRACE_SOURCE_REMOVED])
+		outStream << "Removed source (" << removedSource.row << ", " << removedSource.col << ")" << endl;
+
+	const TraceRecord& addedSource = step.sourceEvents[TRACE_SOURCE_ADDED];
+	if (step.hasSourceEvent[TRACE_SOURCE_ADDED])
+		outStream << "Added source (" << addedSource.row << ", " << addedSource.col << ")" << " power " << addedSource.value << endl;
+
+	const TraceRecord& modifiedSource = step.sourceEvents[TRACE_SOURCE_MODIFIED];
+	if (step.hasSourceEvent[TRACE_SOURCE_MODIFIED])
+		outStream << "Modified source (" << modifiedSource.row << ", " << modifiedSource.col << ")" << " power " << modifiedSource.value << endl;
+
+	if (step.isReorganization)
+		outStream << "Reorganization called !!!";
+
+	outStream << endl;
+}
+
+// The cells as BoardObject::printBoard prints them, without the console colors
+static void printCells(const int numRows, const int numCols, const TraceCell* cells, ostream& outStream)
+{
+	outStream << ' ' << ' ';
+	for (int j = 0; j < numCols; j++)
+		outStream << ' ' << j % 10 << ' ';
+
+	outStream << endl;
+	for (int i = 0; i < numRows; i++)
+	{
+		outStream << i % 10 << ' ';
+
+		for (int j = 0; j < numCols; j++)
+		{
+			const TraceCell& cell = cells[i * numCols + j];
+			outStream << ' ' << ((cell.flags & TRACE_CELL_FREE) ? BOARD_SKIP_CHARACTER : cell.symbol) << ' ';
+		}
+
+		outStream << std::endl;
+	}
+}
+
+// Same as BoardObject::printBoard
+static void printBoard(const TraceRecord& boardRecord, const TraceCell* cells, const TraceSource* sources, ostream& outStream)
+{
+	outStream << "Current board: " << endl;
+	printCells(boardRecord.row, boardRecord.col, cells, outStream);
+
+	outStream << "Current sources ((row,col - power): ";
+	for (int srcIndex = 0; srcIndex < boardRecord.targetRow; srcIndex++)
+	{
+		outStream << " (" << sources[srcIndex].row << ", " << sources[srcIndex].col << ") - " << sources[srcIndex].power;
+	}
+	outStream << endl << endl << endl;
+}
+
+static void printRecord(const TraceRecord& record, ostream& outStream)
+{
+	static const char* const typeNames[] = { "SourceAdded", "SourceModified", "SourceRemoved", "Reorganization", "FlowSample", "StepEnd", "Board", "Keyframe", "Frame" };
+	outStream << record.step << " " << typeNames[record.type] << " (" << record.row << ", " << record.col << ") -> (" << record.targetRow << ", " << record.targetCol << ") " << record.value << endl;
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc < 2)
+	{
+		cout << "Usage: traceRenderer <trace file> [output file] [-events]" << endl;
+		return 1;
+	}
+
+	const bool printEvents = strcmp(argv[argc - 1], "-events") == 0;
+	const char* outFileName = argc - printEvents > 2 ? argv[2] : "result.txt";
+
+	ifstream inFile(argv[1], ios::binary);
+	vector<char> data((istreambuf_iterator<char>(inFile)), istreambuf_iterator<char>());
+	if (data.size() < sizeof(TraceFileHeader) || !isValidTraceHeader(*reinterpret_cast<const TraceFileHeader*>(data.data())))
+	{
+		cout << "The file " << argv[1] << " isn't a trace of this version !" << endl;
+		return 1;
+	}
+
+	ofstream outFile(outFileName);
+	if (!outFile.is_open())
+	{
+		cout << "Can't open " << outFileName << " for writing !" << endl;
+		return 1;
+	}
+
+	RenderedStep step;
+	vector<TraceCell> frameCells; // The board as of the last frame
+	size_t offset = sizeof(TraceFileHeader);
+	bool isComplete = true;
+	while (isComplete && offset + sizeof(TraceRecord) <= data.size())
+	{
+		TraceRecord record;
+		memcpy(&record, &data[offset], sizeof(record));
+		offset += sizeof(record);
+
+		if (record.type < TRACE_SOURCE_ADDED || record.type > TRACE_FRAME)
+		{
+			cout << "Unknown record at offset " << offset - sizeof(record) << " !" << endl;
+			return 1;
+		}
+
+		if (printEvents)
+			printRecord(record, outFile);
+
+		switch (record.type)
+		{
+		case TRACE_SOURCE_ADDED:
+		case TRACE_SOURCE_MODIFIED:
+		case TRACE_SOURCE_REMOVED:
+			step.sourceEvents[record.type] = record;
+			step.hasSourceEvent[record.type] = true;
+			break;
+
+		case TRACE_REORGANIZATION:
+			step.isReorganization = true;
+			break;
+
+		case TRACE_STEP_END:
+			if (!printEvents)
+				printStep(record, step, outFile);
+			step = RenderedStep();
+			break;
+
+		case TRACE_BOARD:
+		{
+			const size_t payloadSize = (size_t)record.row * record.col * sizeof(TraceCell) + (size_t)record.targetRow * sizeof(TraceSource);
+			if (offset + payloadSize > data.size())
+			{
+				offset -= sizeof(record);
+				isComplete = false;
+				break;
+			}
+
+			vector<TraceCell> cells((size_t)record.row * record.col);
+			vector<TraceSource> sources(record.targetRow);
+			memcpy(cells.data(), &data[offset], cells.size() * sizeof(TraceCell));
+			memcpy(sources.data(), &data[offset + cells.size() * sizeof(TraceCell)], sources.size() * sizeof(TraceSource));
+			offset += payloadSize;
+
+			if (!printEvents)
+				printBoard(record, cells.data(), sources.data(), outFile);
+		}
+		break;
+
+		case TRACE_KEYFRAME:
+		case TRACE_FRAME:
+		{
+			const bool isKeyframe = record.type == TRACE_KEYFRAME;
+			const size_t numCells = (size_t)record.row * record.col;
+			const size_t payloadSize = isKeyframe ? numCells * sizeof(TraceCell) : (size_t)record.targetRow * sizeof(TraceCellChange);
+			if (offset + payloadSize > data.size())
+			{
+				offset -= sizeof(record);
+				isComplete = false;
+				break;
+			}
+
+			if (isKeyframe)
+			{
+				frameCells.resize(numCells);
+				memcpy(frameCells.data(), &data[offset], payloadSize);
+			}
+			else if (frameCells.size() != numCells)
+			{
+				cout << "The frame of step " << record.step << " doesn't follow a keyframe !" << endl;
+				return 1;
+			}
+			else
+			{
+				for (int changeIndex = 0; changeIndex < record.targetRow; changeIndex++)
+				{
+					TraceCellChange change;
+					memcpy(&change, &data[offset + changeIndex * sizeof(TraceCellChange)], sizeof(change));
+					if (change.index < 0 || (size_t)change.index >= numCells)
+					{
+						cout << "The frame of step " << record.step << " has a cell out of the board !" << endl;
+						return 1;
+					}
+					frameCells[change.index] = change.cell;
+
+					if (printEvents)
+						outFile << "  (" << change.index / record.col << ", " << change.index % record.col << ") " << change.cell.symbol << " flags " << (int)change.cell.flags << endl;
+				}
+			}
+			offset += payloadSize;
+
+			if (!printEvents)
+			{
+				outFile << "Frame of step " << record.step << (isKeyframe ? " (keyframe)" : "") << ":" << endl;
+				printCells(record.row, record.col, frameCells.data(), outFile);
+				outFile << endl;
+			}
+		}
+		break;
+
+		default:
+			break;
+		}
+	}
+
+	if (offset != data.size())
+		cout << "The trace ends with an incomplete record, it was rendered up to offset " << offset << endl;
+
+	return 0;
+}
@@ -1,30 +1,129 @@
 #include "Utils.h"
 #include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <new>
 #include "Cell.h"
 
 extern int g_minPowerForWirelessSource;
 extern	int g_maxPowerForWirelessSource;
 
+static thread_local RandomStream t_threadStream;
+static thread_local RandomStream* t_randomStream = nullptr; // Installed by ScopedRandomStream, else the thread's own stream is used
+
+static RandomStream& getCurrentRandomStream()
+{
+	return t_randomStream ? *t_randomStream : t_threadStream;
+}
+
+void setRandomSeed(const uint64_t seed)
+{
+	t_threadStream = RandomStream(seed);
+}
+
+void getRandomState(uint64_t& outSeed, uint64_t& outCounter)
+{
+	outSeed = t_threadStream.getSeed();
+	outCounter = t_threadStream.getCounter();
+}
+
+void setRandomState(const uint64_t seed, const uint64_t counter)
+{
+	t_threadStream = RandomStream(seed, counter);
+}
+
+int randInt()
+{
+	return (int)(getCurrentRandomStream().next() >> 33);
+}
+
+int randIndex(int n)
+{
+	return randInt() % n;
+}
+
+uint64_t randSeed()
+{
+	return getCurrentRandomStream().next();
+}
+
+uint64_t RandomStream::at(const uint64_t index) const
+{
+	uint64_t z = m_seed + index * 0x9E3779B97F4A7C15ULL;
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+ScopedRandomStream::ScopedRandomStream(const uint64_t seed)
+	: m_stream(seed)
+	, m_prevStream(t_randomStream)
+{
+	t_randomStream = &m_stream;
+}
+
+ScopedRandomStream::~ScopedRandomStream()
+{
+	t_randomStream = m_prevStream;
+}
+
+#ifdef COUNT_HEAP_ALLOCATIONS
+static thread_local uint64_t t_numHeapAllocations = 0;
+
+// The array versions of the standard library call these ones
+void* operator new(std::size_t size)
+{
+	t_numHeapAllocations++;
+
+	void* ptr = std::malloc(size > 0 ? size : 1);
+	if (ptr == nullptr)
+		throw std::bad_alloc();
+
+	return ptr;
+}
+
+void operator delete(void* ptr) noexcept
+{
+	std::free(ptr);
+}
+
+uint64_t getNumHeapAllocations()
+{
+	return t_numHeapAllocations;
+}
+#else
+uint64_t getNumHeapAllocations()
+{
+	return 0;
+}
+#endif
+
+uint64_t combineSeeds(const uint64_t seed, const uint64_t value)
+{
+	const RandomStream mixer(seed ^ (value * 0x9E3779B97F4A7C15ULL));
+	return mixer.at(1);
+}
+
 int randRange(int min, int max)
 {
-	return min + (rand() % static_cast<int>(max - min + 1));
+	return min + (randInt() % static_cast<int>(max - min + 1));
 }
 
 bool floatEqual(const float val1, const float val2)
 {
-	return std::fabsf(val1 - val2) < EPSILON;
+	return std::fabs(val1 - val2) < EPSILON;
 }
 
 float randUniform()
 {
-	return rand() / (float)RAND_MAX;
+	return randInt() / (float)RAND_INT_MAX;
 }
 
 TablePos getRandomTablePos()
 {
 	TablePos pos;
-	pos.row = randRange(0, MAX_ROWS - 1);
-	pos.col = randRange(0, MAX_COLS - 1);
+	pos.row = randRange(0, g_boardRows - 1);
+	pos.col = randRange(0, g_boardCols - 1);
 	return pos;
 }
 
@@ -37,7 +136,7 @@ SourceInfo getRandomSourceInfo()
 
 bool isCoordinateValid(int row, int col)
 {
-	return (row >= 0 && col >= 0 && row < MAX_ROWS && col < MAX_COLS);
+	return (row >= 0 && col >= 0 && row < g_boardRows && col < g_boardCols);
 }
 
 bool isCoordinateValid(const TablePos& pos)
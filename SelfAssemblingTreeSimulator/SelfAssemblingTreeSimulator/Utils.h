@@ -15,10 +15,13 @@
 #include <assert.h>
 #include <atomic>
 #include <limits.h>
+#include <cstdint>
 
 using uint = unsigned int;
-#define MAX_ROWS 10 // For emodel use 20!
-#define MAX_COLS 10
+
+// Board dimensions, decided at load time: from the input file when initializing from a file, or from config.ini otherwise
+extern int g_boardRows;
+extern int g_boardCols;
 
 #define INVALID_POS -1
 #define MIN_SCORE 0.0f
@@ -36,6 +39,10 @@ using uint = unsigned int;
 
 //#define USE_NODES_SHUFFLING 
 
+// Count the heap allocations of each thread by replacing the global operator new. Used to check that the simulation ticks don't allocate.
+// Opt-in, since it replaces the allocator of the whole program: build with -DCOUNT_HEAP_ALLOCATIONS
+//#define COUNT_HEAP_ALLOCATIONS
+
 struct TablePos
 {
 	TablePos() : row(INVALID_POS), col(INVALID_POS) {}
@@ -65,6 +72,65 @@ bool isCoordinateValid(int row, int col);
 bool isCoordinateValid(const TablePos& pos);
 float randUniform();
 
+// Random numbers don't use the global rand(): each thread draws from its current random stream.
+// The main thread starts with the stream seeded by setRandomSeed (FIXED_SEED normally). Code that can run on any thread, like the tasks of a parallel loop,
+// must install its own stream with ScopedRandomStream, seeded from the stream of the code that started it (randSeed) and the task's id.
+// This way the numbers don't depend on which thread runs what, nor on the platform, and runs are reproducible for any number of threads.
+#define RAND_INT_MAX 0x7FFFFFFF
+
+// Seeds the current thread's own stream
+void setRandomSeed(const uint64_t seed);
+
+// The position of the current thread's own stream, to be saved in a checkpoint and restored to continue the same sequence of numbers
+void getRandomState(uint64_t& outSeed, uint64_t& outCounter);
+void setRandomState(const uint64_t seed, const uint64_t counter);
+
+// Random number in [0, RAND_INT_MAX]. All the random functions above use this
+int randInt();
+
+// Random number in [0, n), to be given to std::random_shuffle
+int randIndex(int n);
+
+// A full 64 bit random number, to seed the streams of sub tasks
+uint64_t randSeed();
+
+// Counter based generator (SplitMix64 output function): the n-th number of a stream depends only on its seed and n,
+// so independent streams are cheap to create and any of their numbers can be computed directly
+struct RandomStream
+{
+	explicit RandomStream(const uint64_t seed = 0, const uint64_t counter = 0) : m_seed(seed), m_counter(counter) {}
+
+	uint64_t next() { return at(++m_counter); }
+	uint64_t at(const uint64_t index) const;
+
+	uint64_t getSeed() const { return m_seed; }
+	uint64_t getCounter() const { return m_counter; }
+
+private:
+	uint64_t m_seed;
+	uint64_t m_counter;
+};
+
+// Installs a random stream on the current thread while in scope
+struct ScopedRandomStream
+{
+	explicit ScopedRandomStream(const uint64_t seed);
+	~ScopedRandomStream();
+
+private:
+	ScopedRandomStream(const ScopedRandomStream& other) = delete;
+	void operator=(const ScopedRandomStream& other) = delete;
+
+	RandomStream m_stream;
+	RandomStream* m_prevStream;
+};
+
+// Derives the seed of an independent stream, e.g. combineSeeds(searchSeed, taskIndex)
+uint64_t combineSeeds(const uint64_t seed, const uint64_t value);
+
+// Number of heap allocations made by the current thread so far. Always 0 without COUNT_HEAP_ALLOCATIONS
+uint64_t getNumHeapAllocations();
+
 TablePos get2DNormDir(const TablePos& from, const TablePos& to);
 
 bool floatEqual(const float val1, const float val2);
@@ -103,7 +169,7 @@ namespace std
 	{
 		size_t operator()(const TablePos& tablePos) const
 		{
-			return tablePos.row * MAX_COLS + tablePos.col;
+			return tablePos.row * g_boardCols + tablePos.col;
 		}
 	};
 }
@@ -132,6 +198,12 @@ struct BufferedTrafficData
 		assert(m_value >= 0.0f);
 	}
 
+	void set(const float _value)
+	{
+		m_value = _value;
+		assert(m_value >= 0.0f && m_value <= m_maxFlowSize);
+	}
+
 	float getCurrentCap() const { return m_value; }
 	void reset() { m_value = 0.0f; }
 
@@ -1,15 +1,20 @@
 #include <iostream>
 #include "SimulatorBoard.h"
+#include "TaskPool.h"
+#include "EvaluationCache.h"
 #include <string.h>
 #include <fstream>
 #include <sstream>
 #include <map>
+#include <ctime>
 
 using namespace std;
 
 // Parameter variables
 int FIXED_SEED = 0;
 bool isFixedSeed = true;
+int g_numThreads = 0; // Threads used by the parallel searches, main thread included. 0 uses all the hardware threads
+int g_evaluationCacheSize = 65536; // Board evaluations kept to be reused when the same board is evaluated again. 0 disables the cache
 std::string exprForRows("4*(2|6)");
 std::string exprForCols("(4|6)2*");
 int g_depthForAutoInitialization = 0;
@@ -38,6 +43,9 @@ int g_simulateOptimalVsRandomFlowScenarios = 0;
 int g_simulateOptimalVsRandomFlowSampleCount = 0;
 int g_avgTickBetweenSourceEvents = 0;
 int g_maxResourcesToRent = 1;
+int g_boardRows = 10;
+int g_boardCols = 10;
+float g_minSourceInfluence = 0.0f; // A source gives nothing to the leaves where power / distance^2 is below this. 0 disables the cut-off
 
 
 bool g_verboseBestGatheredSolutions = true; // print the best gathered solutions
@@ -56,12 +64,21 @@ double g_variationDistribution = 1.0f;
 int g_numberOfTicksOnDay = 30;
 bool g_outputCSVFileBestSourcesInTime = false;
 bool g_debugSourceEventAutosimulator = false;
+int g_autoSimulateCheckpointInterval = 0; // Steps of the auto simulator between checkpoints. 0 disables them
+const char* g_autoSimulateCheckpointFile = "autoSimulate.ckpt";
+bool g_resumeAutoSimulate = false;
+bool g_autoSimulateTrace = false; // Write the results of the auto simulator as a binary trace instead of result.txt
+const char* g_autoSimulateTraceFile = "autoSimulate.trace";
+bool g_boardFrames = false; // Write the changes of the board in the auto simulator as a stream of frames, for visualization
+const char* g_boardFramesFile = "boardFrames.trace";
+int g_boardFramesKeyframeInterval = 100; // Steps between the frames with all the cells
 
-std::ostream* g_debugLogOutput;
+// Per thread, so the scenarios running in parallel can log to their own buffers
+thread_local std::ostream* g_debugLogOutput = &std::cout;
 
 // Globals since we need to extern them
-std::regex g_rowRXExpr;
-std::regex g_colRXExpr;
+Expression_DFA g_rowExprDFA;
+Expression_DFA g_colExprDFA;
 
 bool processCostPerResource(const std::string& str)
 {
@@ -159,6 +176,8 @@ void readInput(const char* configFileName)
 
 		if (key == "isFixedSeed") { isFixedSeed = std::stoi(value) == 1 ? true : false; }
 		else if (key == "FIXED_SEED") { FIXED_SEED = std::stoi(value); }
+		else if (key == "numThreads") { g_numThreads = std::stoi(value); }
+		else if (key == "evaluationCacheSize") { g_evaluationCacheSize = std::stoi(value); }
 		else if (key == "exprForRows") { exprForRows = value; }
 		else if (key == "exprForCols") { exprForCols = value; }
 		else if (key == "depthForAutoInitialization") { g_depthForAutoInitialization = std::stoi(value); }
@@ -181,6 +200,7 @@ void readInput(const char* configFileName)
 		else if (key == "g_costPerResource") { processCostPerResource(value); }
 		else if (key == "g_benefitPerUnitOfFlow") { g_benefitPerUnitOfFlow = std::stof(value); }
 		else if (key == "g_maxFlowPerCell") { g_maxFlowPerCell = std::stoi(value); }
+		else if (key == "g_minSourceInfluence") { g_minSourceInfluence = std::stof(value); }
 		else if (key == "g_ticksToDelayDataFlowCaptureOnRestructure") { g_ticksToDelayDataFlowCaptureOnRestructure = std::stoi(value); }
 		else if (key == "g_simulationTicksForDataFlowEstimation") { g_simulationTicksForDataFlowEstimation = std::stoi(value); }
 		else if (key == "numSourcesOnRandomBoard") { g_numSourcesOnRandomBoard = std::stoi(value); }
@@ -198,6 +218,16 @@ void readInput(const char* configFileName)
 		else if (key == "g_numberOfTicksOnDay") { g_numberOfTicksOnDay = std::stoi(value); }
 		else if (key == "g_outputCSVFileBestSourcesInTime") { g_outputCSVFileBestSourcesInTime = std::stoi(value); }
 		else if (key == "g_debugSourceEventAutosimulator") { g_debugSourceEventAutosimulator = std::stoi(value); }
+		else if (key == "g_autoSimulateCheckpointInterval") { g_autoSimulateCheckpointInterval = std::stoi(value); }
+		else if (key == "g_autoSimulateCheckpointFile") { g_autoSimulateCheckpointFile = strdup(value.c_str()); }
+		else if (key == "g_resumeAutoSimulate") { g_resumeAutoSimulate = std::stoi(value) == 1 ? true : false; }
+		else if (key == "g_autoSimulateTrace") { g_autoSimulateTrace = std::stoi(value) == 1 ? true : false; }
+		else if (key == "g_autoSimulateTraceFile") { g_autoSimulateTraceFile = strdup(value.c_str()); }
+		else if (key == "g_boardFrames") { g_boardFrames = std::stoi(value) == 1 ? true : false; }
+		else if (key == "g_boardFramesFile") { g_boardFramesFile = strdup(value.c_str()); }
+		else if (key == "g_boardFramesKeyframeInterval") { g_boardFramesKeyframeInterval = std::stoi(value); }
+		else if (key == "boardRows") { g_boardRows = std::stoi(value); }
+		else if (key == "boardCols") { g_boardCols = std::stoi(value); }
 		else
 		{
 			ostringstream strErr;
@@ -222,16 +252,20 @@ int main()
 
 	if (isFixedSeed == false)
 	{
-		std::srand((uint)std::time(0));
+		setRandomSeed((uint64_t)std::time(0));
 	}
 	else
 	{
-		std::srand(FIXED_SEED);
+		setRandomSeed(FIXED_SEED);
 	}
+	g_taskPool.init(g_numThreads);
+	g_evaluationCache.init(g_evaluationCacheSize);
+	g_boardObjectPool.init(g_taskPool.getNumThreads());
+
 	// TODO: move these as input for program
 	Simulator simulator(exprForRows, exprForCols, g_speedOnConduct);
-	g_colRXExpr = regex(exprForCols);
-	g_rowRXExpr = regex(exprForRows);
+	g_colExprDFA.compile(exprForCols);
+	g_rowExprDFA.compile(exprForRows);
 
 	g_debugLogOutput = &std::cout;
 	if (g_simulateOptimalVsRandomFlowScenarios)
@@ -246,7 +280,11 @@ int main()
 	}
 	else
 	{
-		if (initializeFromFile)
+		if (initializeFromFile && CheckpointReader::isCheckpointFile(fileToInitializeFrom))
+		{
+			simulator.loadCheckpoint(fileToInitializeFrom);
+		}
+		else if (initializeFromFile)
 		{
 			simulator.initialize_fromFile(fileToInitializeFrom);
 		}
@@ -287,5 +325,9 @@ int main()
 		}
 	}
 
+	// On stderr, since the numbers depend on the threads that raced to evaluate the same boards
+	std::cerr << "Evaluation cache: " << g_evaluationCache.getNumHits() << " hits, " << g_evaluationCache.getNumMisses() << " misses" << std::endl;
+	std::cerr << "Board pool: " << g_boardObjectPool.getNumBoardsCreated() << " boards created for " << g_boardObjectPool.getNumAcquires() << " copies, at most " << g_boardObjectPool.getMaxBoardsInUse() << " in use at once" << std::endl;
+
 	return 0;
 }